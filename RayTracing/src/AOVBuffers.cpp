@@ -0,0 +1,93 @@
+#include "AOVBuffers.h"
+
+#include <limits>
+
+namespace RayTracing {
+	namespace Utils {
+		template<typename T>
+		static void ResizePlane(std::vector<T>& plane, bool enabled, size_t pixelCount, T sky)
+		{
+			if (enabled)
+				plane.assign(pixelCount, sky);
+			else
+				std::vector<T>().swap(plane);
+		}
+	}
+
+	void AOVBuffers::Resize(size_t pixelCount, AOV enabled)
+	{
+		m_Enabled = enabled;
+		Utils::ResizePlane(m_Depth, HasAOV(enabled, AOV::Depth), pixelCount, std::numeric_limits<float>::infinity());
+		for (int i = 0; i < 3; i++)
+		{
+			Utils::ResizePlane(m_Normal[i], HasAOV(enabled, AOV::Normal), pixelCount, 0.0f);
+			Utils::ResizePlane(m_Albedo[i], HasAOV(enabled, AOV::Albedo), pixelCount, 0.0f);
+		}
+		Utils::ResizePlane(m_ObjectIndex, HasAOV(enabled, AOV::ObjectIndex), pixelCount, 0u);
+		Utils::ResizePlane(m_MaterialIndex, HasAOV(enabled, AOV::MaterialIndex), pixelCount, 0u);
+	}
+
+	void AOVBuffers::Release()
+	{
+		Resize(0, AOV::None);
+	}
+
+	size_t AOVBuffers::GetSizeBytes() const
+	{
+		size_t bytes = (m_Depth.size() + m_ObjectIndex.size() + m_MaterialIndex.size()) * sizeof(float);
+		for (int i = 0; i < 3; i++)
+			bytes += (m_Normal[i].size() + m_Albedo[i].size()) * sizeof(float);
+		return bytes;
+	}
+
+	void AOVBuffers::Record(size_t index, float depth, const glm::vec3& normal, const glm::vec3& albedo, uint32_t objectIndex, uint32_t materialIndex)
+	{
+		if (!m_Depth.empty())
+			m_Depth[index] = depth;
+		if (!m_Normal[0].empty())
+		{
+			for (int i = 0; i < 3; i++)
+				m_Normal[i][index] = normal[i];
+		}
+		if (!m_Albedo[0].empty())
+		{
+			for (int i = 0; i < 3; i++)
+				m_Albedo[i][index] = albedo[i];
+		}
+		if (!m_ObjectIndex.empty())
+			m_ObjectIndex[index] = objectIndex + 1;
+		if (!m_MaterialIndex.empty())
+			m_MaterialIndex[index] = materialIndex + 1;
+	}
+
+	void AOVBuffers::RecordMiss(size_t index)
+	{
+		if (!m_Depth.empty())
+			m_Depth[index] = std::numeric_limits<float>::infinity();
+		for (int i = 0; i < 3; i++)
+		{
+			if (!m_Normal[i].empty())
+				m_Normal[i][index] = 0.0f;
+			if (!m_Albedo[i].empty())
+				m_Albedo[i][index] = 0.0f;
+		}
+		if (!m_ObjectIndex.empty())
+			m_ObjectIndex[index] = 0;
+		if (!m_MaterialIndex.empty())
+			m_MaterialIndex[index] = 0;
+	}
+
+	const char* AOVBuffers::GetName(AOV aov)
+	{
+		switch (aov)
+		{
+		case AOV::Depth:         return "depth";
+		case AOV::Normal:        return "normal";
+		case AOV::Albedo:        return "albedo";
+		case AOV::ObjectIndex:   return "object";
+		case AOV::MaterialIndex: return "material";
+		default: break;
+		}
+		return "unknown";
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace RayTracing {
+	// Arbitrary output variables, per-pixel data about the primary hit next to the color.
+	// Combined as flags in Renderer::Settings::AOVs.
+	enum class AOV : uint32_t
+	{
+		None = 0,
+		// Distance along the camera ray, infinity for sky
+		Depth = 1 << 0,
+		// World space, zero for sky
+		Normal = 1 << 1,
+		// Diffuse albedo, white for glass, zero for sky
+		Albedo = 1 << 2,
+		// Sphere index + 1, or sphere count + triangle index + 1 for triangles, 0 for sky
+		ObjectIndex = 1 << 3,
+		// Index into Scene::Materials + 1, 0 for sky
+		MaterialIndex = 1 << 4,
+		All = (1 << 5) - 1
+	};
+
+	inline AOV operator|(AOV a, AOV b) { return (AOV)((uint32_t)a | (uint32_t)b); }
+	inline bool HasAOV(AOV set, AOV aov) { return ((uint32_t)set & (uint32_t)aov) != 0; }
+
+	// Planar buffers for the enabled AOVs, filled from the primary hit of each pixel's latest sample
+	// in the same pass that traces it. Nothing is allocated for disabled AOVs, and with none enabled
+	// the renderer skips recording entirely.
+	class AOVBuffers
+	{
+	public:
+		// Contents are reset to sky
+		void Resize(size_t pixelCount, AOV enabled);
+		void Release();
+
+		void Record(size_t index, float depth, const glm::vec3& normal, const glm::vec3& albedo, uint32_t objectIndex, uint32_t materialIndex);
+		void RecordMiss(size_t index);
+
+		AOV GetEnabled() const { return m_Enabled; }
+		bool IsAllocated() const { return m_Enabled != AOV::None; }
+		size_t GetSizeBytes() const;
+
+		// nullptr for disabled AOVs
+		const float* GetDepth() const { return Data(m_Depth); }
+		const float* GetNormal(int axis) const { return Data(m_Normal[axis]); }
+		const float* GetAlbedo(int channel) const { return Data(m_Albedo[channel]); }
+		const uint32_t* GetObjectIndices() const { return Data(m_ObjectIndex); }
+		const uint32_t* GetMaterialIndices() const { return Data(m_MaterialIndex); }
+
+		static const char* GetName(AOV aov);
+	private:
+		template<typename T>
+		static const T* Data(const std::vector<T>& plane) { return plane.empty() ? nullptr : plane.data(); }
+	private:
+		AOV m_Enabled = AOV::None;
+		std::vector<float> m_Depth;
+		std::vector<float> m_Normal[3];
+		std::vector<float> m_Albedo[3];
+		std::vector<uint32_t> m_ObjectIndex;
+		std::vector<uint32_t> m_MaterialIndex;
+	};
+}
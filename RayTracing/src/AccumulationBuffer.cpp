@@ -0,0 +1,213 @@
+#include "AccumulationBuffer.h"
+
+#include "Random.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace RayTracing {
+	namespace Utils {
+		// Stream of the dither values, far from the bounce indices the path streams use
+		static constexpr uint32_t DitherStream = 0xffffffffu;
+
+		static constexpr float HalfMax = 65504.0f;
+		// 2^-14, below it halves are denormal multiples of 2^-24
+		static constexpr float HalfMinNormal = 6.103515625e-05f;
+
+		// Rounds value up with the probability of its fractional part. dither is uniform in [0, 2^32).
+		static uint32_t RoundStochastic(float value, uint32_t dither)
+		{
+			float whole = std::floor(value);
+			return (uint32_t)whole + (value - whole > (float)(dither >> 8) * (1.0f / 16777216.0f) ? 1u : 0u);
+		}
+
+		static uint16_t FloatToHalf(float value, uint32_t dither)
+		{
+			// Light is never negative, and a NaN sample must not poison the pixel
+			if (!(value > 0.0f))
+				return 0;
+			if (value >= HalfMax)
+				return 0x7bff;
+
+			if (value < HalfMinNormal)
+				return (uint16_t)RoundStochastic(value * 16777216.0f, dither); // reaching 1024 is the smallest normal
+
+			// Half keeps the top 10 of the 23 mantissa bits. Adding random low bits before cutting
+			// them off rounds up with the probability of the part that is cut off.
+			uint32_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			bits = (bits + (dither & 0x1fffu)) & ~0x1fffu;
+
+			uint32_t exponent = (bits >> 23) - 127 + 15;
+			if (exponent >= 31)
+				return 0x7bff;
+			return (uint16_t)((exponent << 10) | ((bits >> 13) & 0x3ffu));
+		}
+
+		static float HalfToFloat(uint16_t half)
+		{
+			uint32_t exponent = (half >> 10) & 0x1fu;
+			uint32_t mantissa = half & 0x3ffu;
+			if (exponent == 0)
+				return (float)mantissa * (1.0f / 16777216.0f);
+
+			uint32_t bits = ((exponent - 15 + 127) << 23) | (mantissa << 13);
+			float value;
+			memcpy(&value, &bits, sizeof(value));
+			return value;
+		}
+
+		// RGB9E5 as in EXT_texture_shared_exponent: no implicit leading bit, exponent bias 15
+		static constexpr int SharedExponentBias = 15;
+		static constexpr int SharedMantissaBits = 9;
+		static constexpr float SharedExponentMax = (511.0f / 512.0f) * 65536.0f;
+
+		static uint32_t EncodeSharedExponent(glm::vec3 color, RandomStream& random)
+		{
+			for (int i = 0; i < 3; i++)
+				color[i] = color[i] > 0.0f ? std::min(color[i], SharedExponentMax) : 0.0f;
+
+			float maxChannel = std::max(color.r, std::max(color.g, color.b));
+			if (maxChannel <= 0.0f)
+				return 0;
+
+			// The brightest channel gets a mantissa in [256, 512)
+			int exponent;
+			std::frexp(maxChannel, &exponent);
+			exponent = std::max(exponent + SharedExponentBias, 0);
+
+			uint32_t dither[3] = { random.UInt(), random.UInt(), random.UInt() };
+			uint32_t mantissas[3];
+			while (true)
+			{
+				float scale = std::ldexp(1.0f, SharedMantissaBits + SharedExponentBias - exponent);
+				for (int i = 0; i < 3; i++)
+					mantissas[i] = RoundStochastic(color[i] * scale, dither[i]);
+
+				// Rounded up past 9 bits, one exponent step higher fits
+				if (std::max(mantissas[0], std::max(mantissas[1], mantissas[2])) < (1u << SharedMantissaBits))
+					break;
+				exponent++;
+			}
+
+			return mantissas[0] | (mantissas[1] << 9) | (mantissas[2] << 18) | ((uint32_t)exponent << 27);
+		}
+
+		static glm::vec3 DecodeSharedExponent(uint32_t packed)
+		{
+			int exponent = (int)(packed >> 27);
+			float scale = std::ldexp(1.0f, exponent - SharedExponentBias - SharedMantissaBits);
+			return glm::vec3((float)(packed & 0x1ffu), (float)((packed >> 9) & 0x1ffu), (float)((packed >> 18) & 0x1ffu)) * scale;
+		}
+	}
+
+	size_t AccumulationBuffer::GetBytesPerPixel(AccumulationFormat format)
+	{
+		switch (format)
+		{
+		case AccumulationFormat::Half:
+			return 3 * sizeof(uint16_t);
+		case AccumulationFormat::SharedExponent:
+			return sizeof(uint32_t);
+		default:
+			return sizeof(glm::vec3);
+		}
+	}
+
+	const char* AccumulationBuffer::GetName(AccumulationFormat format)
+	{
+		switch (format)
+		{
+		case AccumulationFormat::Half:
+			return "half";
+		case AccumulationFormat::SharedExponent:
+			return "rgb9e5";
+		default:
+			return "float";
+		}
+	}
+
+	void AccumulationBuffer::Resize(size_t pixelCount, AccumulationFormat format)
+	{
+		if (m_PixelCount == pixelCount && m_Format == format && IsAllocated())
+			return;
+
+		m_Format = format;
+		m_PixelCount = pixelCount;
+		// Not shrink_to_fit, a resize back to the old size should not allocate again
+		m_Data.resize(pixelCount * GetBytesPerPixel(format));
+	}
+
+	void AccumulationBuffer::Release()
+	{
+		std::vector<uint8_t>().swap(m_Data);
+		m_PixelCount = 0;
+	}
+
+	void AccumulationBuffer::Clear()
+	{
+		memset(m_Data.data(), 0, m_Data.size());
+	}
+
+	void AccumulationBuffer::AddSamples(size_t index, const glm::vec3& sum, uint32_t addedSamples, uint32_t sampleCount, uint32_t ditherSeed)
+	{
+		if (m_Format == AccumulationFormat::Float32)
+		{
+			reinterpret_cast<glm::vec3*>(m_Data.data())[index] += sum;
+			return;
+		}
+
+		// mean_n = mean_m + (sum - k * mean_m) / n, the incremental form of sum_n / n
+		glm::vec3 mean = GetMean(index, sampleCount - addedSamples);
+		mean += (sum - (float)addedSamples * mean) / (float)sampleCount;
+		SetMean(index, mean, sampleCount, ditherSeed);
+	}
+
+	void AccumulationBuffer::SetMean(size_t index, const glm::vec3& mean, uint32_t sampleCount, uint32_t ditherSeed)
+	{
+		switch (m_Format)
+		{
+		case AccumulationFormat::Float32:
+			reinterpret_cast<glm::vec3*>(m_Data.data())[index] = mean * (float)sampleCount;
+			break;
+		case AccumulationFormat::Half:
+		{
+			RandomStream random(ditherSeed, Utils::DitherStream);
+			uint16_t* half = reinterpret_cast<uint16_t*>(m_Data.data()) + index * 3;
+			for (int i = 0; i < 3; i++)
+				half[i] = Utils::FloatToHalf(mean[i], random.UInt());
+			break;
+		}
+		case AccumulationFormat::SharedExponent:
+		{
+			RandomStream random(ditherSeed, Utils::DitherStream);
+			reinterpret_cast<uint32_t*>(m_Data.data())[index] = Utils::EncodeSharedExponent(mean, random);
+			break;
+		}
+		}
+	}
+
+	glm::vec3 AccumulationBuffer::GetMean(size_t index, uint32_t sampleCount) const
+	{
+		switch (m_Format)
+		{
+		case AccumulationFormat::Half:
+		{
+			const uint16_t* half = reinterpret_cast<const uint16_t*>(m_Data.data()) + index * 3;
+			return glm::vec3(Utils::HalfToFloat(half[0]), Utils::HalfToFloat(half[1]), Utils::HalfToFloat(half[2]));
+		}
+		case AccumulationFormat::SharedExponent:
+			return Utils::DecodeSharedExponent(reinterpret_cast<const uint32_t*>(m_Data.data())[index]);
+		default:
+			return reinterpret_cast<const glm::vec3*>(m_Data.data())[index] / (float)std::max(sampleCount, 1u);
+		}
+	}
+
+	glm::vec3 AccumulationBuffer::GetSum(size_t index, uint32_t sampleCount) const
+	{
+		if (m_Format == AccumulationFormat::Float32)
+			return reinterpret_cast<const glm::vec3*>(m_Data.data())[index];
+		return GetMean(index, sampleCount) * (float)sampleCount;
+	}
+}
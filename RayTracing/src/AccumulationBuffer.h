@@ -0,0 +1,62 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace RayTracing {
+	// How the accumulated samples of each pixel are stored. The sample count is kept by the
+	// renderer, so no format spends a channel on it.
+	enum class AccumulationFormat
+	{
+		// Sum of the samples in 3 floats, 12 bytes. Exact up to float addition.
+		Float32 = 0,
+		// Running mean in 3 IEEE half floats, 6 bytes
+		Half,
+		// Running mean in RGB9E5, three 9 bit mantissas sharing a 5 bit exponent, 4 bytes
+		SharedExponent
+	};
+
+	// Per-pixel accumulation in one of the formats above.
+	//
+	// The compact formats store the mean instead of the sum so the stored value does not grow
+	// with the sample count. Every update is rounded stochastically, which keeps the mean unbiased:
+	// after n samples the rounding only adds noise, with a standard deviation of at most
+	// ulp * sqrt(n / 12) where ulp is the spacing of representable values around the mean,
+	// 2^-10 of the channel for Half and 2^-8 of the brightest channel for SharedExponent.
+	// At 256 spp that is 0.5% (Half) and 1.8% (SharedExponent) of the linear value, around one
+	// 8-bit display step, so they suit previews and very large frames rather than final renders.
+	class AccumulationBuffer
+	{
+	public:
+		// Contents are undefined until Clear
+		void Resize(size_t pixelCount, AccumulationFormat format);
+		void Release();
+		void Clear();
+
+		// Adds addedSamples samples summing to sum to a pixel that holds sampleCount samples
+		// afterwards. ditherSeed drives the stochastic rounding and should differ per pixel and update.
+		void AddSamples(size_t index, const glm::vec3& sum, uint32_t addedSamples, uint32_t sampleCount, uint32_t ditherSeed);
+		// Replaces a pixel with sampleCount samples averaging mean
+		void SetMean(size_t index, const glm::vec3& mean, uint32_t sampleCount, uint32_t ditherSeed);
+
+		glm::vec3 GetMean(size_t index, uint32_t sampleCount) const;
+		glm::vec3 GetSum(size_t index, uint32_t sampleCount) const;
+
+		AccumulationFormat GetFormat() const { return m_Format; }
+		size_t GetPixelCount() const { return m_PixelCount; }
+		bool IsAllocated() const { return !m_Data.empty(); }
+		// Raw storage, for checkpoints
+		const uint8_t* GetData() const { return m_Data.data(); }
+		uint8_t* GetData() { return m_Data.data(); }
+		size_t GetSizeBytes() const { return m_Data.size(); }
+
+		static size_t GetBytesPerPixel(AccumulationFormat format);
+		static const char* GetName(AccumulationFormat format);
+	private:
+		AccumulationFormat m_Format = AccumulationFormat::Float32;
+		size_t m_PixelCount = 0;
+		std::vector<uint8_t> m_Data;
+	};
+}
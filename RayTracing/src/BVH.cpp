@@ -0,0 +1,612 @@
+#include "BVH.h"
+
+#include "Walnut/Timer.h"
+
+#include <algorithm>
+#include <cfloat>
+
+#if defined(__x86_64__) || defined(_M_X64)
+	#define RT_X64 1
+	#include <immintrin.h>
+#endif
+
+namespace RayTracing {
+	namespace Utils {
+		static constexpr uint32_t SAHBinCount = 16;
+		// Leaves are tested 4/8 spheres at a time, so they can hold a full vector
+		static constexpr uint32_t MaxLeafSize = 8;
+
+		// SAH costs relative to one ray-sphere test. A node visit costs about as
+		// much as a few vectorized sphere tests.
+		static constexpr float TraversalCost = 4.0f;
+
+		// Rounding in the slab test can put the exit just before the entry for rays grazing a
+		// node's bounds, e.g. through a triangle vertex on the boundary. Scaling the exit by
+		// 1 + 2 * gamma(3) keeps such nodes (Ize, "Robust BVH Ray Traversal", JCGT 2013).
+		static constexpr float RobustExitScale = 1.0f + 2.0f * (3.0f * FLT_EPSILON * 0.5f) / (1.0f - 3.0f * FLT_EPSILON * 0.5f);
+
+		struct Bounds
+		{
+			glm::vec3 Min{ FLT_MAX };
+			glm::vec3 Max{ -FLT_MAX };
+
+			void Grow(const glm::vec3& point)
+			{
+				Min = glm::min(Min, point);
+				Max = glm::max(Max, point);
+			}
+
+			void Grow(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+			{
+				Min = glm::min(Min, boundsMin);
+				Max = glm::max(Max, boundsMax);
+			}
+
+			float Area() const
+			{
+				glm::vec3 extent = Max - Min;
+				if (extent.x < 0.0f)
+					return 0.0f;
+				return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+			}
+		};
+
+		static float IntersectBounds(const BVH::Node& node, const glm::vec3& origin, const glm::vec3& invDirection, float hitDistance)
+		{
+			glm::vec3 t0 = (node.BoundsMin - origin) * invDirection;
+			glm::vec3 t1 = (node.BoundsMax - origin) * invDirection;
+			glm::vec3 tNear = glm::min(t0, t1);
+			glm::vec3 tFar = glm::max(t0, t1);
+
+			float entry = std::max(std::max(tNear.x, tNear.y), tNear.z);
+			float exit = std::min(std::min(tFar.x, tFar.y), tFar.z) * RobustExitScale;
+			if (exit < entry || exit <= 0.0f || entry >= hitDistance)
+				return FLT_MAX;
+			return entry;
+		}
+
+		// Bit i is set if ray i of the packet enters the node before its current hit
+		static uint32_t IntersectBoundsPacket(const BVH::Node& node, const RayPacket& packet)
+		{
+			uint32_t mask = 0;
+#ifdef RT_X64
+			const __m128 minX = _mm_set1_ps(node.BoundsMin.x), minY = _mm_set1_ps(node.BoundsMin.y), minZ = _mm_set1_ps(node.BoundsMin.z);
+			const __m128 maxX = _mm_set1_ps(node.BoundsMax.x), maxY = _mm_set1_ps(node.BoundsMax.y), maxZ = _mm_set1_ps(node.BoundsMax.z);
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 exitScale = _mm_set1_ps(RobustExitScale);
+			for (uint32_t i = 0; i < packet.Count; i += 4)
+			{
+				__m128 ox = _mm_load_ps(&packet.OriginX[i]), oy = _mm_load_ps(&packet.OriginY[i]), oz = _mm_load_ps(&packet.OriginZ[i]);
+				__m128 ix = _mm_load_ps(&packet.InvDirectionX[i]), iy = _mm_load_ps(&packet.InvDirectionY[i]), iz = _mm_load_ps(&packet.InvDirectionZ[i]);
+
+				__m128 tx0 = _mm_mul_ps(_mm_sub_ps(minX, ox), ix), tx1 = _mm_mul_ps(_mm_sub_ps(maxX, ox), ix);
+				__m128 ty0 = _mm_mul_ps(_mm_sub_ps(minY, oy), iy), ty1 = _mm_mul_ps(_mm_sub_ps(maxY, oy), iy);
+				__m128 tz0 = _mm_mul_ps(_mm_sub_ps(minZ, oz), iz), tz1 = _mm_mul_ps(_mm_sub_ps(maxZ, oz), iz);
+
+				__m128 entry = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)), _mm_min_ps(tz0, tz1));
+				__m128 exit = _mm_mul_ps(_mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)), _mm_max_ps(tz0, tz1)), exitScale);
+
+				__m128 hit = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(exit, entry), _mm_cmpgt_ps(exit, zero)),
+					_mm_cmplt_ps(entry, _mm_load_ps(&packet.HitDistance[i])));
+				mask |= (uint32_t)_mm_movemask_ps(hit) << i;
+			}
+#else
+			for (uint32_t i = 0; i < packet.Count; i++)
+			{
+				glm::vec3 origin(packet.OriginX[i], packet.OriginY[i], packet.OriginZ[i]);
+				glm::vec3 invDirection(packet.InvDirectionX[i], packet.InvDirectionY[i], packet.InvDirectionZ[i]);
+				if (IntersectBounds(node, origin, invDirection, packet.HitDistance[i]) != FLT_MAX)
+					mask |= 1u << i;
+			}
+#endif
+			// Lanes past Count have HitDistance -1 and never pass
+			return mask;
+		}
+
+		// Woop, Benthin and Wald, "Watertight Ray/Triangle Intersection", JCGT 2013.
+		// Updates hitDistance if the triangle is hit with 0 < t < hitDistance.
+		static bool IntersectTriangle(const BVH::WatertightRay& ray, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, float& hitDistance)
+		{
+			const int kx = ray.Axis[0], ky = ray.Axis[1], kz = ray.Axis[2];
+			glm::vec3 a = v0 - ray.Origin;
+			glm::vec3 b = v1 - ray.Origin;
+			glm::vec3 c = v2 - ray.Origin;
+
+			float ax = a[kx] - ray.Shear.x * a[kz];
+			float ay = a[ky] - ray.Shear.y * a[kz];
+			float bx = b[kx] - ray.Shear.x * b[kz];
+			float by = b[ky] - ray.Shear.y * b[kz];
+			float cx = c[kx] - ray.Shear.x * c[kz];
+			float cy = c[ky] - ray.Shear.y * c[kz];
+
+			float u = cx * by - cy * bx;
+			float v = ax * cy - ay * cx;
+			float w = bx * ay - by * ax;
+
+			// The ray passes through an edge or vertex, redo the edge tests exactly so
+			// neighbouring triangles agree on who owns it
+			if (u == 0.0f || v == 0.0f || w == 0.0f)
+			{
+				u = (float)((double)cx * by - (double)cy * bx);
+				v = (float)((double)ax * cy - (double)ay * cx);
+				w = (float)((double)bx * ay - (double)by * ax);
+			}
+
+			if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+				return false;
+
+			float determinant = u + v + w;
+			if (determinant == 0.0f)
+				return false;
+
+			float t = u * ray.Shear.z * a[kz] + v * ray.Shear.z * b[kz] + w * ray.Shear.z * c[kz];
+			// Compare t / determinant against the range without dividing
+			if (determinant < 0.0f)
+			{
+				t = -t;
+				determinant = -determinant;
+			}
+			if (t <= 0.0f || t >= hitDistance * determinant)
+				return false;
+
+			hitDistance = t / determinant;
+			return true;
+		}
+	}
+
+	BVH::WatertightRay::WatertightRay(const Ray& ray)
+		: Origin(ray.Origin)
+	{
+		glm::vec3 absDirection = glm::abs(ray.Direction);
+		int kz = absDirection.x > absDirection.y ? (absDirection.x > absDirection.z ? 0 : 2) : (absDirection.y > absDirection.z ? 1 : 2);
+		int kx = (kz + 1) % 3;
+		int ky = (kx + 1) % 3;
+		// Keep the winding of the projected triangle
+		if (ray.Direction[kz] < 0.0f)
+			std::swap(kx, ky);
+
+		Axis[0] = kx;
+		Axis[1] = ky;
+		Axis[2] = kz;
+		Shear.x = ray.Direction[kx] / ray.Direction[kz];
+		Shear.y = ray.Direction[ky] / ray.Direction[kz];
+		Shear.z = 1.0f / ray.Direction[kz];
+	}
+
+	void BVH::Build(const std::vector<Sphere>& spheres, const std::vector<Material>& materials)
+	{
+		Walnut::Timer timer;
+
+		Clear();
+		if (spheres.empty())
+			return;
+
+		std::vector<BuildPrimitive> primitives(spheres.size());
+		for (size_t i = 0; i < spheres.size(); i++)
+		{
+			const Sphere& sphere = spheres[i];
+			glm::vec3 radius(std::abs(sphere.Radius));
+			primitives[i].BoundsMin = sphere.Position - radius;
+			primitives[i].BoundsMax = sphere.Position + radius;
+			primitives[i].Centroid = sphere.Position;
+		}
+
+		BuildNodes(primitives);
+		m_Spheres.Build(spheres, materials, m_PrimitiveIndices);
+		std::vector<uint32_t>().swap(m_PrimitiveIndices);
+
+		// The float arrays are padded past Count
+		size_t sphereBytes = m_Spheres.CenterX.size() * 5 * sizeof(float) + m_Spheres.SphereIndex.size() * sizeof(uint32_t);
+		m_BuildStats.MemoryBytes = m_Nodes.size() * sizeof(Node) + sphereBytes;
+		m_BuildStats.BuildTimeMs = timer.ElapsedMillis();
+	}
+
+	void BVH::Build(const std::vector<glm::vec3>& vertices, const std::vector<Triangle>& triangles, const std::vector<Material>& materials, uint32_t firstIndex)
+	{
+		Walnut::Timer timer;
+
+		Clear();
+		if (triangles.empty())
+			return;
+
+		std::vector<BuildPrimitive> primitives(triangles.size());
+		for (size_t i = 0; i < triangles.size(); i++)
+		{
+			const Triangle& triangle = triangles[i];
+			Utils::Bounds bounds;
+			for (uint32_t corner = 0; corner < 3; corner++)
+				bounds.Grow(vertices[triangle.Indices[corner]]);
+			primitives[i].BoundsMin = bounds.Min;
+			primitives[i].BoundsMax = bounds.Max;
+			primitives[i].Centroid = (bounds.Min + bounds.Max) * 0.5f;
+		}
+
+		BuildNodes(primitives);
+
+		// Leaves read the scene's buffers through the build order, so the mesh is never copied
+		m_Vertices = &vertices;
+		m_Triangles = &triangles;
+		m_FirstIndex = firstIndex;
+		for (uint32_t& triangleIndex : m_PrimitiveIndices)
+		{
+			const Triangle& triangle = triangles[triangleIndex];
+			bool validMaterial = triangle.MaterialIndex >= 0 && triangle.MaterialIndex < (int)materials.size();
+			if (validMaterial && materials[triangle.MaterialIndex].Type == MaterialType::Glass)
+				triangleIndex |= ShadowTransparentBit;
+		}
+
+		m_BuildStats.MemoryBytes = m_Nodes.size() * sizeof(Node) + m_PrimitiveIndices.size() * sizeof(uint32_t);
+		m_BuildStats.BuildTimeMs = timer.ElapsedMillis();
+	}
+
+	void BVH::BuildNodes(const std::vector<BuildPrimitive>& primitives)
+	{
+		m_PrimitiveIndices.resize(primitives.size());
+		for (size_t i = 0; i < primitives.size(); i++)
+			m_PrimitiveIndices[i] = (uint32_t)i;
+
+		// A binary tree over N leaves never needs more than 2N - 1 nodes
+		m_Nodes.reserve(primitives.size() * 2 - 1);
+		Node& root = m_Nodes.emplace_back();
+		root.LeftFirst = 0;
+		root.Count = (uint32_t)primitives.size();
+
+		Subdivide(0, primitives, 1);
+
+		m_Nodes.shrink_to_fit();
+		m_BuildStats.NodeCount = (uint32_t)m_Nodes.size();
+	}
+
+	void BVH::Clear()
+	{
+		m_Nodes.clear();
+		m_PrimitiveIndices.clear();
+		m_Spheres.Clear();
+		m_Vertices = nullptr;
+		m_Triangles = nullptr;
+		m_FirstIndex = 0;
+		m_BuildStats = BuildStats();
+	}
+
+	void BVH::SetSIMDLevel(SIMDLevel level)
+	{
+		m_Kernel = SphereKernels::Get(level);
+		m_SIMDLevel = std::min(level, CPUFeatures::DetectSIMDLevel());
+	}
+
+	int BVH::Intersect(const Ray& ray, float& hitDistance, bool shadowRay, TraversalStats* stats) const
+	{
+		if (m_Nodes.empty())
+			return -1;
+
+		const float* radiusSquared = shadowRay ? m_Spheres.ShadowRadiusSquared.data() : m_Spheres.RadiusSquared.data();
+		glm::vec3 invDirection = 1.0f / ray.Direction;
+		int closest = -1;
+
+		bool triangles = m_Triangles != nullptr;
+		WatertightRay triangleRay = triangles ? WatertightRay(ray) : WatertightRay();
+
+		// Far children are pushed with their entry distance so they can be culled
+		// if a closer hit turns up before they are popped
+		uint32_t stack[MaxTreeDepth];
+		float stackDistance[MaxTreeDepth];
+		uint32_t stackSize = 0;
+
+		uint32_t nodeIndex = 0;
+		if (Utils::IntersectBounds(m_Nodes[0], ray.Origin, invDirection, hitDistance) == FLT_MAX)
+			return -1;
+
+		while (true)
+		{
+			const Node& node = m_Nodes[nodeIndex];
+			if (stats)
+				stats->NodesVisited++;
+
+			bool descend = false;
+			if (node.Count > 0)
+			{
+				int hit;
+				if (triangles)
+					hit = IntersectTriangles(node.LeftFirst, node.Count, triangleRay, hitDistance, shadowRay);
+				else
+					hit = m_Kernel(m_Spheres, radiusSquared, node.LeftFirst, node.Count, ray.Origin, ray.Direction, hitDistance);
+				if (hit >= 0)
+					closest = hit;
+				if (stats)
+					(triangles ? stats->TriangleTests : stats->SphereTests) += node.Count;
+			}
+			else
+			{
+				// Visit the nearer child first, push the other one if it is also in range
+				uint32_t nearChild = node.LeftFirst;
+				uint32_t farChild = node.LeftFirst + 1;
+				float nearDistance = Utils::IntersectBounds(m_Nodes[nearChild], ray.Origin, invDirection, hitDistance);
+				float farDistance = Utils::IntersectBounds(m_Nodes[farChild], ray.Origin, invDirection, hitDistance);
+				if (farDistance < nearDistance)
+				{
+					std::swap(nearChild, farChild);
+					std::swap(nearDistance, farDistance);
+				}
+
+				if (nearDistance != FLT_MAX)
+				{
+					if (farDistance != FLT_MAX)
+					{
+						stack[stackSize] = farChild;
+						stackDistance[stackSize] = farDistance;
+						stackSize++;
+					}
+					nodeIndex = nearChild;
+					descend = true;
+				}
+			}
+
+			if (descend)
+				continue;
+
+			// Pop the next subtree that can still contain a closer hit
+			while (stackSize > 0 && stackDistance[stackSize - 1] >= hitDistance)
+				stackSize--;
+			if (stackSize == 0)
+				break;
+			nodeIndex = stack[--stackSize];
+		}
+
+		return GetHitIndex(closest);
+	}
+
+	void BVH::IntersectPacket(RayPacket& packet, TraversalStats* stats) const
+	{
+		if (m_Nodes.empty() || packet.Count == 0)
+			return;
+
+		const float* radiusSquared = m_Spheres.RadiusSquared.data();
+
+		bool triangles = m_Triangles != nullptr;
+		WatertightRay triangleRays[RayPacket::MaxSize];
+		if (triangles)
+		{
+			for (uint32_t i = 0; i < packet.Count; i++)
+				triangleRays[i] = WatertightRay(packet.Rays[i]);
+		}
+
+		// Coherent rays agree on which child is nearer, so order by the first ray's direction
+		const Ray& leadRay = packet.Rays[0];
+
+		// Both children are pushed, so the stack can hold one more entry per level
+		uint32_t stack[MaxTreeDepth * 2];
+		uint32_t stackSize = 0;
+		stack[stackSize++] = 0;
+
+		while (stackSize > 0)
+		{
+			const Node& node = m_Nodes[stack[--stackSize]];
+			uint32_t activeRays = Utils::IntersectBoundsPacket(node, packet);
+			if (stats)
+				stats->NodesVisited++;
+			if (activeRays == 0)
+				continue;
+
+			if (node.Count > 0)
+			{
+				for (uint32_t i = 0; i < packet.Count; i++)
+				{
+					if ((activeRays & (1u << i)) == 0)
+						continue;
+
+					const Ray& ray = packet.Rays[i];
+					int hit;
+					if (triangles)
+						hit = IntersectTriangles(node.LeftFirst, node.Count, triangleRays[i], packet.HitDistance[i], false);
+					else
+						hit = m_Kernel(m_Spheres, radiusSquared, node.LeftFirst, node.Count, ray.Origin, ray.Direction, packet.HitDistance[i]);
+					if (hit >= 0)
+						packet.HitObject[i] = GetHitIndex(hit);
+					if (stats)
+						(triangles ? stats->TriangleTests : stats->SphereTests) += node.Count;
+				}
+				continue;
+			}
+
+			const Node& left = m_Nodes[node.LeftFirst];
+			const Node& right = m_Nodes[node.LeftFirst + 1];
+			glm::vec3 leftCenter = (left.BoundsMin + left.BoundsMax) * 0.5f;
+			glm::vec3 rightCenter = (right.BoundsMin + right.BoundsMax) * 0.5f;
+			bool leftFirst = glm::dot(leftCenter - rightCenter, leadRay.Direction) < 0.0f;
+
+			// Push the far child first so the near one is popped next
+			stack[stackSize++] = leftFirst ? node.LeftFirst + 1 : node.LeftFirst;
+			stack[stackSize++] = leftFirst ? node.LeftFirst : node.LeftFirst + 1;
+		}
+	}
+
+	int BVH::IntersectLinear(const Ray& ray, float& hitDistance, bool shadowRay, TraversalStats* stats) const
+	{
+		if (m_Triangles)
+		{
+			uint32_t count = (uint32_t)m_PrimitiveIndices.size();
+			int closest = IntersectTriangles(0, count, WatertightRay(ray), hitDistance, shadowRay);
+			if (stats)
+				stats->TriangleTests += count;
+			return GetHitIndex(closest);
+		}
+
+		if (m_Spheres.Count == 0)
+			return -1;
+
+		const float* radiusSquared = shadowRay ? m_Spheres.ShadowRadiusSquared.data() : m_Spheres.RadiusSquared.data();
+		int closest = m_Kernel(m_Spheres, radiusSquared, 0, m_Spheres.Count, ray.Origin, ray.Direction, hitDistance);
+		if (stats)
+			stats->SphereTests += m_Spheres.Count;
+
+		return GetHitIndex(closest);
+	}
+
+	int BVH::IntersectTriangles(uint32_t first, uint32_t count, const WatertightRay& ray, float& hitDistance, bool shadowRay) const
+	{
+		const std::vector<glm::vec3>& vertices = *m_Vertices;
+		int closest = -1;
+		for (uint32_t i = first; i < first + count; i++)
+		{
+			uint32_t triangleIndex = m_PrimitiveIndices[i];
+			if (shadowRay && (triangleIndex & ShadowTransparentBit))
+				continue;
+
+			const Triangle& triangle = (*m_Triangles)[triangleIndex & ~ShadowTransparentBit];
+			if (Utils::IntersectTriangle(ray, vertices[triangle.Indices[0]], vertices[triangle.Indices[1]], vertices[triangle.Indices[2]], hitDistance))
+				closest = (int)i;
+		}
+		return closest;
+	}
+
+	int BVH::GetHitIndex(int leafPosition) const
+	{
+		if (leafPosition < 0)
+			return -1;
+		if (m_Triangles)
+			return (int)(m_FirstIndex + (m_PrimitiveIndices[leafPosition] & ~ShadowTransparentBit));
+		return (int)m_Spheres.SphereIndex[leafPosition];
+	}
+
+	void BVH::Subdivide(uint32_t nodeIndex, const std::vector<BuildPrimitive>& primitives, uint32_t depth)
+	{
+		m_BuildStats.MaxDepth = std::max(m_BuildStats.MaxDepth, depth);
+
+		{
+			Node& node = m_Nodes[nodeIndex];
+			Utils::Bounds bounds;
+			for (uint32_t i = 0; i < node.Count; i++)
+			{
+				const BuildPrimitive& primitive = primitives[m_PrimitiveIndices[node.LeftFirst + i]];
+				bounds.Grow(primitive.BoundsMin, primitive.BoundsMax);
+			}
+			node.BoundsMin = bounds.Min;
+			node.BoundsMax = bounds.Max;
+		}
+
+		Node node = m_Nodes[nodeIndex];
+		if (node.Count <= 1 || depth >= MaxTreeDepth)
+		{
+			m_BuildStats.LeafCount++;
+			return;
+		}
+
+		int axis = -1;
+		float splitPosition = 0.0f;
+		float splitCost = FindBestSplit(node, primitives, axis, splitPosition);
+
+		// Both costs are scaled by the node's surface area, the split also pays for visiting the children
+		Utils::Bounds nodeBounds{ node.BoundsMin, node.BoundsMax };
+		float leafCost = node.Count * nodeBounds.Area();
+		splitCost += Utils::TraversalCost * nodeBounds.Area();
+		if (axis < 0 || (splitCost >= leafCost && node.Count <= Utils::MaxLeafSize))
+		{
+			m_BuildStats.LeafCount++;
+			return;
+		}
+
+		uint32_t* first = m_PrimitiveIndices.data() + node.LeftFirst;
+		uint32_t* last = first + node.Count;
+		uint32_t* middle = std::partition(first, last, [&](uint32_t index)
+			{
+				return primitives[index].Centroid[axis] < splitPosition;
+			});
+
+		uint32_t leftCount = (uint32_t)(middle - first);
+		if (leftCount == 0 || leftCount == node.Count)
+		{
+			// All centroids fell into one bin, fall back to a median split
+			leftCount = node.Count / 2;
+			std::nth_element(first, first + leftCount, last, [&](uint32_t a, uint32_t b)
+				{
+					return primitives[a].Centroid[axis] < primitives[b].Centroid[axis];
+				});
+		}
+
+		uint32_t leftIndex = (uint32_t)m_Nodes.size();
+		Node& left = m_Nodes.emplace_back();
+		left.LeftFirst = node.LeftFirst;
+		left.Count = leftCount;
+		Node& right = m_Nodes.emplace_back();
+		right.LeftFirst = node.LeftFirst + leftCount;
+		right.Count = node.Count - leftCount;
+
+		m_Nodes[nodeIndex].LeftFirst = leftIndex;
+		m_Nodes[nodeIndex].Count = 0;
+
+		Subdivide(leftIndex, primitives, depth + 1);
+		Subdivide(leftIndex + 1, primitives, depth + 1);
+	}
+
+	float BVH::FindBestSplit(const Node& node, const std::vector<BuildPrimitive>& primitives, int& axis, float& splitPosition) const
+	{
+		using Utils::SAHBinCount;
+
+		Utils::Bounds centroidBounds;
+		for (uint32_t i = 0; i < node.Count; i++)
+			centroidBounds.Grow(primitives[m_PrimitiveIndices[node.LeftFirst + i]].Centroid);
+
+		// Bin all three axes in one pass so each primitive is fetched once
+		Utils::Bounds bins[3][SAHBinCount];
+		uint32_t binCounts[3][SAHBinCount] = {};
+		glm::vec3 scale(0.0f);
+		for (int a = 0; a < 3; a++)
+		{
+			float extent = centroidBounds.Max[a] - centroidBounds.Min[a];
+			if (extent > 0.0f)
+				scale[a] = SAHBinCount / extent;
+		}
+
+		for (uint32_t i = 0; i < node.Count; i++)
+		{
+			const BuildPrimitive& primitive = primitives[m_PrimitiveIndices[node.LeftFirst + i]];
+			for (int a = 0; a < 3; a++)
+			{
+				uint32_t bin = std::min(SAHBinCount - 1, (uint32_t)((primitive.Centroid[a] - centroidBounds.Min[a]) * scale[a]));
+				binCounts[a][bin]++;
+				bins[a][bin].Grow(primitive.BoundsMin, primitive.BoundsMax);
+			}
+		}
+
+		float bestCost = FLT_MAX;
+		for (int a = 0; a < 3; a++)
+		{
+			if (scale[a] == 0.0f)
+				continue;
+
+			// Sweep from both sides to get the cost of every plane between bins
+			float leftArea[SAHBinCount - 1], rightArea[SAHBinCount - 1];
+			uint32_t leftCount[SAHBinCount - 1], rightCount[SAHBinCount - 1];
+			Utils::Bounds leftBounds, rightBounds;
+			uint32_t leftSum = 0, rightSum = 0;
+			for (uint32_t i = 0; i < SAHBinCount - 1; i++)
+			{
+				leftSum += binCounts[a][i];
+				leftCount[i] = leftSum;
+				leftBounds.Grow(bins[a][i].Min, bins[a][i].Max);
+				leftArea[i] = leftBounds.Area();
+
+				rightSum += binCounts[a][SAHBinCount - 1 - i];
+				rightCount[SAHBinCount - 2 - i] = rightSum;
+				rightBounds.Grow(bins[a][SAHBinCount - 1 - i].Min, bins[a][SAHBinCount - 1 - i].Max);
+				rightArea[SAHBinCount - 2 - i] = rightBounds.Area();
+			}
+
+			for (uint32_t i = 0; i < SAHBinCount - 1; i++)
+			{
+				if (leftCount[i] == 0 || rightCount[i] == 0)
+					continue;
+
+				float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					axis = a;
+					splitPosition = centroidBounds.Min[a] + (i + 1) / scale[a];
+				}
+			}
+		}
+
+		return bestCost;
+	}
+}
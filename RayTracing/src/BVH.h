@@ -0,0 +1,116 @@
+#pragma once
+
+#include "Ray.h"
+#include "RayPacket.h"
+#include "Scene.h"
+#include "SphereKernels.h"
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+namespace RayTracing {
+	// Bounding volume hierarchy over Scene::Spheres or Scene::Triangles, built with binned SAH.
+	// Nodes live in one flat array; the two children of a node are always adjacent.
+	// Sphere leaves are tested with the SIMD sphere kernels, triangle leaves with a
+	// watertight ray-triangle test.
+	class BVH {
+	public:
+		struct Node
+		{
+			glm::vec3 BoundsMin;
+			uint32_t LeftFirst; // left child for interior nodes, first index for leaves
+			glm::vec3 BoundsMax;
+			uint32_t Count; // 0 for interior nodes
+		};
+
+		struct BuildStats
+		{
+			float BuildTimeMs = 0.0f;
+			uint32_t NodeCount = 0;
+			uint32_t LeafCount = 0;
+			uint32_t MaxDepth = 0;
+			// Nodes and leaf primitive data kept for traversal
+			size_t MemoryBytes = 0;
+		};
+
+		struct TraversalStats
+		{
+			uint32_t NodesVisited = 0;
+			uint32_t SphereTests = 0;
+			uint32_t TriangleTests = 0;
+		};
+
+		// Ray transformed once so that triangle tests are done in 2D after a shear,
+		// edges shared by two triangles then give the same result for both
+		struct WatertightRay
+		{
+			glm::vec3 Origin{ 0.0f };
+			glm::vec3 Shear{ 0.0f };
+			int Axis[3] = { 0, 1, 2 }; // x and y of the projection, then the dominant direction axis
+
+			WatertightRay() = default;
+			WatertightRay(const Ray& ray);
+		};
+
+		// Deeper subtrees are collapsed into leaves so traversal can use a fixed stack
+		static constexpr uint32_t MaxTreeDepth = 64;
+	public:
+		// Materials decide which spheres shadow rays ignore, so changing a
+		// sphere's MaterialIndex also needs a rebuild
+		void Build(const std::vector<Sphere>& spheres, const std::vector<Material>& materials);
+		// Triangle hits are reported as firstIndex + the index into triangles, so a scene's
+		// spheres and triangles can share one numbering. Only references to vertices and
+		// triangles are kept, they have to outlive the BVH or the next Build.
+		void Build(const std::vector<glm::vec3>& vertices, const std::vector<Triangle>& triangles, const std::vector<Material>& materials, uint32_t firstIndex);
+		void Clear();
+
+		bool IsEmpty() const { return m_Nodes.empty(); }
+		const BuildStats& GetBuildStats() const { return m_BuildStats; }
+
+		// Returns the index into Scene::Spheres (or the triangle hit index) of the closest hit, or -1.
+		// hitDistance starts as the ray length. Shadow rays pass through glass.
+		int Intersect(const Ray& ray, float& hitDistance, bool shadowRay, TraversalStats* stats = nullptr) const;
+		// Closest hits for a whole packet. A node is visited once for all rays that reach it,
+		// its bounds are tested against four rays at a time. Fills HitDistance/HitObject.
+		void IntersectPacket(RayPacket& packet, TraversalStats* stats = nullptr) const;
+		// Tests every primitive with the same leaf test, for comparison
+		int IntersectLinear(const Ray& ray, float& hitDistance, bool shadowRay, TraversalStats* stats = nullptr) const;
+
+		void SetSIMDLevel(SIMDLevel level);
+		SIMDLevel GetSIMDLevel() const { return m_SIMDLevel; }
+	private:
+		struct BuildPrimitive
+		{
+			glm::vec3 BoundsMin;
+			glm::vec3 BoundsMax;
+			glm::vec3 Centroid;
+		};
+
+		// Set in m_PrimitiveIndices for glass triangles, which shadow rays pass through
+		static constexpr uint32_t ShadowTransparentBit = 0x80000000u;
+
+		// Leaf position of the closest triangle in [first, first + count) or -1, like the sphere kernels
+		int IntersectTriangles(uint32_t first, uint32_t count, const WatertightRay& ray, float& hitDistance, bool shadowRay) const;
+		int GetHitIndex(int leafPosition) const;
+
+		void BuildNodes(const std::vector<BuildPrimitive>& primitives);
+		void Subdivide(uint32_t nodeIndex, const std::vector<BuildPrimitive>& primitives, uint32_t depth);
+		float FindBestSplit(const Node& node, const std::vector<BuildPrimitive>& primitives, int& axis, float& splitPosition) const;
+	private:
+		std::vector<Node> m_Nodes;
+		// Build order of the primitives. Sphere BVHs drop it after the build, triangle
+		// leaves keep indexing into the scene's triangles through it.
+		std::vector<uint32_t> m_PrimitiveIndices;
+		BuildStats m_BuildStats;
+
+		// Spheres in leaf order, leaves index straight into it
+		SphereSoA m_Spheres;
+		// The scene's triangles and vertices, null for a sphere BVH
+		const std::vector<glm::vec3>* m_Vertices = nullptr;
+		const std::vector<Triangle>* m_Triangles = nullptr;
+		uint32_t m_FirstIndex = 0;
+		SIMDLevel m_SIMDLevel = CPUFeatures::DetectSIMDLevel();
+		SphereKernel m_Kernel = SphereKernels::Get(m_SIMDLevel);
+	};
+}
@@ -0,0 +1,46 @@
+#include "CPUFeatures.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+	#define RT_X64 1
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#include <immintrin.h>
+	#endif
+#endif
+
+namespace RayTracing {
+	namespace Utils {
+		static SIMDLevel QuerySIMDLevel()
+		{
+#if !defined(RT_X64)
+			return SIMDLevel::Scalar;
+#elif defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 0);
+			if (info[0] < 7)
+				return SIMDLevel::SSE;
+
+			// AVX needs OS support for saving the YMM registers (OSXSAVE + XCR0 bits 1 and 2)
+			__cpuid(info, 1);
+			bool osxsave = (info[2] & (1 << 27)) != 0;
+			bool avx = (info[2] & (1 << 28)) != 0;
+			if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+				return SIMDLevel::SSE;
+
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) ? SIMDLevel::AVX2 : SIMDLevel::SSE;
+#else
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") ? SIMDLevel::AVX2 : SIMDLevel::SSE;
+#endif
+		}
+	}
+
+	namespace CPUFeatures {
+		SIMDLevel DetectSIMDLevel()
+		{
+			static SIMDLevel s_Level = Utils::QuerySIMDLevel();
+			return s_Level;
+		}
+	}
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+namespace RayTracing {
+	enum class SIMDLevel
+	{
+		Scalar = 0,
+		SSE,  // 4 floats per instruction
+		AVX2  // 8 floats per instruction
+	};
+
+	namespace CPUFeatures {
+		// Best level this CPU (and OS) supports, detected once
+		SIMDLevel DetectSIMDLevel();
+	}
+}
@@ -4,17 +4,22 @@
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
 
+#ifndef RT_HEADLESS
 #include "Walnut/Input/Input.h"
 
 using namespace Walnut;
+#endif
 
 Camera::Camera(float verticalFOV, float nearClip, float farClip)
 	: m_VerticalFOV(verticalFOV), m_NearClip(nearClip), m_FarClip(farClip)
 {
 	m_ForwardDirection = glm::vec3(0, 0, -1);
 	m_Position = glm::vec3(0, 0, 3);
+
+	RecalculateView();
 }
 
+#ifndef RT_HEADLESS
 bool Camera::OnUpdate(float ts)
 {
 	glm::vec2 mousePos = Input::GetMousePosition();
@@ -84,10 +89,11 @@ bool Camera::OnUpdate(float ts)
 	if (moved)
 	{
 		RecalculateView();
-		RecalculateRayDirections();
+		RecalculateRayBasis();
 	}
 	return moved;
 }
+#endif
 
 void Camera::OnResize(uint32_t width, uint32_t height)
 {
@@ -97,8 +103,10 @@ void Camera::OnResize(uint32_t width, uint32_t height)
 	m_ViewportWidth = width;
 	m_ViewportHeight = height;
 
+	m_InverseViewportSize = { 1.0f / (float)width, 1.0f / (float)height };
+
 	RecalculateProjection();
-	RecalculateRayDirections();
+	RecalculateRayBasis();
 }
 
 float Camera::GetRotationSpeed()
@@ -118,20 +126,16 @@ void Camera::RecalculateView()
 	m_InverseView = glm::inverse(m_View);
 }
 
-void Camera::RecalculateRayDirections()
+void Camera::RecalculateRayBasis()
 {
-	m_RayDirections.resize(m_ViewportWidth * m_ViewportHeight);
-
-	for (uint32_t y = 0; y < m_ViewportHeight; y++)
-	{
-		for (uint32_t x = 0; x < m_ViewportWidth; x++)
-		{
-			glm::vec2 coord = { (float)x / (float)m_ViewportWidth, (float)y / (float)m_ViewportHeight };
-			coord = coord * 2.0f - 1.0f; // -1 -> 1
-
-			glm::vec4 target = m_InverseProjection * glm::vec4(coord.x, coord.y, 1, 1);
-			glm::vec3 rayDirection = glm::vec3(m_InverseView * glm::vec4(glm::normalize(glm::vec3(target) / target.w), 0)); // World space
-			m_RayDirections[x + y * m_ViewportWidth] = rayDirection;
-		}
-	}
+	// The inverse perspective projection is linear in the device coordinate and leaves w
+	// independent of it, so target(x, y) = center + x * right + y * up
+	glm::vec4 center = m_InverseProjection * glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+	glm::vec4 right = m_InverseProjection * glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+	glm::vec4 up = m_InverseProjection * glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+
+	// World space
+	m_RayCenter = glm::vec3(m_InverseView * glm::vec4(glm::vec3(center) / center.w, 0.0f));
+	m_RayRight = glm::vec3(m_InverseView * glm::vec4(glm::vec3(right) / center.w, 0.0f));
+	m_RayUp = glm::vec3(m_InverseView * glm::vec4(glm::vec3(up) / center.w, 0.0f));
 }
@@ -1,14 +1,16 @@
 #pragma once
 
 #include <glm/glm.hpp>
-#include <vector>
+#include <cstdint>
 
 class Camera
 {
 public:
 	Camera(float verticalFOV, float nearClip, float farClip);
 
+#ifndef RT_HEADLESS
 	bool OnUpdate(float ts);
+#endif
 	void OnResize(uint32_t width, uint32_t height);
 
 	const glm::mat4& GetProjection() const { return m_Projection; }
@@ -19,13 +21,21 @@ public:
 	const glm::vec3& GetPosition() const { return m_Position; }
 	const glm::vec3& GetDirection() const { return m_ForwardDirection; }
 
-	const std::vector<glm::vec3>& GetRayDirections() const { return m_RayDirections; }
+	// World space direction through pixel (x, y), computed from the camera basis so
+	// moving or resizing the camera does not rebuild a per-pixel cache
+	glm::vec3 GetRayDirection(uint32_t x, uint32_t y) const
+	{
+		glm::vec2 coord = { (float)x * m_InverseViewportSize.x, (float)y * m_InverseViewportSize.y };
+		coord = coord * 2.0f - 1.0f; // -1 -> 1
+
+		return glm::normalize(m_RayCenter + coord.x * m_RayRight + coord.y * m_RayUp);
+	}
 
 	float GetRotationSpeed();
 private:
 	void RecalculateProjection();
 	void RecalculateView();
-	void RecalculateRayDirections();
+	void RecalculateRayBasis();
 private:
 	glm::mat4 m_Projection{ 1.0f };
 	glm::mat4 m_View{ 1.0f };
@@ -39,8 +49,12 @@ private:
 	glm::vec3 m_Position{0.0f, 0.0f, 0.0f};
 	glm::vec3 m_ForwardDirection{0.0f, 0.0f, 0.0f};
 
-	// Cached ray directions
-	std::vector<glm::vec3> m_RayDirections;
+	// Unnormalized world space direction through the image center, and its change per unit of
+	// normalized device x and y
+	glm::vec3 m_RayCenter{ 0.0f, 0.0f, -1.0f };
+	glm::vec3 m_RayRight{ 0.0f };
+	glm::vec3 m_RayUp{ 0.0f };
+	glm::vec2 m_InverseViewportSize{ 0.0f };
 
 	glm::vec2 m_LastMousePosition{ 0.0f, 0.0f };
 
@@ -0,0 +1,379 @@
+#include "Checkpoint.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Checkpoint {
+	namespace Utils {
+		static void SetError(std::string* error, const std::string& message)
+		{
+			if (error)
+				*error = message;
+		}
+
+		static uint64_t AlignUp(uint64_t value)
+		{
+			return (value + SlotAlignment - 1) & ~(SlotAlignment - 1);
+		}
+
+		static uint64_t GetAccumulationSize(uint32_t width, uint32_t height, RayTracing::AccumulationFormat format)
+		{
+			return (uint64_t)width * height * RayTracing::AccumulationBuffer::GetBytesPerPixel(format);
+		}
+
+		static uint64_t GetSlotSize(uint32_t width, uint32_t height, uint32_t tileCount, RayTracing::AccumulationFormat format)
+		{
+			uint64_t pixelCount = (uint64_t)width * height;
+			return AlignUp(GetAccumulationSize(width, height, format) + pixelCount * (sizeof(float) + sizeof(uint32_t)) + tileCount);
+		}
+
+		// FNV-1a, 64 bit
+		class Hasher
+		{
+		public:
+			void Add(const void* data, size_t size)
+			{
+				const uint8_t* bytes = static_cast<const uint8_t*>(data);
+				for (size_t i = 0; i < size; i++)
+					m_Hash = (m_Hash ^ bytes[i]) * 0x100000001b3ull;
+			}
+
+			template<typename T>
+			void Add(const T& value)
+			{
+				static_assert(std::is_trivially_copyable<T>::value, "hashed as raw bytes");
+				Add(&value, sizeof(T));
+			}
+
+			// Element types without padding only, so every byte hashed is initialized
+			template<typename T>
+			void AddArray(const std::vector<T>& values)
+			{
+				Add((uint64_t)values.size());
+				if (!values.empty())
+					Add(values.data(), values.size() * sizeof(T));
+			}
+
+			uint64_t Get() const { return m_Hash; }
+		private:
+			uint64_t m_Hash = 0xcbf29ce484222325ull;
+		};
+	}
+
+	uint64_t HashRender(const Scene& scene, const Camera& camera, const RayTracing::Renderer::Settings& settings, uint32_t width, uint32_t height)
+	{
+		static_assert(sizeof(Sphere) == 5 * 4 && sizeof(Triangle) == 4 * 4 && sizeof(PointLight) == 7 * 4 && sizeof(DirectionalLight) == 7 * 4,
+			"scene structs are hashed as raw bytes and must not have padding");
+
+		Utils::Hasher hasher;
+		hasher.AddArray(scene.Spheres);
+		hasher.AddArray(scene.Vertices);
+		hasher.AddArray(scene.Triangles);
+		hasher.AddArray(scene.DirectionalLights);
+		hasher.AddArray(scene.PointLights);
+
+		// The union leaves the bytes a glass material does not use uninitialized
+		hasher.Add((uint64_t)scene.Materials.size());
+		for (const Material& material : scene.Materials)
+		{
+			hasher.Add(material.Type);
+			if (material.Type == MaterialType::Glass)
+			{
+				hasher.Add(material.Glass.RefractiveIndex);
+			}
+			else
+			{
+				hasher.Add(material.Diffuse.Albedo);
+				hasher.Add(material.Diffuse.Roughness);
+				hasher.Add(material.Diffuse.Metallic);
+				hasher.Add(material.Diffuse.EmissionColor);
+				hasher.Add(material.Diffuse.EmissionPower);
+			}
+		}
+
+		hasher.Add(camera.GetView());
+		hasher.Add(camera.GetProjection());
+		hasher.Add(width);
+		hasher.Add(height);
+
+		// Only settings that change the samples; thread count, kernels and the BVH do not
+		hasher.Add(settings.PreviewRenderer);
+		hasher.Add(settings.Integrator);
+		hasher.Add(settings.TileSize);
+		hasher.Add(settings.Seed);
+		hasher.Add(settings.SampleOffset);
+		hasher.Add(settings.MaxDiffuseDepth);
+		hasher.Add(settings.MaxGlassDepth);
+		hasher.Add(settings.RussianRoulette);
+		hasher.Add(settings.RussianRouletteDepth);
+		hasher.Add(settings.NextEventEstimation);
+		hasher.Add(settings.AdaptiveSampling);
+		hasher.Add(settings.NoiseThreshold);
+		hasher.Add(settings.MinSamples);
+		hasher.Add(settings.Accumulation);
+		return hasher.Get();
+	}
+
+	uint32_t GetTileCount(const RayTracing::Renderer::Settings& settings, uint32_t width, uint32_t height)
+	{
+		uint32_t tileSize = std::max(1u, settings.TileSize);
+		return ((width + tileSize - 1) / tileSize) * ((height + tileSize - 1) / tileSize);
+	}
+
+	CheckpointFile::~CheckpointFile()
+	{
+		Close();
+	}
+
+	bool CheckpointFile::Map(const std::string& path, bool create, size_t size, std::string* error)
+	{
+		Close();
+
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+			create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			Utils::SetError(error, "cannot open " + path);
+			return false;
+		}
+		m_File = file;
+
+		LARGE_INTEGER fileSize;
+		if (create)
+		{
+			fileSize.QuadPart = (LONGLONG)size;
+			if (!SetFilePointerEx(file, fileSize, nullptr, FILE_BEGIN) || !SetEndOfFile(file))
+			{
+				Utils::SetError(error, "cannot resize " + path);
+				Close();
+				return false;
+			}
+		}
+		else if (!GetFileSizeEx(file, &fileSize))
+		{
+			Utils::SetError(error, "cannot read the size of " + path);
+			Close();
+			return false;
+		}
+		m_Size = (size_t)fileSize.QuadPart;
+		if (m_Size < sizeof(Header))
+		{
+			Utils::SetError(error, path + " is too small to be a checkpoint");
+			Close();
+			return false;
+		}
+
+		m_Mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+		m_Data = m_Mapping ? MapViewOfFile(m_Mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0) : nullptr;
+#else
+		int file = open(path.c_str(), create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644);
+		if (file < 0)
+		{
+			Utils::SetError(error, "cannot open " + path);
+			return false;
+		}
+
+		if (create && ftruncate(file, (off_t)size) != 0)
+		{
+			Utils::SetError(error, "cannot resize " + path);
+			close(file);
+			return false;
+		}
+
+		struct stat fileStat;
+		if (fstat(file, &fileStat) != 0 || fileStat.st_size < (off_t)sizeof(Header))
+		{
+			Utils::SetError(error, path + " is too small to be a checkpoint");
+			close(file);
+			return false;
+		}
+		m_Size = (size_t)fileStat.st_size;
+
+		m_Data = mmap(nullptr, m_Size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+		// The mapping keeps the file alive
+		close(file);
+		if (m_Data == MAP_FAILED)
+			m_Data = nullptr;
+#endif
+
+		if (!m_Data)
+		{
+			Utils::SetError(error, "cannot map " + path);
+			Close();
+			return false;
+		}
+
+		m_Header = static_cast<Header*>(m_Data);
+		return true;
+	}
+
+	bool CheckpointFile::Create(const std::string& path, uint32_t width, uint32_t height, uint32_t tileCount, RayTracing::AccumulationFormat format,
+		uint64_t renderHash, std::string* error)
+	{
+		uint64_t slotSize = Utils::GetSlotSize(width, height, tileCount, format);
+		if (!Map(path, true, (size_t)(Utils::AlignUp(sizeof(Header)) + 2 * slotSize), error))
+			return false;
+
+		// ftruncate zero-fills, so both slots start out unwritten
+		Header& header = *m_Header;
+		header.Magic = Magic;
+		header.Version = Version;
+		header.EndianCheck = EndianCheck;
+		header.HeaderSize = sizeof(Header);
+		header.Width = width;
+		header.Height = height;
+		header.TileCount = tileCount;
+		header.AccumulationFormat = (uint32_t)format;
+		header.RenderHash = renderHash;
+		header.SlotSize = slotSize;
+		return true;
+	}
+
+	bool CheckpointFile::Open(const std::string& path, std::string* error)
+	{
+		if (!Map(path, false, 0, error))
+			return false;
+
+		const Header& header = *m_Header;
+		if (header.Magic != Magic)
+			Utils::SetError(error, path + " is not a checkpoint");
+		else if (header.EndianCheck != EndianCheck)
+			Utils::SetError(error, path + " was written on a machine with the other byte order");
+		else if (header.Version != Version || header.HeaderSize != sizeof(Header))
+			Utils::SetError(error, path + " is checkpoint version " + std::to_string(header.Version) + ", expected " + std::to_string(Version));
+		else if (header.AccumulationFormat > (uint32_t)RayTracing::AccumulationFormat::SharedExponent)
+			Utils::SetError(error, path + " has an unknown accumulation format");
+		else if (header.SlotSize != Utils::GetSlotSize(header.Width, header.Height, header.TileCount, (RayTracing::AccumulationFormat)header.AccumulationFormat) ||
+			Utils::AlignUp(sizeof(Header)) + 2 * header.SlotSize > m_Size)
+			Utils::SetError(error, path + " is truncated");
+		else
+			return true;
+
+		Close();
+		return false;
+	}
+
+	void CheckpointFile::Close()
+	{
+#ifdef _WIN32
+		if (m_Data)
+			UnmapViewOfFile(m_Data);
+		if (m_Mapping)
+			CloseHandle(m_Mapping);
+		if (m_File)
+			CloseHandle(m_File);
+		m_Mapping = nullptr;
+		m_File = nullptr;
+#else
+		if (m_Data)
+			munmap(m_Data, m_Size);
+#endif
+		m_Data = nullptr;
+		m_Size = 0;
+		m_Header = nullptr;
+	}
+
+	int CheckpointFile::GetNewestSlot() const
+	{
+		if (!m_Header || (m_Header->Slots[0].Sequence == 0 && m_Header->Slots[1].Sequence == 0))
+			return -1;
+		return m_Header->Slots[1].Sequence > m_Header->Slots[0].Sequence ? 1 : 0;
+	}
+
+	uint32_t CheckpointFile::GetFrameIndex() const
+	{
+		int slot = GetNewestSlot();
+		return slot < 0 ? 0 : m_Header->Slots[slot].FrameIndex;
+	}
+
+	uint8_t* CheckpointFile::GetSlotData(int slot) const
+	{
+		return static_cast<uint8_t*>(m_Data) + Utils::AlignUp(sizeof(Header)) + (uint64_t)slot * m_Header->SlotSize;
+	}
+
+	void CheckpointFile::Save(const RayTracing::Renderer& renderer)
+	{
+		const RayTracing::AccumulationBuffer& accumulation = renderer.GetAccumulation();
+		if (!m_Header || renderer.GetWidth() != m_Header->Width || renderer.GetHeight() != m_Header->Height ||
+			(uint32_t)accumulation.GetFormat() != m_Header->AccumulationFormat)
+			return;
+
+		int newest = GetNewestSlot();
+		int slot = newest == 0 ? 1 : 0;
+		uint64_t sequence = newest < 0 ? 1 : m_Header->Slots[newest].Sequence + 1;
+
+		// Unpublish the slot before overwriting it, the other one stays the valid checkpoint
+		Slot& target = m_Header->Slots[slot];
+		target.Sequence = 0;
+		std::atomic_thread_fence(std::memory_order_release);
+
+		size_t pixelCount = (size_t)m_Header->Width * m_Header->Height;
+		uint8_t* data = GetSlotData(slot);
+		memcpy(data, accumulation.GetData(), accumulation.GetSizeBytes());
+		data += accumulation.GetSizeBytes();
+		memcpy(data, renderer.GetLuminanceSquaredData(), pixelCount * sizeof(float));
+		data += pixelCount * sizeof(float);
+		memcpy(data, renderer.GetSampleCounts(), pixelCount * sizeof(uint32_t));
+		data += pixelCount * sizeof(uint32_t);
+
+		const std::vector<uint8_t>& tileConverged = renderer.GetTileConverged();
+		memset(data, 0, m_Header->TileCount);
+		memcpy(data, tileConverged.data(), std::min<size_t>(tileConverged.size(), m_Header->TileCount));
+
+		std::atomic_thread_fence(std::memory_order_release);
+		target.FrameIndex = renderer.GetFrameIndex();
+		std::atomic_thread_fence(std::memory_order_release);
+		target.Sequence = sequence;
+
+		// Start writing back without waiting for it
+#ifdef _WIN32
+		FlushViewOfFile(m_Data, m_Size);
+#else
+		msync(m_Data, m_Size, MS_ASYNC);
+#endif
+	}
+
+	bool CheckpointFile::Restore(RayTracing::Renderer& renderer, std::string* error) const
+	{
+		int slot = GetNewestSlot();
+		if (slot < 0)
+		{
+			Utils::SetError(error, "the checkpoint has no saved frames");
+			return false;
+		}
+		if (renderer.GetWidth() != m_Header->Width || renderer.GetHeight() != m_Header->Height)
+		{
+			Utils::SetError(error, "the checkpoint is " + std::to_string(m_Header->Width) + "x" + std::to_string(m_Header->Height));
+			return false;
+		}
+
+		RayTracing::AccumulationFormat format = (RayTracing::AccumulationFormat)m_Header->AccumulationFormat;
+		if (renderer.GetSettings().Accumulation != format)
+		{
+			Utils::SetError(error, std::string("the checkpoint accumulates in ") + RayTracing::AccumulationBuffer::GetName(format));
+			return false;
+		}
+
+		size_t pixelCount = (size_t)m_Header->Width * m_Header->Height;
+		const uint8_t* accumulation = GetSlotData(slot);
+		const uint8_t* data = accumulation + Utils::GetAccumulationSize(m_Header->Width, m_Header->Height, format);
+		const float* luminanceSquared = reinterpret_cast<const float*>(data);
+		const uint32_t* sampleCounts = reinterpret_cast<const uint32_t*>(data + pixelCount * sizeof(float));
+		const uint8_t* tileConverged = data + pixelCount * (sizeof(float) + sizeof(uint32_t));
+		renderer.RestoreAccumulation(m_Header->Slots[slot].FrameIndex, accumulation, luminanceSquared, sampleCounts, tileConverged, m_Header->TileCount);
+		return true;
+	}
+}
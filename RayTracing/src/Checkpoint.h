@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Camera.h"
+#include "Renderer.h"
+#include "Scene.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Checkpoint files (.rtckpt) hold the accumulation of a progressive render so it can be resumed
+// after the process dies. The file is memory-mapped and holds two slots that are written in turn:
+//
+//   Header                          magic, version, image and tile grid size, render hash, slot states
+//   slot 0, slot 1                  each one 64 byte aligned:
+//     accumulation                  Width * Height pixels in AccumulationFormat (see AccumulationBuffer.h)
+//     float[Width * Height]         squared luminance sums for adaptive sampling
+//     uint32_t[Width * Height]      samples per pixel
+//     uint8_t[TileCount]            converged tile flags
+//
+// Saving copies into the older slot and only then publishes it in the header, so a crash during
+// a save leaves the previous checkpoint intact. The copy goes to the page cache; the OS writes it
+// to disk in the background instead of the render loop waiting on it.
+//
+// Paths are seeded from Settings::Seed, SampleOffset and the frame index alone, so the frame
+// index is all the random state there is: a resumed render traces the same samples an
+// uninterrupted one would have.
+namespace Checkpoint {
+	constexpr uint32_t Magic = 0x4b435452; // "RTCK"
+	constexpr uint32_t Version = 2;
+	constexpr uint32_t EndianCheck = 0x01020304;
+	constexpr uint64_t SlotAlignment = 64;
+
+	struct Slot
+	{
+		// Highest complete slot wins, 0 = never written
+		uint64_t Sequence;
+		// Frame the renderer continues with, one more than the frames accumulated
+		uint32_t FrameIndex;
+		uint32_t Reserved;
+	};
+
+	struct Header
+	{
+		uint32_t Magic;
+		uint32_t Version;
+		uint32_t EndianCheck;
+		uint32_t HeaderSize;
+		uint32_t Width;
+		uint32_t Height;
+		uint32_t TileCount;
+		uint32_t AccumulationFormat;
+		uint64_t RenderHash;
+		uint64_t SlotSize;
+		Slot Slots[2];
+	};
+
+	// Everything that decides which samples land in which pixel: the scene, the camera, the image
+	// and tile grid size and the integrator settings. A checkpoint only resumes with the same hash.
+	uint64_t HashRender(const Scene& scene, const Camera& camera, const RayTracing::Renderer::Settings& settings, uint32_t width, uint32_t height);
+
+	// Tiles the renderer splits a width x height image into with the given settings
+	uint32_t GetTileCount(const RayTracing::Renderer::Settings& settings, uint32_t width, uint32_t height);
+
+	class CheckpointFile
+	{
+	public:
+		CheckpointFile() = default;
+		~CheckpointFile();
+		CheckpointFile(const CheckpointFile&) = delete;
+		CheckpointFile& operator=(const CheckpointFile&) = delete;
+
+		// Creates or truncates path and sizes it for two slots of the given image
+		bool Create(const std::string& path, uint32_t width, uint32_t height, uint32_t tileCount, RayTracing::AccumulationFormat format,
+			uint64_t renderHash, std::string* error = nullptr);
+		// Maps an existing checkpoint, which keeps being written by Save
+		bool Open(const std::string& path, std::string* error = nullptr);
+		void Close();
+
+		// Copies the renderer's accumulation into the older slot and publishes it. Call between
+		// frames, the renderer's image size must match the file.
+		void Save(const RayTracing::Renderer& renderer);
+		// Loads the newest slot into a renderer already resized to the checkpoint's image and set to its format
+		bool Restore(RayTracing::Renderer& renderer, std::string* error = nullptr) const;
+
+		bool IsOpen() const { return m_Header != nullptr; }
+		uint32_t GetWidth() const { return m_Header ? m_Header->Width : 0; }
+		uint32_t GetHeight() const { return m_Header ? m_Header->Height : 0; }
+		uint64_t GetRenderHash() const { return m_Header ? m_Header->RenderHash : 0; }
+		// Frame index of the newest slot, 0 if nothing was saved yet
+		uint32_t GetFrameIndex() const;
+		size_t GetFileSize() const { return m_Size; }
+	private:
+		bool Map(const std::string& path, bool create, size_t size, std::string* error);
+		// Newest written slot, -1 if none
+		int GetNewestSlot() const;
+		uint8_t* GetSlotData(int slot) const;
+	private:
+		void* m_Data = nullptr;
+		size_t m_Size = 0;
+#ifdef _WIN32
+		void* m_File = nullptr;
+		void* m_Mapping = nullptr;
+#endif
+
+		Header* m_Header = nullptr;
+	};
+}
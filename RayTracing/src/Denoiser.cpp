@@ -0,0 +1,307 @@
+#include "Denoiser.h"
+
+#include "CPUFeatures.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64)
+	#define RT_X64 1
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#define RT_TARGET_AVX2
+	#else
+		#define RT_TARGET_AVX2 __attribute__((target("avx2")))
+	#endif
+#endif
+
+namespace RayTracing {
+	namespace Utils {
+		// 3x3 binomial kernel, the separable [1 2 1] / 4 B-spline
+		static constexpr float Kernel[3] = { 0.25f, 0.5f, 0.25f };
+
+		// Relative depth difference per pixel of tap distance that costs a factor e^-1
+		static constexpr float DepthSigma = 0.02f;
+		// Squared albedo difference that costs a factor e^-1
+		static constexpr float InverseAlbedoSigmaSquared = 1.0f / (0.1f * 0.1f);
+		// Depths are relative to at least this, the camera's near plane is further out
+		static constexpr float MinDepth = 1.0e-3f;
+		// Keeps noise-free pixels from rejecting every neighbour over rounding differences
+		static constexpr float LuminanceEpsilon = 1.0e-4f;
+
+		// Luminance of a pixel and the inverse of the luminance difference to a neighbour that counts as an edge
+		static void UpdateNoise(const float* const color[3], const float* variance, float colorSigma, float* luminance, float* inverseSigma, size_t p)
+		{
+			luminance[p] = 0.2126f * color[0][p] + 0.7152f * color[1][p] + 0.0722f * color[2][p];
+			inverseSigma[p] = 1.0f / (colorSigma * std::sqrt(variance[p]) + LuminanceEpsilon);
+		}
+
+		// (1 - x / 8)^8, within 0.03 of e^-x and exactly 0 from x = 8 on, without a call to exp
+		static float FastExpNegative(float x)
+		{
+			float e = std::max(1.0f - x * 0.125f, 0.0f);
+			e *= e;
+			e *= e;
+			return e * e;
+		}
+
+		// Everything one iteration reads and writes, planar
+		struct Iteration
+		{
+			const float* Color[3];
+			const float* Variance;
+			const float* Luminance;
+			const float* InverseSigma;
+			// 1 / (DepthSigma * depth) per pixel
+			const float* DepthScale;
+			const float* Depth;
+			const float* Albedo[3];
+			const float* Normal[3];
+
+			float* OutColor[3];
+			float* OutVariance;
+			// For the next iteration, which compares against the noise left after this one
+			float* OutLuminance;
+			float* OutInverseSigma;
+
+			uint32_t Width, Height, Step;
+			float ColorSigma;
+		};
+
+		// Depth may differ more the further out the tap is, 1 / (|dx| + |dy|)
+		static constexpr float TapDepthFactor[3][3] = { { 0.5f, 1.0f, 0.5f }, { 1.0f, 1.0f, 1.0f }, { 0.5f, 1.0f, 0.5f } };
+
+		// Pixel p with bounds checks for the image border. The AVX2 version does the same operations
+		// in the same order, so both give the same image.
+		static void FilterPixel(const Iteration& it, uint32_t x, uint32_t y)
+		{
+			const size_t p = x + (size_t)y * it.Width;
+			const float depthStep = 1.0f / (float)it.Step;
+			float sumR = 0.0f, sumG = 0.0f, sumB = 0.0f, sumWeight = 0.0f, sumVariance = 0.0f;
+			for (int dy = -1; dy <= 1; dy++)
+			{
+				int64_t tapY = (int64_t)y + dy * (int64_t)it.Step;
+				if (tapY < 0 || tapY >= (int64_t)it.Height)
+					continue;
+
+				for (int dx = -1; dx <= 1; dx++)
+				{
+					int64_t tapX = (int64_t)x + dx * (int64_t)it.Step;
+					if (tapX < 0 || tapX >= (int64_t)it.Width)
+						continue;
+					const size_t q = (size_t)tapX + (size_t)tapY * it.Width;
+
+					// pow(n_p . n_q, 64); zero normals (sky) get no neighbours
+					float normalWeight = std::max(it.Normal[0][p] * it.Normal[0][q] + it.Normal[1][p] * it.Normal[1][q] + it.Normal[2][p] * it.Normal[2][q], 0.0f);
+					for (int i = 0; i < 6; i++)
+						normalWeight *= normalWeight;
+
+					float depthTerm = std::abs(it.Depth[p] - it.Depth[q]) * (it.DepthScale[p] * (TapDepthFactor[dy + 1][dx + 1] * depthStep));
+					float luminanceTerm = std::abs(it.Luminance[p] - it.Luminance[q]) * it.InverseSigma[p];
+					float albedoR = it.Albedo[0][p] - it.Albedo[0][q];
+					float albedoG = it.Albedo[1][p] - it.Albedo[1][q];
+					float albedoB = it.Albedo[2][p] - it.Albedo[2][q];
+					float albedoTerm = (albedoR * albedoR + albedoG * albedoG + albedoB * albedoB) * InverseAlbedoSigmaSquared;
+
+					float weight = (Kernel[dy + 1] * Kernel[dx + 1]) * normalWeight * FastExpNegative(depthTerm + luminanceTerm + albedoTerm);
+					sumR += weight * it.Color[0][q];
+					sumG += weight * it.Color[1][q];
+					sumB += weight * it.Color[2][q];
+					sumWeight += weight;
+					sumVariance += weight * weight * it.Variance[q];
+				}
+			}
+
+			// Sky pixels have no weight at all, not even their own, and are passed through
+			if (sumWeight > 0.0f)
+			{
+				float inverseWeight = 1.0f / sumWeight;
+				it.OutColor[0][p] = sumR * inverseWeight;
+				it.OutColor[1][p] = sumG * inverseWeight;
+				it.OutColor[2][p] = sumB * inverseWeight;
+				it.OutVariance[p] = sumVariance * inverseWeight * inverseWeight;
+			}
+			else
+			{
+				for (int c = 0; c < 3; c++)
+					it.OutColor[c][p] = it.Color[c][p];
+				it.OutVariance[p] = it.Variance[p];
+			}
+			UpdateNoise(it.OutColor, it.OutVariance, it.ColorSigma, it.OutLuminance, it.OutInverseSigma, p);
+		}
+
+#ifdef RT_X64
+		// 8 pixels from p on, whose taps are all inside the image horizontally. The sums stay in registers
+		// across the 9 taps, so each plane is read once per tap instead of streaming through scratch rows.
+		RT_TARGET_AVX2
+		static void FilterBlockAVX2(const Iteration& it, uint32_t x, uint32_t y)
+		{
+			const size_t p = x + (size_t)y * it.Width;
+			const float depthStep = 1.0f / (float)it.Step;
+			const __m256 zero = _mm256_setzero_ps();
+			const __m256 one = _mm256_set1_ps(1.0f);
+			const __m256 eighth = _mm256_set1_ps(0.125f);
+			const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+			const __m256 albedoScale = _mm256_set1_ps(InverseAlbedoSigmaSquared);
+
+			const __m256 luminance = _mm256_loadu_ps(it.Luminance + p);
+			const __m256 inverseSigma = _mm256_loadu_ps(it.InverseSigma + p);
+			const __m256 depthScale = _mm256_loadu_ps(it.DepthScale + p);
+			const __m256 depth = _mm256_loadu_ps(it.Depth + p);
+			const __m256 albedoR = _mm256_loadu_ps(it.Albedo[0] + p);
+			const __m256 albedoG = _mm256_loadu_ps(it.Albedo[1] + p);
+			const __m256 albedoB = _mm256_loadu_ps(it.Albedo[2] + p);
+			const __m256 normalX = _mm256_loadu_ps(it.Normal[0] + p);
+			const __m256 normalY = _mm256_loadu_ps(it.Normal[1] + p);
+			const __m256 normalZ = _mm256_loadu_ps(it.Normal[2] + p);
+
+			__m256 sumR = zero, sumG = zero, sumB = zero, sumWeight = zero, sumVariance = zero;
+			for (int dy = -1; dy <= 1; dy++)
+			{
+				int64_t tapY = (int64_t)y + dy * (int64_t)it.Step;
+				if (tapY < 0 || tapY >= (int64_t)it.Height)
+					continue;
+
+				for (int dx = -1; dx <= 1; dx++)
+				{
+					const size_t q = (size_t)((int64_t)x + dx * (int64_t)it.Step) + (size_t)tapY * it.Width;
+
+					__m256 normalWeight = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(normalX, _mm256_loadu_ps(it.Normal[0] + q)),
+						_mm256_mul_ps(normalY, _mm256_loadu_ps(it.Normal[1] + q))), _mm256_mul_ps(normalZ, _mm256_loadu_ps(it.Normal[2] + q)));
+					normalWeight = _mm256_max_ps(normalWeight, zero);
+					for (int i = 0; i < 6; i++)
+						normalWeight = _mm256_mul_ps(normalWeight, normalWeight);
+
+					__m256 depthTerm = _mm256_mul_ps(_mm256_and_ps(_mm256_sub_ps(depth, _mm256_loadu_ps(it.Depth + q)), absMask),
+						_mm256_mul_ps(depthScale, _mm256_set1_ps(TapDepthFactor[dy + 1][dx + 1] * depthStep)));
+					__m256 luminanceTerm = _mm256_mul_ps(_mm256_and_ps(_mm256_sub_ps(luminance, _mm256_loadu_ps(it.Luminance + q)), absMask), inverseSigma);
+					__m256 differenceR = _mm256_sub_ps(albedoR, _mm256_loadu_ps(it.Albedo[0] + q));
+					__m256 differenceG = _mm256_sub_ps(albedoG, _mm256_loadu_ps(it.Albedo[1] + q));
+					__m256 differenceB = _mm256_sub_ps(albedoB, _mm256_loadu_ps(it.Albedo[2] + q));
+					__m256 albedoTerm = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(differenceR, differenceR), _mm256_mul_ps(differenceG, differenceG)),
+						_mm256_mul_ps(differenceB, differenceB)), albedoScale);
+
+					__m256 e = _mm256_max_ps(_mm256_sub_ps(one, _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(depthTerm, luminanceTerm), albedoTerm), eighth)), zero);
+					e = _mm256_mul_ps(e, e);
+					e = _mm256_mul_ps(e, e);
+					e = _mm256_mul_ps(e, e);
+					__m256 weight = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(Kernel[dy + 1] * Kernel[dx + 1]), normalWeight), e);
+
+					sumR = _mm256_add_ps(sumR, _mm256_mul_ps(weight, _mm256_loadu_ps(it.Color[0] + q)));
+					sumG = _mm256_add_ps(sumG, _mm256_mul_ps(weight, _mm256_loadu_ps(it.Color[1] + q)));
+					sumB = _mm256_add_ps(sumB, _mm256_mul_ps(weight, _mm256_loadu_ps(it.Color[2] + q)));
+					sumWeight = _mm256_add_ps(sumWeight, weight);
+					sumVariance = _mm256_add_ps(sumVariance, _mm256_mul_ps(_mm256_mul_ps(weight, weight), _mm256_loadu_ps(it.Variance + q)));
+				}
+			}
+
+			// Division by zero in the sky lanes is masked away
+			__m256 hasWeight = _mm256_cmp_ps(sumWeight, zero, _CMP_GT_OQ);
+			__m256 inverseWeight = _mm256_div_ps(one, sumWeight);
+			__m256 outR = _mm256_blendv_ps(_mm256_loadu_ps(it.Color[0] + p), _mm256_mul_ps(sumR, inverseWeight), hasWeight);
+			__m256 outG = _mm256_blendv_ps(_mm256_loadu_ps(it.Color[1] + p), _mm256_mul_ps(sumG, inverseWeight), hasWeight);
+			__m256 outB = _mm256_blendv_ps(_mm256_loadu_ps(it.Color[2] + p), _mm256_mul_ps(sumB, inverseWeight), hasWeight);
+			__m256 outVariance = _mm256_blendv_ps(_mm256_loadu_ps(it.Variance + p), _mm256_mul_ps(_mm256_mul_ps(sumVariance, inverseWeight), inverseWeight), hasWeight);
+			_mm256_storeu_ps(it.OutColor[0] + p, outR);
+			_mm256_storeu_ps(it.OutColor[1] + p, outG);
+			_mm256_storeu_ps(it.OutColor[2] + p, outB);
+			_mm256_storeu_ps(it.OutVariance + p, outVariance);
+
+			// UpdateNoise
+			__m256 outLuminance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(0.2126f), outR), _mm256_mul_ps(_mm256_set1_ps(0.7152f), outG)),
+				_mm256_mul_ps(_mm256_set1_ps(0.0722f), outB));
+			__m256 outInverseSigma = _mm256_div_ps(one, _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(it.ColorSigma), _mm256_sqrt_ps(outVariance)),
+				_mm256_set1_ps(LuminanceEpsilon)));
+			_mm256_storeu_ps(it.OutLuminance + p, outLuminance);
+			_mm256_storeu_ps(it.OutInverseSigma + p, outInverseSigma);
+		}
+#endif
+	}
+
+	void Denoiser::Resize(uint32_t width, uint32_t height)
+	{
+		if (m_Width == width && m_Height == height && IsAllocated())
+			return;
+
+		m_Width = width;
+		m_Height = height;
+		// Plane starts 64 bytes apart modulo 4 KiB
+		m_PlaneStride = ((size_t)width * height + 15) / 16 * 16 + 16;
+		m_Planes.assign(m_PlaneStride * PlaneCount, 0.0f);
+		m_Source = 0;
+	}
+
+	void Denoiser::Release()
+	{
+		std::vector<float>().swap(m_Planes);
+		m_Width = m_Height = 0;
+		m_PlaneStride = 0;
+	}
+
+	void Denoiser::Denoise(ThreadPool& pool, const float* depth, uint32_t iterations, float colorSigma)
+	{
+		if (!IsAllocated())
+			return;
+
+		// Later iterations get the noise estimate from the one before
+		pool.ParallelFor(m_Height, [&](uint32_t y, uint32_t)
+			{
+				const float* color[3] = { GetColor(0), GetColor(1), GetColor(2) };
+				float* depthCopy = GetPlane(Depth);
+				float* depthScale = GetPlane(DepthScale);
+				for (size_t p = (size_t)y * m_Width; p < (size_t)(y + 1) * m_Width; p++)
+				{
+					Utils::UpdateNoise(color, GetVariance(), colorSigma, GetPlane(m_Source + Luminance), GetPlane(m_Source + InverseSigma), p);
+					depthCopy[p] = depth[p];
+					depthScale[p] = 1.0f / (Utils::DepthSigma * std::max(std::abs(depth[p]), Utils::MinDepth));
+				}
+			});
+
+		bool avx2 = CPUFeatures::DetectSIMDLevel() == SIMDLevel::AVX2;
+		for (uint32_t i = 0; i < iterations; i++)
+		{
+			uint32_t target = SetSize - m_Source;
+
+			Utils::Iteration it;
+			for (int c = 0; c < 3; c++)
+			{
+				it.Color[c] = GetPlane(m_Source + ColorR + c);
+				it.OutColor[c] = GetPlane(target + ColorR + c);
+				it.Albedo[c] = GetPlane(Albedo + c);
+				it.Normal[c] = GetPlane(Normal + c);
+			}
+			it.Variance = GetPlane(m_Source + Variance);
+			it.OutVariance = GetPlane(target + Variance);
+			it.Luminance = GetPlane(m_Source + Luminance);
+			it.OutLuminance = GetPlane(target + Luminance);
+			it.InverseSigma = GetPlane(m_Source + InverseSigma);
+			it.OutInverseSigma = GetPlane(target + InverseSigma);
+			it.DepthScale = GetPlane(DepthScale);
+			it.Depth = GetPlane(Depth);
+			it.Width = m_Width;
+			it.Height = m_Height;
+			it.Step = 1u << i;
+			it.ColorSigma = colorSigma;
+
+			pool.ParallelFor(m_Height, [&](uint32_t y, uint32_t)
+				{
+					uint32_t x = 0;
+#ifdef RT_X64
+					// Blocks whose taps stay inside the row, the border pixels take the checked path
+					if (avx2)
+					{
+						for (; x < it.Step && x < m_Width; x++)
+							Utils::FilterPixel(it, x, y);
+						for (; x + 8 + it.Step <= m_Width; x += 8)
+							Utils::FilterBlockAVX2(it, x, y);
+					}
+#endif
+					for (; x < m_Width; x++)
+						Utils::FilterPixel(it, x, y);
+				});
+
+			m_Source = target;
+		}
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace RayTracing {
+	class ThreadPool;
+
+	// Edge-avoiding a-trous wavelet filter (Dammertz et al., "Edge-Avoiding A-Trous Wavelet Transform
+	// for fast Global Illumination Filtering", HPG 2010) with the variance-guided luminance weight of
+	// SVGF (Schied et al., HPG 2017). Each iteration is a 3x3 binomial kernel whose taps are spread
+	// 2^i pixels apart, weighted down where the first hit's normal, depth or albedo changes, or where
+	// the luminance differs by more than the noise explains. Five iterations cover 63x63 pixels.
+	//
+	// Every buffer is planar and every weight branch-free, so 8 pixels of a row are filtered at once
+	// with AVX2.
+	class Denoiser
+	{
+	public:
+		// Planes are zeroed, which reads as sky until features are written
+		void Resize(uint32_t width, uint32_t height);
+		void Release();
+		bool IsAllocated() const { return !m_Planes.empty(); }
+
+		// First-hit features, written while tracing. Pixels whose normal is zero (sky) are passed through.
+		float* GetAlbedo(int channel) { return GetPlane(Albedo + channel); }
+		float* GetNormal(int channel) { return GetPlane(Normal + channel); }
+
+		// Input: mean color per pixel and the variance of its mean luminance, filled in by the caller
+		float* GetColor(int channel) { return GetPlane(m_Source + ColorR + channel); }
+		float* GetVariance() { return GetPlane(m_Source + Variance); }
+
+		// Filters the input in place, one pool task per row. depth is the distance along the camera
+		// ray of each pixel's first hit.
+		void Denoise(ThreadPool& pool, const float* depth, uint32_t iterations, float colorSigma);
+
+		const float* GetColor(int channel) const { return m_Planes.data() + (m_Source + ColorR + channel) * m_PlaneStride; }
+		size_t GetMemoryBytes() const { return m_Planes.size() * sizeof(float); }
+	private:
+		enum Plane : uint32_t
+		{
+			// Ping-pong between iterations, the second set starts at SetSize
+			ColorR = 0, ColorG, ColorB, Variance,
+			// Luminance and its noise-scaled inverse spread, written by each iteration for the next
+			Luminance, InverseSigma,
+			SetSize,
+
+			// Inverse of the depth difference that counts as an edge, and the depth itself
+			DepthScale = 2 * SetSize, Depth,
+			Albedo, Normal = Albedo + 3,
+			PlaneCount = Normal + 3
+		};
+
+		float* GetPlane(uint32_t plane) { return m_Planes.data() + plane * m_PlaneStride; }
+	private:
+		uint32_t m_Width = 0, m_Height = 0;
+
+		// All planes in one allocation. The stride is padded by a cache line so the ~50 streams a tap
+		// reads do not all map to the same L1 sets, as page-aligned planes of the same size would.
+		std::vector<float> m_Planes;
+		size_t m_PlaneStride = 0;
+		// First plane of the set holding the input and the result
+		uint32_t m_Source = 0;
+	};
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+
+namespace RayTracing {
+	// PCG hash from Jarzynski & Olano, "Hash Functions for GPU Rendering" (JCGT 2020)
+	inline uint32_t PCGHash(uint32_t input)
+	{
+		uint32_t state = input * 747796405u + 2891336453u;
+		uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return (word >> 22u) ^ word;
+	}
+
+	// Small counter-based generator that lives on the stack of the trace functions.
+	// Every (pixel, frame, bounce) gets its own stream, so the image does not depend
+	// on which thread traced which pixel, or on how many numbers an earlier bounce used.
+	class RandomStream {
+	public:
+		// One seed per camera path, hashed from everything that identifies it
+		static uint32_t PathSeed(uint32_t pixelIndex, uint32_t frameIndex, uint32_t seed)
+		{
+			return PCGHash(pixelIndex + PCGHash(frameIndex + PCGHash(seed)));
+		}
+
+		RandomStream(uint32_t pathSeed, uint32_t bounce)
+			: m_State(PCGHash(pathSeed + PCGHash(bounce)))
+		{
+		}
+
+		uint32_t UInt()
+		{
+			uint32_t state = m_State;
+			m_State = m_State * 747796405u + 2891336453u;
+			uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+			return (word >> 22u) ^ word;
+		}
+
+		// [0, 1), using the top 24 bits so every value is exactly representable
+		float Float()
+		{
+			return (float)(UInt() >> 8) * (1.0f / 16777216.0f);
+		}
+
+		glm::vec3 Vec3(float min, float max)
+		{
+			float x = Float();
+			float y = Float();
+			float z = Float();
+			return glm::vec3(x, y, z) * (max - min) + min;
+		}
+
+		// Same distribution as Walnut::Random::InUnitSphere (a normalized cube sample)
+		glm::vec3 InUnitSphere()
+		{
+			return glm::normalize(Vec3(-1.0f, 1.0f));
+		}
+	private:
+		uint32_t m_State;
+	};
+}
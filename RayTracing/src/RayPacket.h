@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Ray.h"
+
+#include <glm/glm.hpp>
+#include <cstdint>
+
+namespace RayTracing {
+	// Up to 4x4 coherent rays in structure-of-arrays form, traced through the BVH together.
+	// Unused lanes have a negative HitDistance so they never hit anything.
+	struct RayPacket
+	{
+		static constexpr uint32_t Width = 4;
+		static constexpr uint32_t MaxSize = Width * Width;
+
+		alignas(16) float OriginX[MaxSize];
+		alignas(16) float OriginY[MaxSize];
+		alignas(16) float OriginZ[MaxSize];
+		alignas(16) float InvDirectionX[MaxSize];
+		alignas(16) float InvDirectionY[MaxSize];
+		alignas(16) float InvDirectionZ[MaxSize];
+		alignas(16) float HitDistance[MaxSize];
+
+		Ray Rays[MaxSize];
+		// Sphere or triangle index of the closest hit, see BVH::IntersectPacket
+		int HitObject[MaxSize];
+		uint32_t Count = 0;
+
+		void Clear()
+		{
+			Count = 0;
+			for (uint32_t i = 0; i < MaxSize; i++)
+			{
+				OriginX[i] = OriginY[i] = OriginZ[i] = 0.0f;
+				InvDirectionX[i] = InvDirectionY[i] = InvDirectionZ[i] = 1.0f;
+				HitDistance[i] = -1.0f;
+				HitObject[i] = -1;
+			}
+		}
+
+		void Add(const Ray& ray)
+		{
+			uint32_t i = Count++;
+			Rays[i] = ray;
+			OriginX[i] = ray.Origin.x;
+			OriginY[i] = ray.Origin.y;
+			OriginZ[i] = ray.Origin.z;
+			InvDirectionX[i] = 1.0f / ray.Direction.x;
+			InvDirectionY[i] = 1.0f / ray.Direction.y;
+			InvDirectionZ[i] = 1.0f / ray.Direction.z;
+			HitDistance[i] = ray.Length;
+			HitObject[i] = -1;
+		}
+	};
+}
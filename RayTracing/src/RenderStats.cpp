@@ -0,0 +1,67 @@
+#include "RenderStats.h"
+
+namespace RayTracing {
+	void RenderStats::Merge(const RenderStats& other)
+	{
+		CameraRays += other.CameraRays;
+		BounceRays += other.BounceRays;
+		ShadowRays += other.ShadowRays;
+		NodesVisited += other.NodesVisited;
+		SphereTests += other.SphereTests;
+		TriangleTests += other.TriangleTests;
+
+		for (uint32_t i = 0; i < DepthBuckets; i++)
+			PathDepth[i] += other.PathDepth[i];
+		TotalPathDepth += other.TotalPathDepth;
+		DiffuseEvents += other.DiffuseEvents;
+		GlassEvents += other.GlassEvents;
+
+		for (size_t i = 0; i < (size_t)RenderStage::Count; i++)
+			StageMs[i] += other.StageMs[i];
+	}
+
+	void RenderStats::WriteJSON(FILE* file) const
+	{
+		fprintf(file, "{\"frame\":%u,\"threads\":%u,\"frameMs\":%.4f,\"tilesMs\":%.4f", FrameIndex, ThreadCount, FrameMs, TilesMs);
+		fprintf(file, ",\"rays\":{\"camera\":%llu,\"bounce\":%llu,\"shadow\":%llu}", (unsigned long long)CameraRays,
+			(unsigned long long)BounceRays, (unsigned long long)ShadowRays);
+		fprintf(file, ",\"nodesVisited\":%llu,\"sphereTests\":%llu,\"triangleTests\":%llu", (unsigned long long)NodesVisited,
+			(unsigned long long)SphereTests, (unsigned long long)TriangleTests);
+		fprintf(file, ",\"diffuseEvents\":%llu,\"glassEvents\":%llu", (unsigned long long)DiffuseEvents, (unsigned long long)GlassEvents);
+
+		fprintf(file, ",\"pathDepth\":[");
+		for (uint32_t i = 0; i < DepthBuckets; i++)
+			fprintf(file, i ? ",%llu" : "%llu", (unsigned long long)PathDepth[i]);
+
+		fprintf(file, "],\"averagePathDepth\":%.4f", GetAveragePathDepth());
+
+		fprintf(file, ",\"stageMs\":{");
+		for (size_t i = 0; i < (size_t)RenderStage::Count; i++)
+			fprintf(file, "%s\"%s\":%.4f", i ? "," : "", GetStageName((RenderStage)i), StageMs[i]);
+		fprintf(file, "}}\n");
+	}
+
+	double RenderStats::GetAveragePathDepth() const
+	{
+		uint64_t paths = 0;
+		for (uint32_t i = 0; i < DepthBuckets; i++)
+			paths += PathDepth[i];
+		return paths ? (double)TotalPathDepth / (double)paths : 0.0;
+	}
+
+	const char* RenderStats::GetStageName(RenderStage stage)
+	{
+		switch (stage)
+		{
+		case RenderStage::Setup:      return "setup";
+		case RenderStage::CameraRays: return "cameraRays";
+		case RenderStage::Paths:      return "paths";
+		case RenderStage::Intersect:  return "intersect";
+		case RenderStage::Shade:      return "shade";
+		case RenderStage::Accumulate: return "accumulate";
+		case RenderStage::Denoise:    return "denoise";
+		default: break;
+		}
+		return "unknown";
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+
+// Hot-path counters are compiled out of Dist builds; RT_STAT(...) expands to nothing there
+#ifndef WL_DIST
+#define RT_ENABLE_STATS 1
+#define RT_STAT(statement) statement
+#else
+#define RT_STAT(statement)
+#endif
+
+namespace RayTracing {
+	enum class RenderStage
+	{
+		// BVH rebuild, buffer clears and thread pool setup, wall time on the calling thread
+		Setup = 0,
+		// Generating camera rays and tracing them as packets
+		CameraRays,
+		// Recursive integrator: everything after the camera rays, including accumulation
+		Paths,
+		// Wavefront integrator stages
+		Intersect,
+		Shade,
+		Accumulate,
+		// Settings::Denoise after the tiles, wall time on the calling thread
+		Denoise,
+		Count
+	};
+
+	// One per pool thread, written without synchronization and merged once per frame
+	struct alignas(64) RenderStats
+	{
+		// Index = diffuse bounces before the path ended, the last bucket collects anything deeper
+		static constexpr uint32_t DepthBuckets = 10;
+
+		uint64_t CameraRays = 0;
+		uint64_t BounceRays = 0;
+		uint64_t ShadowRays = 0;
+
+		// Only counted with Settings::CollectBVHStats, they cost a branch per node
+		uint64_t NodesVisited = 0;
+		uint64_t SphereTests = 0;
+		uint64_t TriangleTests = 0;
+
+		uint64_t PathDepth[DepthBuckets] = {};
+		// Sum of the exact depths, for the average
+		uint64_t TotalPathDepth = 0;
+		uint64_t DiffuseEvents = 0;
+		uint64_t GlassEvents = 0;
+
+		// Setup and Denoise are wall time, the other stages are summed over all threads
+		double StageMs[(size_t)RenderStage::Count] = {};
+
+		// Filled in on the merged stats only
+		uint32_t FrameIndex = 0;
+		uint32_t ThreadCount = 0;
+		double FrameMs = 0.0;
+		double TilesMs = 0.0;
+
+		uint64_t GetTotalRays() const { return CameraRays + BounceRays + ShadowRays; }
+		void AddPathDepth(int depth) { PathDepth[std::min((uint32_t)depth, DepthBuckets - 1)]++; TotalPathDepth += depth; }
+		double GetAveragePathDepth() const;
+
+		void Reset() { *this = RenderStats(); }
+		// Adds the counters and stage times of other
+		void Merge(const RenderStats& other);
+
+		// One JSON object on a single line, so a log of frames is one object per line
+		void WriteJSON(FILE* file) const;
+
+		static const char* GetStageName(RenderStage stage);
+	};
+}
@@ -0,0 +1,147 @@
+#include "RenderThread.h"
+
+#include "Walnut/Timer.h"
+
+#include <cstring>
+
+namespace RayTracing {
+	RenderThread::RenderThread()
+		: m_Camera(45.0f, 0.01f, 100.0f), m_PendingCamera(45.0f, 0.01f, 100.0f)
+	{
+		m_Thread = std::thread(&RenderThread::ThreadLoop, this);
+	}
+
+	RenderThread::~RenderThread()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Shutdown = true;
+		}
+		m_WakeCondition.notify_all();
+		m_Thread.join();
+
+		if (m_StatsLog)
+			fclose(m_StatsLog);
+	}
+
+	void RenderThread::Submit(const Renderer::Settings& settings, const Camera& camera, uint32_t width, uint32_t height, bool interacting, bool resetFrameIndex)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_PendingSettings = settings;
+			m_PendingCamera = camera;
+			m_PendingWidth = width;
+			m_PendingHeight = height;
+			m_PendingInteracting = interacting;
+			m_PendingReset |= resetFrameIndex;
+		}
+		m_WakeCondition.notify_one();
+	}
+
+	void RenderThread::SubmitScene(const Scene& scene, bool geometryChanged)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_PendingScene = scene;
+			m_PendingSceneValid = true;
+			m_PendingGeometryChanged |= geometryChanged;
+		}
+		m_WakeCondition.notify_one();
+	}
+
+	const uint32_t* RenderThread::AcquireImage(FrameInfo& info)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (!m_ReadyIsNew)
+			return nullptr;
+
+		std::swap(m_PresentIndex, m_ReadyIndex);
+		m_ReadyIsNew = false;
+		info = m_Frames[m_PresentIndex].Info;
+		return m_Frames[m_PresentIndex].Pixels.data();
+	}
+
+	void RenderThread::SetStatsLogPath(const std::string& path)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_StatsLogPath = path;
+	}
+
+	void RenderThread::ThreadLoop()
+	{
+		bool hasScene = false;
+		while (true)
+		{
+			std::string statsLogPath;
+			{
+				std::unique_lock<std::mutex> lock(m_Mutex);
+				m_WakeCondition.wait(lock, [&]()
+					{
+						return m_Shutdown || (m_PendingWidth > 0 && m_PendingHeight > 0 && (hasScene || m_PendingSceneValid));
+					});
+				if (m_Shutdown)
+					return;
+
+				// The move leaves the pending scene empty, the next SubmitScene replaces all of it anyway
+				if (m_PendingSceneValid)
+				{
+					m_Scene = std::move(m_PendingScene);
+					if (m_PendingGeometryChanged)
+						m_Renderer.OnSceneChanged();
+					m_PendingSceneValid = false;
+					m_PendingGeometryChanged = false;
+					hasScene = true;
+				}
+
+				m_Renderer.GetSettings() = m_PendingSettings;
+				m_Camera = m_PendingCamera;
+				m_Renderer.OnResize(m_PendingWidth, m_PendingHeight);
+				m_Camera.OnResize(m_PendingWidth, m_PendingHeight);
+				m_Renderer.SetInteracting(m_PendingInteracting);
+				if (m_PendingReset)
+					m_Renderer.ResetFrameIndex();
+				m_PendingReset = false;
+				statsLogPath = m_StatsLogPath;
+			}
+
+			Walnut::Timer timer;
+			m_Renderer.Render(m_Scene, m_Camera);
+
+#ifdef RT_ENABLE_STATS
+			if (statsLogPath != m_StatsLogOpenPath)
+			{
+				if (m_StatsLog)
+					fclose(m_StatsLog);
+				m_StatsLog = statsLogPath.empty() ? nullptr : fopen(statsLogPath.c_str(), "a");
+				m_StatsLogOpenPath = statsLogPath;
+			}
+			if (m_StatsLog)
+				m_Renderer.GetStats().WriteJSON(m_StatsLog);
+#endif
+
+			// Only a copy stays on this thread, the upload happens on the UI thread while the next frame traces
+			Frame& frame = m_Frames[m_WriteIndex];
+			uint32_t width = m_Renderer.GetWidth(), height = m_Renderer.GetHeight();
+			frame.Pixels.resize((size_t)width * height);
+			memcpy(frame.Pixels.data(), m_Renderer.GetImageData(), frame.Pixels.size() * sizeof(uint32_t));
+
+			FrameInfo& info = frame.Info;
+			info.Width = width;
+			info.Height = height;
+			info.FrameIndex = m_Renderer.GetFrameIndex();
+			info.PreviewStride = m_Renderer.GetPreviewStride();
+			info.ConvergedTiles = m_Renderer.GetConvergedTileCount();
+			info.TileCount = m_Renderer.GetTileCount();
+			info.FrameProgress = m_Renderer.GetFrameProgress();
+			info.Memory = m_Renderer.GetMemoryUsage();
+			info.BVHBuildStats = m_Renderer.GetBVHBuildStats();
+			info.MeshBVHBuildStats = m_Renderer.GetMeshBVHBuildStats();
+			info.Stats = m_Renderer.GetStats();
+			info.RenderMs = timer.ElapsedMillis();
+
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			std::swap(m_WriteIndex, m_ReadyIndex);
+			m_ReadyIsNew = true;
+		}
+	}
+}
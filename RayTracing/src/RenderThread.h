@@ -0,0 +1,98 @@
+#pragma once
+
+#include "Camera.h"
+#include "Renderer.h"
+#include "Scene.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace RayTracing {
+	// Runs a Renderer on a thread of its own so the UI thread never waits for a frame.
+	// The UI edits its own scene, camera and settings and submits copies; the render thread picks up
+	// the latest submission at the start of each frame. Finished images go through a triple buffer:
+	// the render thread writes one, the UI presents another and the third holds the newest finished
+	// frame, so neither side ever blocks on the other.
+	class RenderThread
+	{
+	public:
+		// What the UI shows about the frame a presented image came from
+		struct FrameInfo
+		{
+			uint32_t Width = 0, Height = 0;
+			// Wall time of the frame on the render thread, including the copy out
+			float RenderMs = 0.0f;
+			uint32_t FrameIndex = 0;
+			uint32_t PreviewStride = 1;
+			uint32_t ConvergedTiles = 0, TileCount = 0;
+			// Of a time-sliced frame, see Renderer::Settings::FrameBudgetMs
+			float FrameProgress = 0.0f;
+			Renderer::MemoryUsage Memory;
+			BVH::BuildStats BVHBuildStats, MeshBVHBuildStats;
+			RenderStats Stats;
+		};
+
+	public:
+		RenderThread();
+		~RenderThread();
+
+		RenderThread(const RenderThread&) = delete;
+		RenderThread& operator=(const RenderThread&) = delete;
+
+		// State for the next frame. A zero size pauses rendering. resetFrameIndex restarts
+		// accumulation and stays pending until a frame picked it up.
+		void Submit(const Renderer::Settings& settings, const Camera& camera, uint32_t width, uint32_t height, bool interacting, bool resetFrameIndex);
+		// Copies the scene. geometryChanged = spheres or vertices were moved, resized or given
+		// another material, see Renderer::OnSceneChanged.
+		void SubmitScene(const Scene& scene, bool geometryChanged);
+
+		// Takes the newest finished frame if one arrived since the last call, otherwise returns nullptr.
+		// The pixels stay valid until the next call.
+		const uint32_t* AcquireImage(FrameInfo& info);
+
+		// Appends the render stats of every frame to path as JSON lines, an empty path stops logging
+		void SetStatsLogPath(const std::string& path);
+	private:
+		void ThreadLoop();
+	private:
+		struct Frame
+		{
+			std::vector<uint32_t> Pixels;
+			FrameInfo Info;
+		};
+
+		// Only touched by the render thread
+		Renderer m_Renderer;
+		Scene m_Scene;
+		Camera m_Camera;
+		FILE* m_StatsLog = nullptr;
+		std::string m_StatsLogOpenPath;
+
+		// Everything below is guarded by m_Mutex
+		std::mutex m_Mutex;
+		std::condition_variable m_WakeCondition;
+		bool m_Shutdown = false;
+
+		Renderer::Settings m_PendingSettings;
+		Camera m_PendingCamera;
+		uint32_t m_PendingWidth = 0, m_PendingHeight = 0;
+		bool m_PendingInteracting = false;
+		bool m_PendingReset = false;
+		Scene m_PendingScene;
+		bool m_PendingSceneValid = false;
+		bool m_PendingGeometryChanged = false;
+		std::string m_StatsLogPath;
+
+		// m_Frames[m_WriteIndex] belongs to the render thread, m_Frames[m_PresentIndex] to the UI and
+		// m_Frames[m_ReadyIndex] is the newest finished frame, new if m_ReadyIsNew
+		Frame m_Frames[3];
+		uint32_t m_WriteIndex = 0, m_ReadyIndex = 1, m_PresentIndex = 2;
+		bool m_ReadyIsNew = false;
+
+		std::thread m_Thread;
+	};
+}
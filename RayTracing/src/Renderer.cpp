@@ -1,14 +1,21 @@
 #include "Renderer.h"
 
-#include "Walnut/Random.h"
+#include "Random.h"
+
 #include <iostream>
 
+#include <algorithm>
 #include <cmath> 
-#include <execution>
+#include <cfloat>
+#include <cstring>
 #include <math.h>
+#ifdef _WIN32
 #include <corecrt_math_defines.h>
+#endif
 #include <unordered_map>
 
+#include "Walnut/Timer.h"
+
 namespace RayTracing {
 	namespace Utils {
 		static uint32_t ConvertToRGBA(const glm::vec4& color) {
@@ -19,73 +26,374 @@ namespace RayTracing {
 
 			return (a << 24) | (b << 16) | (g << 8) | r;
 		}
+
+#ifdef RT_ENABLE_STATS
+		static void AddStageTime(RenderStats& threadStats, RenderStage stage, Walnut::Timer& timer)
+		{
+			threadStats.StageMs[(size_t)stage] += timer.ElapsedMillis();
+			timer.Reset();
+		}
+#endif
+
+		static float Luminance(const glm::vec3& color)
+		{
+			return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+		}
 	}
 
 	void Renderer::OnResize(uint32_t width, uint32_t height)
 	{
 		if (width == 0 || height == 0)
 			return;
-		if (m_FinalImage)
-		{
-			if (m_FinalImage->GetWidth() == width && m_FinalImage->GetHeight() == height)
-				return;
+		if (m_Width == width && m_Height == height)
+			return;
 
-			m_FinalImage->Resize(width, height);
-		}
-		else
-		{
-			m_FinalImage = std::make_shared<Walnut::Image>(width, height, Walnut::ImageFormat::RGBA);
-		}
+		m_Width = width;
+		m_Height = height;
 		
-		delete[] m_ImageData;
-		m_ImageData = new uint32_t[width * height];
+		m_ImageData.resize((size_t)width * height);
+
+		m_Accumulation.Resize(width * height, m_Settings.Accumulation);
+
+		m_LuminanceSquaredData.resize((size_t)width * height);
+		m_SampleCounts.resize((size_t)width * height);
 
-		delete[] m_AccumulationData;
-		m_AccumulationData = new glm::vec4[width * height];
+		m_DepthData.resize((size_t)width * height);
+		m_ObjectData.resize((size_t)width * height);
 
-		m_ImageHorizontalIter.resize(width);
-		m_ImageVerticalIter.resize(height);
-		for (uint32_t i = 0; i < width; i++)
-			m_ImageHorizontalIter[i] = i;
-		for (uint32_t i = 0; i < height; i++)
-			m_ImageVerticalIter[i] = i;
+		// Allocated again by the next Render that denoises
+		m_Denoiser.Release();
+		m_Denoised = false;
+		m_AOVs.Release();
 
+		// Allocated again on the next camera move, headless renders never need it
+		m_History.Accumulation.Release();
+		std::vector<float>().swap(m_History.LuminanceSquared);
+		std::vector<uint32_t>().swap(m_History.SampleCounts);
+		std::vector<float>().swap(m_History.Depth);
+		std::vector<int32_t>().swap(m_History.Objects);
+
+		// Nothing to reproject across a resize
+		m_HasAccumulationCamera = false;
+		m_FrameIndex = 1;
+		m_NextTile = 0;
+	}
+
+	void Renderer::AllocateHistory()
+	{
+		uint32_t pixelCount = m_Width * m_Height;
+		m_History.Accumulation.Resize(pixelCount, m_Accumulation.GetFormat());
+		if (!m_History.SampleCounts.empty())
+			return;
+
+		m_History.LuminanceSquared.resize(pixelCount);
+		m_History.SampleCounts.resize(pixelCount);
+		m_History.Depth.resize(pixelCount);
+		m_History.Objects.resize(pixelCount);
+	}
+
+	Renderer::MemoryUsage Renderer::GetMemoryUsage(uint32_t width, uint32_t height, AccumulationFormat format, bool history)
+	{
+		size_t pixelCount = (size_t)width * height;
+		MemoryUsage usage;
+		usage.Image = pixelCount * sizeof(uint32_t);
+		usage.Accumulation = pixelCount * AccumulationBuffer::GetBytesPerPixel(format);
+		usage.Statistics = pixelCount * (sizeof(float) + sizeof(uint32_t));
+		usage.PrimaryHits = pixelCount * (sizeof(float) + sizeof(int32_t));
+		if (history)
+			usage.History = usage.Accumulation + usage.Statistics + usage.PrimaryHits;
+		return usage;
+	}
+
+	Renderer::MemoryUsage Renderer::GetMemoryUsage() const
+	{
+		MemoryUsage usage = GetMemoryUsage(m_Width, m_Height, m_Accumulation.GetFormat(), !m_History.SampleCounts.empty());
+		usage.Denoising = m_Denoiser.GetMemoryBytes();
+		usage.AOVs = m_AOVs.GetSizeBytes();
+		return usage;
+	}
+
+	uint32_t Renderer::AccumulationDither(uint32_t index) const
+	{
+		return RandomStream::PathSeed(index, m_FrameIndex + m_Settings.SampleOffset, m_Settings.Seed);
+	}
+
+	void Renderer::RestoreAccumulation(uint32_t frameIndex, const void* accumulation, const float* luminanceSquared,
+		const uint32_t* sampleCounts, const uint8_t* tileConverged, uint32_t tileCount)
+	{
+		uint32_t pixelCount = m_Width * m_Height;
+		m_Accumulation.Resize(pixelCount, m_Settings.Accumulation);
+		memcpy(m_Accumulation.GetData(), accumulation, m_Accumulation.GetSizeBytes());
+		m_LuminanceSquaredData.assign(luminanceSquared, luminanceSquared + pixelCount);
+		m_SampleCounts.assign(sampleCounts, sampleCounts + pixelCount);
+		m_TileConverged.assign(tileConverged, tileConverged + tileCount);
+
+		// The first frame after this one sets the accumulation camera without restarting
+		m_HasAccumulationCamera = false;
+		m_Reprojecting = false;
+		m_FrameIndex = std::max(frameIndex, 1u);
+		m_NextTile = 0;
+
+		for (uint32_t i = 0; i < pixelCount; i++)
+			ResolvePixel(i);
 	}
 
 	void Renderer::Render(const Scene& scene, const Camera& camera)
 	{
-		if (m_FinalImage == nullptr)
+		if (m_ImageData.empty())
 			return;
+		Walnut::Timer frameTimer;
 		m_ActiveScene = &scene;
 		m_ActiveCamera = &camera;
 
-		if (m_FrameIndex == 1)
-			memset(m_AccumulationData, 0, m_FinalImage->GetWidth() * m_FinalImage->GetHeight() * sizeof(glm::vec4));
+		if (m_BVH.GetSIMDLevel() != std::min(m_Settings.SphereSIMDLevel, CPUFeatures::DetectSIMDLevel()))
+			m_BVH.SetSIMDLevel(m_Settings.SphereSIMDLevel);
 
-		
-		std::for_each(std::execution::par, m_ImageVerticalIter.begin(), m_ImageVerticalIter.end(),
-			[&](uint32_t y)
+		if (m_SceneChanged || m_BVHScene != &scene || m_BVHSphereCount != scene.Spheres.size() || m_BVHTriangleCount != scene.Triangles.size())
+		{
+			m_BVH.Build(scene.Spheres, scene.Materials);
+			m_MeshBVH.Build(scene.Vertices, scene.Triangles, scene.Materials, (uint32_t)scene.Spheres.size());
+			m_BVHScene = &scene;
+			m_BVHSphereCount = scene.Spheres.size();
+			m_BVHTriangleCount = scene.Triangles.size();
+			m_SceneChanged = false;
+		}
+
+		// Emission is only picked up on rough diffuse hits, so only those spheres are lights
+		m_EmissiveSpheres.clear();
+		if (m_Settings.NextEventEstimation)
+		{
+			for (uint32_t i = 0; i < (uint32_t)scene.Spheres.size(); i++)
 			{
-				std::for_each(std::execution::par, m_ImageHorizontalIter.begin(), m_ImageHorizontalIter.end(),
-				[this, y](uint32_t x)
-					{
-						glm::vec4 color = PerPixel(x, y);
-						color = glm::sqrt(color);
+				const Material& material = scene.Materials[scene.Spheres[i].MaterialIndex];
+				if (material.Type == MaterialType::Diffuse && material.Diffuse.Roughness != 0.0f && glm::dot(material.Diffuse.GetEmission(), glm::vec3(1.0f)) > 0.0f)
+					m_EmissiveSpheres.push_back(i);
+			}
+		}
 
-						m_AccumulationData[x + y * m_FinalImage->GetWidth()] += color;
+		// Preview frames write the image directly and leave the accumulation buffers alone
+		bool preview = m_Interacting && m_Settings.InteractivePreview;
+		uint32_t stride = preview ? m_PreviewStride : 1;
+		m_RenderingPreview = preview;
 
-						glm::vec4 accumulatedColor = m_AccumulationData[x + y * m_FinalImage->GetWidth()];
-						accumulatedColor /= (float)m_FrameIndex;
+		if (!preview)
+		{
+			// Samples in the old format are dropped
+			if (m_Accumulation.GetFormat() != m_Settings.Accumulation)
+			{
+				m_Accumulation.Resize(m_Width * m_Height, m_Settings.Accumulation);
+				m_HasAccumulationCamera = false;
+				m_FrameIndex = 1;
+				m_NextTile = 0;
+			}
 
-						accumulatedColor = glm::clamp(accumulatedColor, 0.0f, 1.0f);
+			bool cameraMoved = m_HasAccumulationCamera && (camera.GetView() != m_AccumulationView || camera.GetProjection() != m_AccumulationProjection);
+			if (cameraMoved)
+			{
+				// The old accumulation becomes the history the new one is seeded from
+				if (m_Settings.TemporalReprojection && m_Settings.Accumulate && m_FrameIndex > 1)
+				{
+					AllocateHistory();
+					std::swap(m_Accumulation, m_History.Accumulation);
+					std::swap(m_LuminanceSquaredData, m_History.LuminanceSquared);
+					std::swap(m_SampleCounts, m_History.SampleCounts);
+					std::swap(m_DepthData, m_History.Depth);
+					std::swap(m_ObjectData, m_History.Objects);
+					m_HistoryViewProjection = m_AccumulationProjection * m_AccumulationView;
+					m_HistoryPosition = m_AccumulationPosition;
+					m_Reprojecting = true;
+				}
+				m_FrameIndex = 1;
+				m_NextTile = 0;
+			}
 
-						
+			m_AccumulationView = camera.GetView();
+			m_AccumulationProjection = camera.GetProjection();
+			m_AccumulationPosition = camera.GetPosition();
+			m_HasAccumulationCamera = true;
+		}
 
-						m_ImageData[x + y * m_FinalImage->GetWidth()] = Utils::ConvertToRGBA(accumulatedColor);
-					});
-			});
+		bool denoise = m_Settings.Denoise && !preview && !m_Settings.ShowSampleCount;
+		m_HoldImage = denoise;
+		if (m_Settings.Denoise)
+		{
+			m_RetraceConvergedTiles |= !m_Denoiser.IsAllocated();
+			m_Denoiser.Resize(m_Width, m_Height);
+		}
+		else if (m_Denoiser.IsAllocated())
+			m_Denoiser.Release();
+		m_Denoised = false;
+
+		if (m_AOVs.GetEnabled() != m_Settings.AOVs)
+		{
+			m_AOVs.Resize((size_t)m_Width * m_Height, m_Settings.AOVs);
+			m_RetraceConvergedTiles |= m_AOVs.IsAllocated();
+		}
+
+		// Preview tiles cover stride x stride more pixels so each still traces about TileSize^2 paths
+		uint32_t tileSize = std::max(1u, m_Settings.TileSize) * stride;
+		uint32_t tilesX = (m_Width + tileSize - 1) / tileSize;
+		uint32_t tilesY = (m_Height + tileSize - 1) / tileSize;
+		uint32_t tileCount = tilesX * tilesY;
+
+		// Tracing the rest of a sliced frame on another tile grid would sample some pixels twice
+		if (!preview && m_NextTile > 0 && tileCount != m_FrameTileCount)
+		{
+			m_FrameIndex = 1;
+			m_NextTile = 0;
+		}
+		// A time-sliced frame spans several calls, only the first one starts it
+		bool frameStart = !preview && m_NextTile == 0;
+
+		if (m_FrameIndex == 1 && frameStart)
+		{
+			m_Accumulation.Clear();
+			std::fill(m_LuminanceSquaredData.begin(), m_LuminanceSquaredData.end(), 0.0f);
+			std::fill(m_SampleCounts.begin(), m_SampleCounts.end(), 0u);
+		}
+
+		if (!m_ThreadPool || m_ThreadPoolSize != m_Settings.ThreadCount)
+		{
+			m_ThreadPool = std::make_unique<ThreadPool>(m_Settings.ThreadCount);
+			m_ThreadPoolSize = m_Settings.ThreadCount;
+		}
+
+		bool wavefront = m_Settings.Integrator == IntegratorMode::Wavefront && !m_Settings.PreviewRenderer && !preview;
+		if (wavefront)
+			m_WavefrontQueues.resize(m_ThreadPool->GetThreadCount());
+
+		// Converged flags are per tile, so they start over when the tile grid changes. Converged tiles
+		// also record no primary hits, so newly allocated feature buffers clear them too.
+		bool adaptive = m_Settings.AdaptiveSampling && m_Settings.Accumulate && !preview;
+		if (frameStart)
+		{
+			if (m_FrameIndex == 1 || m_TileConverged.size() != tileCount || m_RetraceConvergedTiles)
+				m_TileConverged.assign(tileCount, 0);
+			m_RetraceConvergedTiles = false;
+			m_ConvergedTiles = 0;
+			m_FrameTileCount = tileCount;
+		}
+
+		// Handed down the call chain of every tile, the counters themselves are compiled out of Dist builds
+		m_ThreadStats.resize(m_ThreadPool->GetThreadCount());
+#ifdef RT_ENABLE_STATS
+		for (RenderStats& stats : m_ThreadStats)
+			stats.Reset();
+		float setupMs = frameTimer.ElapsedMillis();
+#endif
+		Walnut::Timer tilesTimer;
+
+		auto renderTile = [&](uint32_t tile, uint32_t threadIndex)
+			{
+				RenderStats& threadStats = m_ThreadStats[threadIndex];
+
+				uint32_t minX = (tile % tilesX) * tileSize;
+				uint32_t minY = (tile / tilesX) * tileSize;
+				uint32_t maxX = std::min(minX + tileSize, m_Width);
+				uint32_t maxY = std::min(minY + tileSize, m_Height);
+
+				if (preview)
+				{
+					RenderPreviewTile(minX, minY, maxX, maxY, stride, threadStats);
+					return;
+				}
+
+				if (adaptive && m_TileConverged[tile])
+				{
+					// Nothing to trace, only refresh the pixels in case the overlay was toggled
+					for (uint32_t y = minY; y < maxY; y++)
+					{
+						for (uint32_t x = minX; x < maxX; x++)
+							ResolvePixel(x + y * m_Width);
+					}
+					m_ConvergedTiles.fetch_add(1, std::memory_order_relaxed);
+					return;
+				}
+
+				if (wavefront)
+					RenderTileWavefront(minX, minY, maxX, maxY, threadIndex, threadStats);
+				else
+					RenderTile(minX, minY, maxX, maxY, threadStats);
+
+				if (adaptive && m_FrameIndex >= m_Settings.MinSamples && TileError(minX, minY, maxX, maxY) < m_Settings.NoiseThreshold)
+				{
+					m_TileConverged[tile] = 1;
+					m_ConvergedTiles.fetch_add(1, std::memory_order_relaxed);
+				}
+			};
+
+		// Previews are cheap by design and always cover the whole image
+		uint32_t firstTile = preview ? 0 : m_NextTile;
+		uint32_t endTile = tileCount;
+		if (!preview && m_Settings.FrameBudgetMs > 0.0f)
+		{
+			// Batches of tiles until the budget is spent, each sized from the time per tile of the last
+			// one. The first batch always runs so every call makes progress.
+			uint32_t threadCount = m_ThreadPool->GetThreadCount();
+			endTile = firstTile;
+			while (endTile < tileCount)
+			{
+				float remainingMs = m_Settings.FrameBudgetMs - frameTimer.ElapsedMillis();
+				if (endTile > firstTile && remainingMs <= 0.0f)
+					break;
+
+				uint32_t batchSize = threadCount;
+				if (m_SliceTileMs > 0.0f)
+					batchSize = std::max(batchSize, (uint32_t)std::min(std::max(remainingMs, 0.0f) / m_SliceTileMs, (float)tileCount));
+				batchSize = std::min(batchSize, tileCount - endTile);
+
+				Walnut::Timer batchTimer;
+				uint32_t batchStart = endTile;
+				m_ThreadPool->ParallelFor(batchSize, [&](uint32_t tile, uint32_t threadIndex) { renderTile(batchStart + tile, threadIndex); });
+				m_SliceTileMs = batchTimer.ElapsedMillis() / (float)batchSize;
+				endTile += batchSize;
+			}
+		}
+		else
+		{
+			m_ThreadPool->ParallelFor(tileCount - firstTile, [&](uint32_t tile, uint32_t threadIndex) { renderTile(firstTile + tile, threadIndex); });
+		}
+		m_TileCount = tileCount;
+		float tilesMs = tilesTimer.ElapsedMillis();
+
+		// The frame is complete once its last tile was traced
+		bool frameDone = preview || endTile == tileCount;
+		if (!preview)
+			m_NextTile = frameDone ? 0 : endTile;
+
+		RT_STAT(Walnut::Timer denoiseTimer);
+		denoise = denoise && frameDone;
+		if (denoise)
+			DenoiseImage();
+		m_HoldImage = false;
+
+#ifdef RT_ENABLE_STATS
+		m_LastStats.Reset();
+		for (const RenderStats& stats : m_ThreadStats)
+			m_LastStats.Merge(stats);
+		m_LastStats.StageMs[(size_t)RenderStage::Setup] = setupMs;
+		m_LastStats.StageMs[(size_t)RenderStage::Denoise] = denoise ? denoiseTimer.ElapsedMillis() : 0.0f;
+		m_LastStats.FrameIndex = m_FrameIndex;
+		m_LastStats.ThreadCount = m_ThreadPool->GetThreadCount();
+		m_LastStats.TilesMs = tilesMs;
+		m_LastStats.FrameMs = frameTimer.ElapsedMillis();
+#endif
+
+		if (preview)
+		{
+			// Only the tiles scale with the stride, a BVH rebuild would throw the estimate off.
+			// The accumulation is left as it was; the next full frame restarts or reprojects it
+			// if the camera moved in the meantime.
+			UpdatePreviewStride(tilesMs);
+			return;
+		}
+
+		// The rest of the tiles follow in the next calls with the same frame index
+		if (!frameDone)
+			return;
 
-		m_FinalImage->SetData(m_ImageData);
+		// Every pixel has been seeded or rejected by now
+		m_Reprojecting = false;
 
 		if (m_Settings.Accumulate)
 			m_FrameIndex++;
@@ -93,6 +401,265 @@ namespace RayTracing {
 			m_FrameIndex = 1;
 	}
 
+	void Renderer::RenderTile(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY, RenderStats& threadStats)
+	{
+		RT_STAT(Walnut::Timer stageTimer);
+		if (!UsePrimaryPackets())
+		{
+			// Camera rays are interleaved with the paths here, all of it counts as Paths
+			for (uint32_t y = minY; y < maxY; y++)
+			{
+				for (uint32_t x = minX; x < maxX; x++)
+					AccumulatePixel(x, y, PerPixel(x, y, threadStats));
+			}
+			RT_STAT(Utils::AddStageTime(threadStats, RenderStage::Paths, stageTimer));
+			return;
+		}
+
+		constexpr uint32_t packetWidth = RayPacket::Width;
+		PrimaryHit primaryHits[RayPacket::MaxSize];
+		for (uint32_t blockY = minY; blockY < maxY; blockY += packetWidth)
+		{
+			for (uint32_t blockX = minX; blockX < maxX; blockX += packetWidth)
+			{
+				uint32_t blockMaxX = std::min(blockX + packetWidth, maxX);
+				uint32_t blockMaxY = std::min(blockY + packetWidth, maxY);
+				TraceCameraPacket(blockX, blockY, blockMaxX, blockMaxY, primaryHits, threadStats);
+				RT_STAT(Utils::AddStageTime(threadStats, RenderStage::CameraRays, stageTimer));
+
+				uint32_t hitIndex = 0;
+				for (uint32_t y = blockY; y < blockMaxY; y++)
+				{
+					for (uint32_t x = blockX; x < blockMaxX; x++)
+						AccumulatePixel(x, y, PerPixel(x, y, threadStats, &primaryHits[hitIndex++]));
+				}
+				RT_STAT(Utils::AddStageTime(threadStats, RenderStage::Paths, stageTimer));
+			}
+		}
+	}
+
+	void Renderer::RenderPreviewTile(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY, uint32_t stride, RenderStats& threadStats)
+	{
+		for (uint32_t blockY = minY; blockY < maxY; blockY += stride)
+		{
+			for (uint32_t blockX = minX; blockX < maxX; blockX += stride)
+			{
+				uint32_t blockMaxX = std::min(blockX + stride, maxX);
+				uint32_t blockMaxY = std::min(blockY + stride, maxY);
+
+				// One sample through the middle of the block, copied to all of its pixels
+				uint32_t x = std::min(blockX + stride / 2, blockMaxX - 1);
+				uint32_t y = std::min(blockY + stride / 2, blockMaxY - 1);
+				glm::vec4 color = glm::clamp(glm::sqrt(PerPixel(x, y, threadStats)), 0.0f, 1.0f);
+				uint32_t rgba = Utils::ConvertToRGBA(color);
+
+				for (uint32_t pixelY = blockY; pixelY < blockMaxY; pixelY++)
+				{
+					for (uint32_t pixelX = blockX; pixelX < blockMaxX; pixelX++)
+						m_ImageData[pixelX + pixelY * m_Width] = rgba;
+				}
+			}
+		}
+	}
+
+	void Renderer::UpdatePreviewStride(float tilesMs)
+	{
+		// Traced pixels fall with stride^2, so the time at another stride s is about tilesMs * (stride / s)^2
+		float targetMs = std::max(m_Settings.TargetFrameMs, 1.0f);
+		float stride = (float)m_PreviewStride;
+		if (tilesMs > targetMs)
+		{
+			m_PreviewStride = std::min((uint32_t)std::ceil(stride * std::sqrt(tilesMs / targetMs)), MaxPreviewStride);
+		}
+		else if (m_PreviewStride > 1)
+		{
+			// Refine one step at a time, and only when the finer stride is predicted to fit
+			float finerMs = tilesMs * (stride * stride) / ((stride - 1.0f) * (stride - 1.0f));
+			if (finerMs < targetMs)
+				m_PreviewStride--;
+		}
+	}
+
+	void Renderer::RecordPrimaryHit(uint32_t x, uint32_t y, const HitPayload& payload)
+	{
+		if (m_RenderingPreview)
+			return;
+
+		uint32_t index = x + y * m_Width;
+		bool hit = payload.HitDistance >= 0.0001f;
+		m_DepthData[index] = hit ? payload.HitDistance : -1.0f;
+		m_ObjectData[index] = hit ? (int32_t)payload.ObjectIndex : -1;
+
+		if (!m_Denoiser.IsAllocated() && !m_AOVs.IsAllocated())
+			return;
+
+		// Glass is treated as white, the denoiser then only stops at its outline and normals
+		glm::vec3 albedo(0.0f), normal(0.0f);
+		if (hit)
+		{
+			const Material& material = m_ActiveScene->Materials[payload.MaterialIndex];
+			albedo = material.Type == MaterialType::Diffuse ? material.Diffuse.Albedo : glm::vec3(1.0f);
+			normal = payload.WorldNormal;
+		}
+
+		if (m_Denoiser.IsAllocated())
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				m_Denoiser.GetAlbedo(c)[index] = albedo[c];
+				m_Denoiser.GetNormal(c)[index] = normal[c];
+			}
+		}
+
+		if (!m_AOVs.IsAllocated())
+			return;
+		if (hit)
+			m_AOVs.Record(index, payload.HitDistance, normal, albedo, payload.ObjectIndex, (uint32_t)payload.MaterialIndex);
+		else
+			m_AOVs.RecordMiss(index);
+	}
+
+	void Renderer::ReprojectPixel(uint32_t x, uint32_t y)
+	{
+		uint32_t index = x + y * m_Width;
+		float depth = m_DepthData[index];
+		int32_t object = m_ObjectData[index];
+
+		// Sky is projected as a direction so it reprojects under rotation only
+		glm::vec3 direction = m_ActiveCamera->GetRayDirection(x, y);
+		glm::vec3 worldPosition = m_ActiveCamera->GetPosition() + direction * depth;
+		glm::vec4 clip = m_HistoryViewProjection * (object < 0 ? glm::vec4(direction, 0.0f) : glm::vec4(worldPosition, 1.0f));
+		if (clip.w <= 0.0f)
+			return;
+
+		// Inverse of Camera::GetRayDirection's pixel to device coordinate mapping, nearest pixel
+		float historyX = std::floor((clip.x / clip.w + 1.0f) * 0.5f * (float)m_Width + 0.5f);
+		float historyY = std::floor((clip.y / clip.w + 1.0f) * 0.5f * (float)m_Height + 0.5f);
+		if (historyX < 0.0f || historyY < 0.0f || historyX >= (float)m_Width || historyY >= (float)m_Height)
+			return;
+
+		uint32_t historyIndex = (uint32_t)historyX + (uint32_t)historyY * m_Width;
+		uint32_t historyCount = m_History.SampleCounts[historyIndex];
+		if (historyCount == 0 || m_History.Objects[historyIndex] != object)
+			return;
+
+		if (object >= 0)
+		{
+			// Something else was in front of this point from the previous camera
+			float expectedDepth = glm::length(worldPosition - m_HistoryPosition);
+			if (std::abs(m_History.Depth[historyIndex] - expectedDepth) > m_Settings.DepthTolerance * expectedDepth)
+				return;
+		}
+
+		uint32_t maxHistory = std::max(m_Settings.MaxHistoryLength, 1u);
+		float scale = historyCount > maxHistory ? (float)maxHistory / (float)historyCount : 1.0f;
+		uint32_t sampleCount = std::min(historyCount, maxHistory);
+		m_Accumulation.SetMean(index, m_History.Accumulation.GetMean(historyIndex, historyCount), sampleCount, AccumulationDither(index));
+		m_LuminanceSquaredData[index] = m_History.LuminanceSquared[historyIndex] * scale;
+		m_SampleCounts[index] = sampleCount;
+	}
+
+	void Renderer::AccumulatePixel(uint32_t x, uint32_t y, glm::vec4 color)
+	{
+		uint32_t index = x + y * m_Width;
+		if (m_Reprojecting && m_SampleCounts[index] == 0)
+			ReprojectPixel(x, y);
+
+		uint32_t sampleCount = ++m_SampleCounts[index];
+		m_Accumulation.AddSamples(index, glm::vec3(color), 1, sampleCount, AccumulationDither(index));
+
+		float luminance = Utils::Luminance(glm::vec3(color));
+		m_LuminanceSquaredData[index] += luminance * luminance;
+
+		ResolvePixel(index);
+	}
+
+	void Renderer::ResolvePixel(uint32_t index)
+	{
+		if (m_HoldImage)
+			return;
+
+		uint32_t sampleCount = std::max(m_SampleCounts[index], 1u);
+		if (m_Settings.ShowSampleCount)
+		{
+			// Blue = few samples, red = as many as the current frame index
+			float t = std::min((float)sampleCount / (float)m_FrameIndex, 1.0f);
+			m_ImageData[index] = Utils::ConvertToRGBA(glm::vec4(t, 0.0f, 1.0f - t, 1.0f));
+			return;
+		}
+
+		glm::vec3 accumulatedColor = m_Accumulation.GetMean(index, sampleCount);
+
+		// Samples are averaged in linear space and the mean is gamma corrected, so the converged
+		// image does not depend on how noisy the samples were
+		accumulatedColor = glm::clamp(glm::sqrt(accumulatedColor), 0.0f, 1.0f);
+
+		m_ImageData[index] = Utils::ConvertToRGBA(glm::vec4(accumulatedColor, 1.0f));
+	}
+
+	float Renderer::PixelError(uint32_t index) const
+	{
+		uint32_t sampleCount = m_SampleCounts[index];
+		if (sampleCount < 2)
+			return FLT_MAX;
+
+		// Standard error of the mean luminance, carried through the display gamma (d sqrt(L) = dL / 2 sqrt(L))
+		// so the threshold is in the same units as the displayed image
+		float n = (float)sampleCount;
+		float mean = Utils::Luminance(m_Accumulation.GetSum(index, sampleCount)) / n;
+		float variance = std::max((m_LuminanceSquaredData[index] - n * mean * mean) / (n - 1.0f), 0.0f);
+		return std::sqrt(variance / n) / (2.0f * std::sqrt(std::max(mean, 1.0e-6f)));
+	}
+
+	void Renderer::DenoiseImage()
+	{
+		float* colors[3] = { m_Denoiser.GetColor(0), m_Denoiser.GetColor(1), m_Denoiser.GetColor(2) };
+		float* variance = m_Denoiser.GetVariance();
+		m_ThreadPool->ParallelFor(m_Height, [&](uint32_t y, uint32_t)
+			{
+				for (uint32_t index = y * m_Width; index < (y + 1) * m_Width; index++)
+				{
+					uint32_t sampleCount = m_SampleCounts[index];
+					glm::vec3 mean = m_Accumulation.GetMean(index, sampleCount);
+					for (int c = 0; c < 3; c++)
+						colors[c][index] = mean[c];
+
+					// Variance of the mean luminance. A single sample says nothing about its noise, so it
+					// is taken to be as large as the value itself.
+					float n = (float)sampleCount;
+					float luminance = Utils::Luminance(mean);
+					variance[index] = sampleCount >= 2
+						? std::max((m_LuminanceSquaredData[index] - n * luminance * luminance) / (n - 1.0f), 0.0f) / n
+						: luminance * luminance;
+				}
+			});
+
+		m_Denoiser.Denoise(*m_ThreadPool, m_DepthData.data(), m_Settings.DenoiseIterations, m_Settings.DenoiseColorSigma);
+
+		const Denoiser& denoiser = m_Denoiser;
+		m_ThreadPool->ParallelFor(m_Height, [&](uint32_t y, uint32_t)
+			{
+				for (uint32_t index = y * m_Width; index < (y + 1) * m_Width; index++)
+				{
+					glm::vec3 color(denoiser.GetColor(0)[index], denoiser.GetColor(1)[index], denoiser.GetColor(2)[index]);
+					color = glm::clamp(glm::sqrt(color), 0.0f, 1.0f);
+					m_ImageData[index] = Utils::ConvertToRGBA(glm::vec4(color, 1.0f));
+				}
+			});
+		m_Denoised = true;
+	}
+
+	float Renderer::TileError(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY) const
+	{
+		float error = 0.0f;
+		for (uint32_t y = minY; y < maxY; y++)
+		{
+			for (uint32_t x = minX; x < maxX; x++)
+				error = std::max(error, PixelError(x + y * m_Width));
+		}
+		return error;
+	}
+
 	namespace Utils {
 		static glm::vec3 RefractAndFresnel(const glm::vec3& IncomingRayDir, const glm::vec3& Normal, const float& ior, float& fresnel) {
 			glm::vec3 normalCopy = Normal;
@@ -125,41 +692,83 @@ namespace RayTracing {
 			return InternalReflection2 < 0.0f ? glm::vec3(0.0f) :
 				RefractionIndices * IncomingRayDir + (RefractionIndices * normalDotIRD - std::sqrt(InternalReflection2)) * normalCopy;
 		}
+
+		// Solid angle density of the diffuse bounce normalize(InUnitSphere() + normal). InUnitSphere
+		// normalizes a point uniform in [-1, 1]^3, whose direction s has density 1 / (24 max|s_i|^3).
+		// A bounce d with c = dot(normal, d) comes from s = 2c d - normal, and s -> d scales solid
+		// angle by 1 / 4c. This is the BSDF the integrator effectively renders with, so light
+		// sampling has to match it rather than an ideal Lambertian.
+		static float DiffuseBounceDensity(const glm::vec3& normal, const glm::vec3& direction)
+		{
+			float c = glm::dot(normal, direction);
+			if (c <= 0.0f)
+				return 0.0f;
+
+			glm::vec3 s = 2.0f * c * direction - normal;
+			float m = std::max(std::abs(s.x), std::max(std::abs(s.y), std::abs(s.z)));
+			return c / (6.0f * m * m * m);
+		}
+
+		// Power heuristic with beta = 2
+		static float PowerHeuristic(float pdf, float otherPdf)
+		{
+			return (pdf * pdf) / (pdf * pdf + otherPdf * otherPdf);
+		}
 	}
 
-	void Renderer::TraceColorRay(Ray& ray, glm::vec3& light, glm::vec3& contribution, const int& maxDepth, int& depth)
+	void Renderer::TraceColorRay(Ray& ray, glm::vec3& light, glm::vec3& contribution, int& depth, int glassDepth, uint32_t pathSeed, float bsdfPdf, RenderStats& threadStats, const HitPayload* firstHit)
 	{
-		if (depth >= maxDepth) {
+		if (depth >= (int)m_Settings.MaxDiffuseDepth) {
 			return;
 		}
-		Renderer::HitPayload payload = Renderer::TraceRay(ray);
+		RT_STAT(if (!firstHit) threadStats.BounceRays++);
+		Renderer::HitPayload payload = firstHit ? *firstHit : Renderer::TraceRay(ray, threadStats);
 		if (payload.HitDistance < 0.0001f)
 		{
 			//color = glm::vec3(0.01f, 0.01f, 0.01f);
-			light = glm::vec3(0.6f, 0.7f, 1.0f);
+			light += contribution * glm::vec3(0.6f, 0.7f, 1.0f);
 			return;
 		}
 
-		const Sphere& sphere = m_ActiveScene->Spheres[payload.ObjectIndex];
-		Material* material = m_ActiveScene->Materials[sphere.MaterialIndex];
+		const Material& material = m_ActiveScene->Materials[payload.MaterialIndex];
 		//TODO see if we can make this a switch
-		if (material->GetMaterialType() == MaterialType::Diffuse) {
+		if (material.Type == MaterialType::Diffuse) {
+			RT_STAT(threadStats.DiffuseEvents++);
 			depth++;
-			DiffuseMaterial* diffuse = (DiffuseMaterial*)material;
+			const DiffuseMaterial& diffuse = material.Diffuse;
+
+			if (diffuse.Roughness != 0.0f) {
+				glm::vec3 emission = diffuse.GetEmission();
+				if (bsdfPdf > 0.0f)
+					emission *= EmissionWeight(ray, payload, bsdfPdf);
 
-			if (diffuse->Roughness != 0.0f) {
 				glm::vec3 lightIntensity(0.0f);
-				for each (auto pointLight in m_ActiveScene->PointLights)
+				for (const PointLight& pointLight : m_ActiveScene->PointLights)
 				{
-					lightIntensity += CaculatePointLight(pointLight, payload);
+					lightIntensity += CaculatePointLight(pointLight, payload, threadStats);
 				}
-				light += ((float)M_PI) * lightIntensity + diffuse->GetEmission();
-				contribution *= diffuse->Albedo;
+				light += contribution * emission;
+				contribution *= diffuse.Albedo;
+				light += contribution * ((float)M_PI) * lightIntensity;
 
+				// The bounce draws first, so the stream matches renders without light sampling
+				RandomStream random(pathSeed, depth);
 				ray.Origin = payload.WorldPosition + (payload.WorldNormal * 0.0001f);
-				ray.Direction = glm::normalize(Walnut::Random::InUnitSphere() + payload.WorldNormal);
+				ray.Direction = glm::normalize(random.InUnitSphere() + payload.WorldNormal);
 
-				TraceColorRay(ray, light, contribution,maxDepth, depth);
+				// The bounce from the last diffuse vertex is never traced, so it cannot find the
+				// emitters either and light sampling there would add energy MIS never balances
+				float nextPdf = 0.0f;
+				if (!m_EmissiveSpheres.empty() && depth < (int)m_Settings.MaxDiffuseDepth)
+				{
+					light += contribution * SampleEmissiveSpheres(payload, random, threadStats);
+					nextPdf = Utils::DiffuseBounceDensity(payload.WorldNormal, ray.Direction);
+				}
+
+				if (!ContinuePath(contribution, depth, random))
+					return;
+
+				TraceColorRay(ray, light, contribution, depth, glassDepth, pathSeed, nextPdf, threadStats);
 
 				return;
 			}
@@ -167,13 +776,14 @@ namespace RayTracing {
 			ray.Origin = payload.WorldPosition + (payload.WorldNormal * 0.0001f);
 			ray.Direction = glm::reflect(ray.Direction, payload.WorldNormal);
 
-			TraceColorRay(ray, light, contribution, maxDepth, depth);
+			TraceColorRay(ray, light, contribution, depth, glassDepth, pathSeed, 0.0f, threadStats);
 		}
 		// Default to glass for now
 		else {
-			RefractiveMaterial* glass = (RefractiveMaterial*)material;
+			RT_STAT(threadStats.GlassEvents++);
+			const RefractiveMaterial& glass = material.Glass;
 			float fresnel = 1.0f;
-			glm::vec3 refract = Utils::RefractAndFresnel(ray.Direction, payload.WorldNormal, glass->RefractiveIndex, fresnel);
+			glm::vec3 refract = Utils::RefractAndFresnel(ray.Direction, payload.WorldNormal, glass.RefractiveIndex, fresnel);
 
 			Ray reflectionRay;
 			reflectionRay.Origin = ray.Origin + (payload.WorldNormal * 0.0001f);
@@ -186,12 +796,12 @@ namespace RayTracing {
 			//int depth2 = 0;
 			//TraceColorRay(reflectionRay, reflectionColor, reflectionContribution, 2, depth2);
 
-			if (fresnel < 1.0f) {
+			if (fresnel < 1.0f && glassDepth < (int)m_Settings.MaxGlassDepth) {
 				ray.Origin = payload.WorldPosition + (-payload.WorldNormal * 0.0001f);
 				ray.Direction += refract;
 
 				//depth++;
-				TraceColorRay(ray, light, contribution, maxDepth, depth);
+				TraceColorRay(ray, light, contribution, depth, glassDepth + 1, pathSeed, 0.0f, threadStats);
 			}
 			//contribution = reflectionColor * fresnel + refractionColor * (1 - fresnel);
 
@@ -202,16 +812,318 @@ namespace RayTracing {
 		}
 	}
 
-	glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y)
+	bool Renderer::ContinuePath(glm::vec3& contribution, int depth, RandomStream& random) const
 	{
+		if (!m_Settings.RussianRoulette || depth < (int)m_Settings.RussianRouletteDepth)
+			return true;
+
+		// Survive with probability equal to the largest throughput channel and make up for the
+		// paths that were cut by weighting the survivors up, which keeps the estimate unbiased
+		float survival = std::min(std::max(contribution.r, std::max(contribution.g, contribution.b)), 1.0f);
+		if (random.Float() >= survival)
+			return false;
+
+		contribution /= survival;
+		return true;
+	}
+
+	Ray Renderer::GenerateCameraRay(uint32_t x, uint32_t y, uint32_t pathSeed)
+	{
+		RandomStream random(pathSeed, 0);
+
 		Ray ray;
 		ray.Origin = m_ActiveCamera->GetPosition();
-		ray.Direction = m_ActiveCamera->GetRayDirections()[x + y * m_FinalImage->GetWidth()] + Walnut::Random::Vec3(-0.001f, 0.001f);
+		ray.Direction = m_ActiveCamera->GetRayDirection(x, y) + random.Vec3(-0.001f, 0.001f);
+		return ray;
+	}
+
+	bool Renderer::UsePrimaryPackets() const
+	{
+		// Packets traverse the BVH, the linear fallback stays one ray at a time
+		return m_Settings.PrimaryRayPackets && m_Settings.UseBVH;
+	}
+
+	void Renderer::TraceCameraPacket(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY, PrimaryHit* hits, RenderStats& threadStats)
+	{
+		RayPacket packet;
+		packet.Clear();
+
+		uint32_t count = 0;
+		for (uint32_t y = minY; y < maxY; y++)
+		{
+			for (uint32_t x = minX; x < maxX; x++)
+			{
+				PrimaryHit& hit = hits[count++];
+				hit.Seed = RandomStream::PathSeed(x + y * m_Width, m_FrameIndex + m_Settings.SampleOffset, m_Settings.Seed);
+				hit.CameraRay = GenerateCameraRay(x, y, hit.Seed);
+				packet.Add(hit.CameraRay);
+			}
+		}
+
+		RT_STAT(threadStats.CameraRays += count);
+		BVH::TraversalStats stats;
+		BVH::TraversalStats* statsPtr = nullptr;
+		RT_STAT(if (m_Settings.CollectBVHStats) statsPtr = &stats);
+
+		m_BVH.IntersectPacket(packet, statsPtr);
+		m_MeshBVH.IntersectPacket(packet, statsPtr);
+		if (statsPtr)
+			RecordTraversal(stats, threadStats);
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			if (packet.HitObject[i] < 0)
+				hits[i].Payload = Miss(hits[i].CameraRay);
+			else
+				hits[i].Payload = ClosestHit(hits[i].CameraRay, packet.HitDistance[i], packet.HitObject[i]);
+		}
+	}
+
+	// Same light transport as TraceColorRay, one stage at a time over every path of
+	// a tile: intersect all paths, bucket the hits by material type, shade each bucket
+	// in a tight loop and compact the survivors into the next queue.
+	void Renderer::RenderTileWavefront(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY, uint32_t threadIndex, RenderStats& threadStats)
+	{
+		const int maxDepth = (int)m_Settings.MaxDiffuseDepth;
+		const glm::vec3 skyColor(0.6f, 0.7f, 1.0f);
+
+		WavefrontQueues& queues = m_WavefrontQueues[threadIndex];
+		uint32_t tileWidth = maxX - minX;
+		uint32_t pathCount = tileWidth * (maxY - minY);
+
+		queues.Paths.resize(pathCount);
+		queues.Hits.resize(pathCount);
+		queues.Colors.resize(pathCount);
+
+		RT_STAT(Walnut::Timer stageTimer);
+		bool primaryPackets = UsePrimaryPackets();
+		if (primaryPackets)
+		{
+			// Camera rays and their first hits come from 4x4 packets
+			constexpr uint32_t packetWidth = RayPacket::Width;
+			PrimaryHit primaryHits[RayPacket::MaxSize];
+			for (uint32_t blockY = minY; blockY < maxY; blockY += packetWidth)
+			{
+				for (uint32_t blockX = minX; blockX < maxX; blockX += packetWidth)
+				{
+					uint32_t blockMaxX = std::min(blockX + packetWidth, maxX);
+					uint32_t blockMaxY = std::min(blockY + packetWidth, maxY);
+					TraceCameraPacket(blockX, blockY, blockMaxX, blockMaxY, primaryHits, threadStats);
+
+					uint32_t hitIndex = 0;
+					for (uint32_t y = blockY; y < blockMaxY; y++)
+					{
+						for (uint32_t x = blockX; x < blockMaxX; x++)
+						{
+							const PrimaryHit& primary = primaryHits[hitIndex++];
+							uint32_t slot = (x - minX) + (y - minY) * tileWidth;
+
+							PathState& path = queues.Paths[slot];
+							path.Slot = slot;
+							path.Seed = primary.Seed;
+							path.PathRay = primary.CameraRay;
+							path.Light = glm::vec3(0.0f);
+							path.Contribution = glm::vec3(1.0f);
+							path.BSDFPdf = 0.0f;
+							path.Depth = 0;
+							path.GlassDepth = 0;
+							queues.Hits[slot] = primary.Payload;
+						}
+					}
+				}
+			}
+		}
+		else
+		{
+			for (uint32_t i = 0; i < pathCount; i++)
+			{
+				uint32_t x = minX + i % tileWidth;
+				uint32_t y = minY + i / tileWidth;
+
+				PathState& path = queues.Paths[i];
+				path.Slot = i;
+				path.Seed = RandomStream::PathSeed(x + y * m_Width, m_FrameIndex + m_Settings.SampleOffset, m_Settings.Seed);
+				path.PathRay = GenerateCameraRay(x, y, path.Seed);
+				RT_STAT(threadStats.CameraRays++);
+				path.Light = glm::vec3(0.0f);
+				path.Contribution = glm::vec3(1.0f);
+				path.BSDFPdf = 0.0f;
+				path.Depth = 0;
+				path.GlassDepth = 0;
+			}
+		}
+		RT_STAT(Utils::AddStageTime(threadStats, RenderStage::CameraRays, stageTimer));
+
+		// Every iteration adds a diffuse or a glass bounce to each surviving path, so the
+		// per-material depth limits bound the number of iterations
+		for (uint32_t iteration = 0; pathCount > 0; iteration++)
+		{
+			// Intersect, the first stage may already have been traced as packets
+			if (iteration > 0 || !primaryPackets)
+			{
+				for (uint32_t i = 0; i < pathCount; i++)
+					queues.Hits[i] = TraceRay(queues.Paths[i].PathRay, threadStats);
+			}
+			RT_STAT(if (iteration > 0) threadStats.BounceRays += pathCount);
+			RT_STAT(Utils::AddStageTime(threadStats, RenderStage::Intersect, stageTimer));
+
+			// Nothing has been compacted yet, path i is still slot i
+			if (iteration == 0)
+			{
+				for (uint32_t i = 0; i < pathCount; i++)
+					RecordPrimaryHit(minX + i % tileWidth, minY + i / tileWidth, queues.Hits[i]);
+			}
+
+			// Sort into material buckets. Terminated paths write out their color now.
+			queues.Diffuse.clear();
+			queues.Glass.clear();
+			for (uint32_t i = 0; i < pathCount; i++)
+			{
+				PathState& path = queues.Paths[i];
+				const HitPayload& payload = queues.Hits[i];
+				if (payload.HitDistance < 0.0001f)
+				{
+					path.Light += path.Contribution * skyColor;
+					queues.Colors[path.Slot] = path.Light;
+					RT_STAT(threadStats.AddPathDepth(path.Depth));
+					path.Depth = -1;
+					continue;
+				}
+
+				if (m_ActiveScene->Materials[payload.MaterialIndex].Type == MaterialType::Diffuse)
+					queues.Diffuse.push_back(i);
+				else
+					queues.Glass.push_back(i);
+			}
+
+			RT_STAT(threadStats.DiffuseEvents += queues.Diffuse.size());
+			RT_STAT(threadStats.GlassEvents += queues.Glass.size());
+
+			// Shade diffuse
+			for (uint32_t i : queues.Diffuse)
+			{
+				PathState& path = queues.Paths[i];
+				const HitPayload& payload = queues.Hits[i];
+				const DiffuseMaterial& diffuse = m_ActiveScene->Materials[payload.MaterialIndex].Diffuse;
+
+				path.Depth++;
+				if (diffuse.Roughness != 0.0f)
+				{
+					glm::vec3 emission = diffuse.GetEmission();
+					if (path.BSDFPdf > 0.0f)
+						emission *= EmissionWeight(path.PathRay, payload, path.BSDFPdf);
+
+					glm::vec3 lightIntensity(0.0f);
+					for (const PointLight& pointLight : m_ActiveScene->PointLights)
+						lightIntensity += CaculatePointLight(pointLight, payload, threadStats);
+					path.Light += path.Contribution * emission;
+					path.Contribution *= diffuse.Albedo;
+					path.Light += path.Contribution * ((float)M_PI) * lightIntensity;
+
+					RandomStream random(path.Seed, path.Depth);
+					path.PathRay.Origin = payload.WorldPosition + (payload.WorldNormal * 0.0001f);
+					path.PathRay.Direction = glm::normalize(random.InUnitSphere() + payload.WorldNormal);
+
+					// No light sampling at the last diffuse vertex, its bounce is dropped in Extend
+					path.BSDFPdf = 0.0f;
+					if (!m_EmissiveSpheres.empty() && path.Depth < maxDepth)
+					{
+						path.Light += path.Contribution * SampleEmissiveSpheres(payload, random, threadStats);
+						path.BSDFPdf = Utils::DiffuseBounceDensity(payload.WorldNormal, path.PathRay.Direction);
+					}
+
+					if (!ContinuePath(path.Contribution, path.Depth, random))
+					{
+						queues.Colors[path.Slot] = path.Light;
+						RT_STAT(threadStats.AddPathDepth(path.Depth));
+						path.Depth = -1;
+					}
+				}
+				else
+				{
+					path.PathRay.Origin = payload.WorldPosition + (payload.WorldNormal * 0.0001f);
+					path.PathRay.Direction = glm::reflect(path.PathRay.Direction, payload.WorldNormal);
+					path.BSDFPdf = 0.0f;
+				}
+			}
+
+			// Shade glass
+			for (uint32_t i : queues.Glass)
+			{
+				PathState& path = queues.Paths[i];
+				const HitPayload& payload = queues.Hits[i];
+				const RefractiveMaterial& glass = m_ActiveScene->Materials[payload.MaterialIndex].Glass;
+
+				float fresnel = 1.0f;
+				glm::vec3 refract = Utils::RefractAndFresnel(path.PathRay.Direction, payload.WorldNormal, glass.RefractiveIndex, fresnel);
+				if (fresnel < 1.0f && path.GlassDepth < (int)m_Settings.MaxGlassDepth)
+				{
+					path.PathRay.Origin = payload.WorldPosition + (-payload.WorldNormal * 0.0001f);
+					path.PathRay.Direction += refract;
+					path.BSDFPdf = 0.0f;
+					path.GlassDepth++;
+				}
+				else
+				{
+					queues.Colors[path.Slot] = path.Light;
+					RT_STAT(threadStats.AddPathDepth(path.Depth));
+					path.Depth = -1;
+				}
+			}
+
+			// Extend: compact the paths that are still alive and under the depth limit
+			uint32_t aliveCount = 0;
+			for (uint32_t i = 0; i < pathCount; i++)
+			{
+				const PathState& path = queues.Paths[i];
+				if (path.Depth < 0)
+					continue;
+				if (path.Depth >= maxDepth)
+				{
+					queues.Colors[path.Slot] = path.Light;
+					RT_STAT(threadStats.AddPathDepth(path.Depth));
+					continue;
+				}
+				queues.Paths[aliveCount++] = path;
+			}
+			pathCount = aliveCount;
+			RT_STAT(Utils::AddStageTime(threadStats, RenderStage::Shade, stageTimer));
+		}
+
+		for (uint32_t i = 0; i < pathCount; i++)
+		{
+			queues.Colors[queues.Paths[i].Slot] = queues.Paths[i].Light;
+			RT_STAT(threadStats.AddPathDepth(queues.Paths[i].Depth));
+		}
+
+		for (uint32_t y = minY; y < maxY; y++)
+		{
+			for (uint32_t x = minX; x < maxX; x++)
+				AccumulatePixel(x, y, glm::vec4(queues.Colors[(x - minX) + (y - minY) * tileWidth], 1.0f));
+		}
+		RT_STAT(Utils::AddStageTime(threadStats, RenderStage::Accumulate, stageTimer));
+	}
+
+	glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y, RenderStats& threadStats, const PrimaryHit* primary)
+	{
+		uint32_t pathSeed = primary ? primary->Seed : RandomStream::PathSeed(x + y * m_Width, m_FrameIndex + m_Settings.SampleOffset, m_Settings.Seed);
+		Ray ray = primary ? primary->CameraRay : GenerateCameraRay(x, y, pathSeed);
+		const HitPayload* firstHit = primary ? &primary->Payload : nullptr;
+
+		// Traced here rather than in TraceColorRay so every ray traced there is a bounce
+		HitPayload cameraHit;
+		if (!firstHit)
+		{
+			RT_STAT(threadStats.CameraRays++);
+			cameraHit = TraceRay(ray, threadStats);
+			firstHit = &cameraHit;
+		}
+		RecordPrimaryHit(x, y, *firstHit);
 		
 		glm::vec3 color(0.0f);
 		glm::vec3 contribution(1.0f);
 		if (m_Settings.PreviewRenderer) {
-			Renderer::HitPayload payload = TraceRay(ray);
+			Renderer::HitPayload payload = *firstHit;
 			if (payload.HitDistance < 0.0001f)
 			{
 				//color = glm::vec3(0.01f, 0.01f, 0.01f);
@@ -219,20 +1131,20 @@ namespace RayTracing {
 			}
 			else {
 				float facingRatio = std::max(0.0f, glm::dot(payload.WorldNormal, -ray.Direction));
-				const Sphere& sphere = m_ActiveScene->Spheres[payload.ObjectIndex];
-				Material* material = m_ActiveScene->Materials[sphere.MaterialIndex];
+				const Material& material = m_ActiveScene->Materials[payload.MaterialIndex];
 				color = glm::vec3(facingRatio);
 				//TODO see if we can make this a switch
-				if (material->GetMaterialType() == MaterialType::Diffuse) {
-					DiffuseMaterial* diffuse = (DiffuseMaterial*)material;
-					glm::vec3 sphereColor = diffuse->Albedo;
+				if (material.Type == MaterialType::Diffuse) {
+					const DiffuseMaterial& diffuse = material.Diffuse;
+					glm::vec3 sphereColor = diffuse.Albedo;
 					color *= sphereColor;
 				}
 			}
 		}
 		else {
 			int depth = 0;
-			TraceColorRay(ray, color, contribution, 8, depth);
+			TraceColorRay(ray, color, contribution, depth, 0, pathSeed, 0.0f, threadStats, firstHit);
+			RT_STAT(threadStats.AddPathDepth(depth));
 		}
 
 
@@ -352,10 +1264,10 @@ namespace RayTracing {
 			
 		}*/
 
-		return glm::vec4(color*contribution, 1.0f);
+		return glm::vec4(color, 1.0f);
 	}
 
-	glm::vec3 Renderer::CaculatePointLight(const PointLight& pointLight, const Renderer::HitPayload& payload)
+	glm::vec3 Renderer::CaculatePointLight(const PointLight& pointLight, const Renderer::HitPayload& payload, RenderStats& threadStats)
 	{
 		glm::vec3 lightDir = pointLight.Position - payload.WorldPosition;
 		float r2 = glm::length(lightDir);
@@ -369,7 +1281,7 @@ namespace RayTracing {
 		shadowRay.Length = dist;
 		glm::normalize(shadowRay.Direction);
 
-		Renderer::HitPayload shadowPayload = Renderer::TraceShadowRay(shadowRay);
+		Renderer::HitPayload shadowPayload = Renderer::TraceShadowRay(shadowRay, threadStats);
 		if (shadowPayload.HitDistance > 0.0001f)
 		{
 			return glm::vec3(0.0f, 0.0f, 0.0f);
@@ -377,76 +1289,143 @@ namespace RayTracing {
 		return lightIntensity * std::max(0.0f, glm::dot(payload.WorldNormal, lightDir));
 	}
 
-	//TEMP
-	Renderer::HitPayload Renderer::TraceShadowRay(const Ray& ray)
+	glm::vec3 Renderer::SampleEmissiveSpheres(const Renderer::HitPayload& payload, RandomStream& random, RenderStats& threadStats)
 	{
-		int closestSphere = -1;
-		float hitDistance = ray.Length;
-		for (size_t i = 0; i < m_ActiveScene->Spheres.size(); i++) {
-			const Sphere& sphere = m_ActiveScene->Spheres[i];
-			glm::vec3 origin = ray.Origin - sphere.Position;
+		uint32_t emitterCount = (uint32_t)m_EmissiveSpheres.size();
+		uint32_t emitter = std::min((uint32_t)(random.Float() * emitterCount), emitterCount - 1);
+		const Sphere& sphere = m_ActiveScene->Spheres[m_EmissiveSpheres[emitter]];
+
+		// Sample from where the diffuse bounce starts, so EmissionWeight sees the same cone. Right next
+		// to an emitter resting on a surface the hit point and the bounce origin see different cones.
+		glm::vec3 origin = payload.WorldPosition + (payload.WorldNormal * 0.0001f);
+		glm::vec3 toCenter = sphere.Position - origin;
+		float distanceSquared = glm::dot(toCenter, toCenter);
+		float radiusSquared = sphere.Radius * sphere.Radius;
+		if (distanceSquared <= radiusSquared)
+			return glm::vec3(0.0f);
+
+		// Uniform direction in the cone the sphere subtends, 1 - cosMax written without cancellation
+		float sinMaxSquared = radiusSquared / distanceSquared;
+		float oneMinusCosMax = sinMaxSquared / (1.0f + std::sqrt(1.0f - sinMaxSquared));
+		float cosTheta = 1.0f - random.Float() * oneMinusCosMax;
+		float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+		float phi = 2.0f * (float)M_PI * random.Float();
+
+		float distance = std::sqrt(distanceSquared);
+		glm::vec3 w = toCenter / distance;
+		glm::vec3 helper = std::abs(w.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+		glm::vec3 u = glm::normalize(glm::cross(helper, w));
+		glm::vec3 v = glm::cross(w, u);
+		glm::vec3 direction = (u * std::cos(phi) + v * std::sin(phi)) * sinTheta + w * cosTheta;
+
+		// Directions the diffuse bounce can never take carry no light
+		float bsdfPdf = Utils::DiffuseBounceDensity(payload.WorldNormal, direction);
+		if (bsdfPdf <= 0.0f)
+			return glm::vec3(0.0f);
+
+		// The emitter is visible if it is the closest hit, anything else in front of it occludes. Unlike
+		// point lights, glass blocks it: bounces that refract through glass reach the emitter with full
+		// weight, so light sampling must not count the same light again.
+		float projection = glm::dot(direction, toCenter);
+		float hitDistance = projection - std::sqrt(std::max(0.0f, projection * projection - distanceSquared + radiusSquared));
 
-			float a = glm::dot(ray.Direction, ray.Direction);
-			float b = 2.0f * glm::dot(origin, ray.Direction);
-			float c = glm::dot(origin, origin) - sphere.Radius * sphere.Radius;
+		Ray shadowRay;
+		shadowRay.Origin = origin;
+		shadowRay.Direction = direction;
+		shadowRay.Length = hitDistance * 1.001f;
+
+		RT_STAT(threadStats.ShadowRays++);
+		float occluderDistance = shadowRay.Length;
+		int occluder = IntersectScene(shadowRay, occluderDistance, false, threadStats);
+		if (occluder >= 0 && occluder != (int)m_EmissiveSpheres[emitter])
+			return glm::vec3(0.0f);
+
+		const Material& material = m_ActiveScene->Materials[sphere.MaterialIndex];
+		float lightPdf = 1.0f / (2.0f * (float)M_PI * oneMinusCosMax * (float)emitterCount);
+		return material.Diffuse.GetEmission() * (bsdfPdf / lightPdf) * Utils::PowerHeuristic(lightPdf, bsdfPdf);
+	}
 
-			// Quadratic Forumula discriminant:
-			// b^2 - 4ac
-			float discriminant = b * b - 4.0f * a * c;
-			if (discriminant < 0.0f)
-				continue;
+	float Renderer::EmissionWeight(const Ray& ray, const Renderer::HitPayload& payload, float bsdfPdf) const
+	{
+		// Emissive triangles are only found by bounces
+		if (payload.ObjectIndex >= m_ActiveScene->Spheres.size())
+			return 1.0f;
 
+		float lightPdf = EmissiveSpherePdf(ray.Origin, m_ActiveScene->Spheres[payload.ObjectIndex]);
+		return Utils::PowerHeuristic(bsdfPdf, lightPdf);
+	}
 
-			float closestT = (-b - sqrt(discriminant)) / (2.0f * a);
-			if (closestT > 0 && closestT < hitDistance) {
-				const Sphere& sphere = m_ActiveScene->Spheres[i];
-				Material* material = m_ActiveScene->Materials[sphere.MaterialIndex];
+	float Renderer::EmissiveSpherePdf(const glm::vec3& point, const Sphere& sphere) const
+	{
+		glm::vec3 toCenter = sphere.Position - point;
+		float distanceSquared = glm::dot(toCenter, toCenter);
+		float radiusSquared = sphere.Radius * sphere.Radius;
+		if (distanceSquared <= radiusSquared)
+			return 0.0f;
+
+		float sinMaxSquared = radiusSquared / distanceSquared;
+		float oneMinusCosMax = sinMaxSquared / (1.0f + std::sqrt(1.0f - sinMaxSquared));
+		return 1.0f / (2.0f * (float)M_PI * oneMinusCosMax * (float)m_EmissiveSpheres.size());
+	}
 
-				if (material->GetMaterialType() != MaterialType::Glass) {
-					hitDistance = closestT;
-					closestSphere = (int)i;
-				}
-			}
-		}
+	//TEMP
+	Renderer::HitPayload Renderer::TraceShadowRay(const Ray& ray, RenderStats& threadStats)
+	{
+		RT_STAT(threadStats.ShadowRays++);
+		float hitDistance = ray.Length;
+		int closestObject = IntersectScene(ray, hitDistance, true, threadStats);
 
-		if (closestSphere < 0)
+		if (closestObject < 0)
 			return Miss(ray);
 
-		return ClosestHit(ray, hitDistance, closestSphere);
+		return ClosestHit(ray, hitDistance, closestObject);
 	}
 
-	Renderer::HitPayload Renderer::TraceRay(const Ray& ray)
+	Renderer::HitPayload Renderer::TraceRay(const Ray& ray, RenderStats& threadStats)
 	{
-		int closestSphere = -1;
 		float hitDistance = ray.Length;
-		for (size_t i = 0; i < m_ActiveScene->Spheres.size(); i++) {
-			const Sphere& sphere = m_ActiveScene->Spheres[i];
-			glm::vec3 origin = ray.Origin - sphere.Position;
-
-			float a = glm::dot(ray.Direction, ray.Direction);
-			float b = 2.0f * glm::dot(origin, ray.Direction);
-			float c = glm::dot(origin, origin) - sphere.Radius * sphere.Radius;
-
-			// Quadratic Forumula discriminant:
-			// b^2 - 4ac
-			float discriminant = b * b - 4.0f * a * c;
-			if (discriminant < 0.0f)
-				continue;
-
-
-			float closestT = (-b - sqrt(discriminant)) / (2.0f * a);
-			if (closestT > 0 && closestT < hitDistance) {
-				hitDistance = closestT;
-				closestSphere = (int)i;
-				continue;
-			}
-			//float t0 = -b + sqrt(discriminant) / (2.0f * a);
-		}
+		int closestObject = IntersectScene(ray, hitDistance, false, threadStats);
 
-		if (closestSphere < 0)
+		if (closestObject < 0)
 			return Miss(ray);
 
-		return ClosestHit(ray, hitDistance, closestSphere);
+		return ClosestHit(ray, hitDistance, closestObject);
+	}
+
+	int Renderer::IntersectScene(const Ray& ray, float& hitDistance, bool shadowRay, RenderStats& threadStats)
+	{
+		BVH::TraversalStats stats;
+		BVH::TraversalStats* statsPtr = nullptr;
+		RT_STAT(if (m_Settings.CollectBVHStats) statsPtr = &stats);
+
+		// The mesh BVH starts from the sphere hit distance, so it only reports closer triangles
+		int closestObject;
+		if (m_Settings.UseBVH)
+		{
+			closestObject = m_BVH.Intersect(ray, hitDistance, shadowRay, statsPtr);
+			int closestTriangle = m_MeshBVH.Intersect(ray, hitDistance, shadowRay, statsPtr);
+			if (closestTriangle >= 0)
+				closestObject = closestTriangle;
+		}
+		else
+		{
+			closestObject = m_BVH.IntersectLinear(ray, hitDistance, shadowRay, statsPtr);
+			int closestTriangle = m_MeshBVH.IntersectLinear(ray, hitDistance, shadowRay, statsPtr);
+			if (closestTriangle >= 0)
+				closestObject = closestTriangle;
+		}
+
+		if (statsPtr)
+			RecordTraversal(stats, threadStats);
+		return closestObject;
+	}
+
+	void Renderer::RecordTraversal(const BVH::TraversalStats& stats, RenderStats& threadStats)
+	{
+		// Only reached with CollectBVHStats, which Dist builds never turn on
+		threadStats.NodesVisited += stats.NodesVisited;
+		threadStats.SphereTests += stats.SphereTests;
+		threadStats.TriangleTests += stats.TriangleTests;
 	}
 
 	Renderer::HitPayload Renderer::ClosestHit(const Ray& ray, float hitDistance, int objectIndex)
@@ -455,7 +1434,25 @@ namespace RayTracing {
 		payload.HitDistance = hitDistance;
 		payload.ObjectIndex = objectIndex;
 
+		uint32_t sphereCount = (uint32_t)m_ActiveScene->Spheres.size();
+		if ((uint32_t)objectIndex >= sphereCount)
+		{
+			const Triangle& triangle = m_ActiveScene->Triangles[objectIndex - sphereCount];
+			const glm::vec3& v0 = m_ActiveScene->Vertices[triangle.Indices[0]];
+			const glm::vec3& v1 = m_ActiveScene->Vertices[triangle.Indices[1]];
+			const glm::vec3& v2 = m_ActiveScene->Vertices[triangle.Indices[2]];
+			payload.MaterialIndex = triangle.MaterialIndex;
+			payload.WorldPosition = ray.Origin + ray.Direction * hitDistance;
+			payload.WorldNormal = glm::normalize(glm::cross(v1 - v0, v2 - v0));
+
+			// Diffuse surfaces are two-sided, glass keeps the outward normal to tell entering from leaving
+			if (m_ActiveScene->Materials[triangle.MaterialIndex].Type != MaterialType::Glass && glm::dot(payload.WorldNormal, ray.Direction) > 0.0f)
+				payload.WorldNormal = -payload.WorldNormal;
+			return payload;
+		}
+
 		const Sphere& closestSphere = m_ActiveScene->Spheres[objectIndex];
+		payload.MaterialIndex = closestSphere.MaterialIndex;
 
 		glm::vec3 origin = ray.Origin - closestSphere.Position;
 		payload.WorldPosition = origin + ray.Direction * hitDistance;
@@ -1,21 +1,128 @@
 #pragma once
 
-#include "Walnut/Image.h"
-
+#include "AccumulationBuffer.h"
+#include "AOVBuffers.h"
+#include "BVH.h"
 #include "Camera.h"
+#include "Denoiser.h"
 #include "Ray.h"
+#include "RenderStats.h"
 #include "Scene.h"
+#include "ThreadPool.h"
 
+#include <atomic>
 #include <memory>
+#include <vector>
 #include <glm/glm.hpp>
 
 namespace RayTracing {
+	class RandomStream;
+
+	enum class IntegratorMode
+	{
+		// One pixel at a time through the recursive TraceColorRay
+		Recursive = 0,
+		// Batched intersect/shade/extend stages over all paths of a tile
+		Wavefront
+	};
+
 	class Renderer {
 	public:
 		struct Settings
 		{
 			bool Accumulate = true;
 			bool PreviewRenderer = false;
+			IntegratorMode Integrator = IntegratorMode::Recursive;
+
+			// 0 = one thread per hardware thread
+			uint32_t ThreadCount = 0;
+			// Square tiles handed out by the thread pool
+			uint32_t TileSize = 16;
+			// > 0 traces only the tiles that fit in this many milliseconds per Render call and continues
+			// with the rest in the next calls, so a heavy frame never holds up the caller for long.
+			// The frame index advances once all tiles were traced.
+			float FrameBudgetMs = 0.0f;
+
+			// Same seed, frame index and settings give bit-identical images at any thread count
+			uint32_t Seed = 0;
+			// Added to the frame index when seeding paths, so processes rendering the same image with
+			// different offsets trace disjoint samples (headless --coordinator)
+			uint32_t SampleOffset = 0;
+
+			// false falls back to testing every sphere, for comparison
+			bool UseBVH = true;
+			// Trace camera rays in 4x4 packets (preview and first bounce), needs the BVH
+			bool PrimaryRayPackets = true;
+			// Capped to what the CPU supports
+			SIMDLevel SphereSIMDLevel = SIMDLevel::AVX2;
+			// Adds BVH nodes visited and sphere tests to the render stats
+			bool CollectBVHStats = false;
+
+			// Diffuse and mirror bounces before a path stops
+			uint32_t MaxDiffuseDepth = 8;
+			// Glass refractions before a path stops, they do not count towards MaxDiffuseDepth
+			uint32_t MaxGlassDepth = 16;
+			// Stop low-throughput paths at random after RussianRouletteDepth diffuse bounces, unbiased
+			bool RussianRoulette = true;
+			uint32_t RussianRouletteDepth = 3;
+
+			// Shadow rays towards emissive spheres at every diffuse bounce but the last, combined with the
+			// bounces that hit them by multiple importance sampling
+			bool NextEventEstimation = true;
+
+			// Stop tracing tiles whose noise fell below NoiseThreshold (needs Accumulate)
+			bool AdaptiveSampling = false;
+			// Largest standard error of a pixel's mean luminance, in display space
+			float NoiseThreshold = 0.01f;
+			// Every tile gets at least this many samples before it may stop
+			uint32_t MinSamples = 16;
+			// Replace the image with a samples-per-pixel heat map
+			bool ShowSampleCount = false;
+
+			// While SetInteracting(true), render 1 spp at a reduced resolution picked to hit TargetFrameMs
+			bool InteractivePreview = true;
+			float TargetFrameMs = 16.0f;
+
+			// Carry accumulated samples over when the camera moves, reprojected through the previous
+			// camera and rejected where the surface under the pixel changed
+			bool TemporalReprojection = true;
+			// Reused samples per pixel are capped so lighting seen from the old view fades out
+			uint32_t MaxHistoryLength = 64;
+			// Relative difference between the expected and stored hit distance that counts as a disocclusion
+			float DepthTolerance = 0.05f;
+
+			// Storage of the accumulated samples, changing it restarts accumulation (see AccumulationBuffer.h)
+			AccumulationFormat Accumulation = AccumulationFormat::Float32;
+
+			// Filter the displayed image after every frame, guided by the first hit's albedo, normal and
+			// depth (see Denoiser.h). The accumulation itself stays noisy.
+			bool Denoise = false;
+			// A-trous iterations, n of them reach 2^(n+1) - 1 pixels across
+			uint32_t DenoiseIterations = 5;
+			// Luminance differences beyond this many standard deviations of the noise count as edges
+			float DenoiseColorSigma = 4.0f;
+
+			// Extra per-pixel outputs recorded from the primary hits, see AOVBuffers.h
+			AOV AOVs = AOV::None;
+		};
+
+		// Bytes held by the per-pixel buffers
+		struct MemoryUsage
+		{
+			size_t Image = 0;
+			size_t Accumulation = 0;
+			// Squared luminance sums and sample counts
+			size_t Statistics = 0;
+			// Distance and object of each pixel's primary hit
+			size_t PrimaryHits = 0;
+			// Second set of the three above for reprojection, allocated on the first camera move
+			size_t History = 0;
+			// Albedo and normal of each primary hit and the filter's planes, while Settings::Denoise is on
+			size_t Denoising = 0;
+			// Settings::AOVs
+			size_t AOVs = 0;
+
+			size_t GetTotal() const { return Image + Accumulation + Statistics + PrimaryHits + History + Denoising + AOVs; }
 		};
 
 	public:
@@ -24,9 +131,54 @@ namespace RayTracing {
 		void OnResize(uint32_t width, uint32_t height);
 		void Render(const Scene& scene, const Camera& camera);
 
-		std::shared_ptr<Walnut::Image> GetFinalImage() const { return m_FinalImage; }
+		uint32_t GetWidth() const { return m_Width; }
+		uint32_t GetHeight() const { return m_Height; }
+		const uint32_t* GetImageData() const { return m_ImageData.data(); }
+		const AccumulationBuffer& GetAccumulation() const { return m_Accumulation; }
+		// Samples in each pixel of the accumulation buffer, less than the frame index for converged pixels
+		const uint32_t* GetSampleCounts() const { return m_SampleCounts.data(); }
+		const float* GetLuminanceSquaredData() const { return m_LuminanceSquaredData.data(); }
+		// Adaptive sampling flag per tile of the last frame, row-major
+		const std::vector<uint8_t>& GetTileConverged() const { return m_TileConverged; }
+		// Linear denoised color of the last frame, planar; only valid while IsDenoised()
+		const Denoiser& GetDenoiser() const { return m_Denoiser; }
+		bool IsDenoised() const { return m_Denoised; }
+		const AOVBuffers& GetAOVs() const { return m_AOVs; }
+
+		// Continues accumulating from buffers saved after frame frameIndex - 1 (see Checkpoint.h).
+		// The buffers must be GetWidth() * GetHeight() pixels, accumulation in Settings::Accumulation's
+		// format; the image is resolved from them.
+		void RestoreAccumulation(uint32_t frameIndex, const void* accumulation, const float* luminanceSquared,
+			const uint32_t* sampleCounts, const uint8_t* tileConverged, uint32_t tileCount);
+
+		MemoryUsage GetMemoryUsage() const;
+		// What a width x height renderer needs, with or without the reprojection history
+		static MemoryUsage GetMemoryUsage(uint32_t width, uint32_t height, AccumulationFormat format, bool history);
+
+		// Spheres or vertices were moved, resized or given another material; the BVHs are rebuilt on
+		// the next Render. Adding or removing spheres and triangles is picked up automatically.
+		void OnSceneChanged() { m_SceneChanged = true; }
+
+		const BVH::BuildStats& GetBVHBuildStats() const { return m_BVH.GetBuildStats(); }
+		const BVH::BuildStats& GetMeshBVHBuildStats() const { return m_MeshBVH.GetBuildStats(); }
+		// Merged per-thread counters of the last frame, all zero in Dist builds
+		const RenderStats& GetStats() const { return m_LastStats; }
+
+		// Adaptive sampling progress of the last frame
+		uint32_t GetConvergedTileCount() const { return m_ConvergedTiles; }
+		uint32_t GetTileCount() const { return m_TileCount; }
+		bool IsConverged() const { return m_TileCount > 0 && m_ConvergedTiles == m_TileCount; }
+		// Fraction of the tiles of a time-sliced frame traced so far, 0 between frames
+		float GetFrameProgress() const { return m_FrameTileCount > 0 ? (float)m_NextTile / (float)m_FrameTileCount : 0.0f; }
 
-		void ResetFrameIndex() { m_FrameIndex = 1; }
+		// The camera or scene is changing. Frames are rendered as coarse previews until this is
+		// cleared, then accumulation restarts at full resolution.
+		void SetInteracting(bool interacting) { m_Interacting = interacting; }
+		// Pixels per side of a preview block, 1 = full resolution
+		uint32_t GetPreviewStride() const { return m_PreviewStride; }
+
+		void ResetFrameIndex() { m_FrameIndex = 1; m_NextTile = 0; }
+		uint32_t GetFrameIndex() const { return m_FrameIndex; }
 		Settings& GetSettings() { return m_Settings; }
 	private:
 		struct HitPayload
@@ -35,30 +187,174 @@ namespace RayTracing {
 			glm::vec3 WorldPosition;
 			glm::vec3 WorldNormal;
 
+			// Sphere index, or sphere count + triangle index for triangles
 			uint32_t ObjectIndex;
+			int MaterialIndex;
+		};
+
+		// Camera ray of one pixel with its already traced first hit
+		struct PrimaryHit
+		{
+			Ray CameraRay;
+			HitPayload Payload;
+			uint32_t Seed;
 		};
 
-		void TraceColorRay(Ray& ray, glm::vec3& color, glm::vec3& contribution, const int& maxDepth, int& depth);
-		glm::vec4 PerPixel(uint32_t x, uint32_t y); // RayGen
+		// threadStats are the counters of the pool thread tracing the tile, passed down rather than
+		// looked up per ray.
+		// pathSeed identifies the camera path; each bounce derives its own RandomStream from it.
+		// firstHit skips tracing the first ray when it came from a packet.
+		// color collects the light found along the path, each term weighted by the path throughput
+		// (contribution) up to it. depth counts diffuse bounces, glassDepth refractions. bsdfPdf is the
+		// solid angle density the diffuse bounce that produced ray was sampled with, 0 for camera and
+		// specular rays.
+		void TraceColorRay(Ray& ray, glm::vec3& color, glm::vec3& contribution, int& depth, int glassDepth, uint32_t pathSeed, float bsdfPdf, RenderStats& threadStats, const HitPayload* firstHit = nullptr);
+		glm::vec4 PerPixel(uint32_t x, uint32_t y, RenderStats& threadStats, const PrimaryHit* primary = nullptr); // RayGen
+		Ray GenerateCameraRay(uint32_t x, uint32_t y, uint32_t pathSeed);
+
+		bool UsePrimaryPackets() const;
+		// Traces the camera rays of a block of at most 4x4 pixels as one packet, hits are row-major
+		void TraceCameraPacket(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY, PrimaryHit* hits, RenderStats& threadStats);
+		void RenderTile(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY, RenderStats& threadStats);
+		void RenderTileWavefront(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY, uint32_t threadIndex, RenderStats& threadStats);
+		void RenderPreviewTile(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY, uint32_t stride, RenderStats& threadStats);
+		void UpdatePreviewStride(float tilesMs);
+		// Russian roulette after a diffuse bounce, false = stop the path. Reweights contribution on survival.
+		bool ContinuePath(glm::vec3& contribution, int depth, RandomStream& random) const;
 
-		glm::vec3 CaculatePointLight(const PointLight& pointLight, const HitPayload& payload);
+		glm::vec3 CaculatePointLight(const PointLight& pointLight, const HitPayload& payload, RenderStats& threadStats);
+		// Next event estimation: one shadow ray towards a random emissive sphere, MIS weighted
+		glm::vec3 SampleEmissiveSpheres(const HitPayload& payload, RandomStream& random, RenderStats& threadStats);
+		// MIS weight of emission found by a diffuse bounce from ray.Origin
+		float EmissionWeight(const Ray& ray, const HitPayload& payload, float bsdfPdf) const;
+		// Solid angle density of SampleEmissiveSpheres picking a direction towards sphere, 0 from inside it
+		float EmissiveSpherePdf(const glm::vec3& point, const Sphere& sphere) const;
 		
 		//TEMP
-		HitPayload TraceShadowRay(const Ray& ray);
-		HitPayload TraceRay(const Ray& ray);
+		HitPayload TraceShadowRay(const Ray& ray, RenderStats& threadStats);
+		HitPayload TraceRay(const Ray& ray, RenderStats& threadStats);
 		HitPayload ClosestHit(const Ray& ray, float hitDistance, int objectIndex);
+		int IntersectScene(const Ray& ray, float& hitDistance, bool shadowRay, RenderStats& threadStats);
 		HitPayload Miss(const Ray& ray);
+
+		// Primary hit of the sample just traced, the reprojection, denoiser and AOVs use the latest one per pixel
+		void RecordPrimaryHit(uint32_t x, uint32_t y, const HitPayload& payload);
+		// Seeds an empty pixel with its history from the previous camera, if that saw the same surface
+		void ReprojectPixel(uint32_t x, uint32_t y);
+		void AllocateHistory();
+		// Seeds the stochastic rounding of the compact accumulation formats, per pixel and frame
+		uint32_t AccumulationDither(uint32_t index) const;
+		void AccumulatePixel(uint32_t x, uint32_t y, glm::vec4 color);
+		// Writes the displayed color (or sample count overlay) of a pixel from the accumulation buffer
+		void ResolvePixel(uint32_t index);
+		float PixelError(uint32_t index) const;
+		// Filters the accumulated means and writes the result to the image
+		void DenoiseImage();
+		float TileError(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY) const;
+		void RecordTraversal(const BVH::TraversalStats& stats, RenderStats& threadStats);
 	private:
-		std::shared_ptr<Walnut::Image> m_FinalImage;
 		Settings m_Settings;
-
-		std::vector<uint32_t> m_ImageHorizontalIter, m_ImageVerticalIter;
+		uint32_t m_Width = 0, m_Height = 0;
 
 		const Scene* m_ActiveScene = nullptr;
 		const Camera* m_ActiveCamera = nullptr;
-		uint32_t* m_ImageData = nullptr;
-		glm::vec4* m_AccumulationData = nullptr;
+		std::vector<uint32_t> m_ImageData;
+		AccumulationBuffer m_Accumulation;
+		// Per pixel sum of squared luminance and sample count, for the variance estimate
+		std::vector<float> m_LuminanceSquaredData;
+		std::vector<uint32_t> m_SampleCounts;
+		// Distance along the camera ray (-1 = sky) and sphere index (-1 = sky) of each pixel's primary hit
+		std::vector<float> m_DepthData;
+		std::vector<int32_t> m_ObjectData;
+
+		// Also holds the albedo and normal of each pixel's primary hit. Only allocated while
+		// Settings::Denoise is on, so recording them costs nothing otherwise.
+		Denoiser m_Denoiser;
+		bool m_Denoised = false;
+		// Set while a denoised frame is traced. The denoiser replaces the whole image once the last tile
+		// is done, until then ResolvePixel leaves it alone so a sliced frame never shows a band of noisy tiles.
+		bool m_HoldImage = false;
+		AOVBuffers m_AOVs;
+
+		// Accumulation of the previous camera, swapped with the buffers above when the camera moves.
+		// Allocated on the first move.
+		struct HistoryBuffers
+		{
+			AccumulationBuffer Accumulation;
+			std::vector<float> LuminanceSquared;
+			std::vector<uint32_t> SampleCounts;
+			std::vector<float> Depth;
+			std::vector<int32_t> Objects;
+		} m_History;
+		glm::mat4 m_HistoryViewProjection{ 1.0f };
+		glm::vec3 m_HistoryPosition{ 0.0f };
+		bool m_Reprojecting = false;
+
+		// Camera the accumulation buffers were rendered from
+		glm::mat4 m_AccumulationView{ 1.0f };
+		glm::mat4 m_AccumulationProjection{ 1.0f };
+		glm::vec3 m_AccumulationPosition{ 0.0f };
+		bool m_HasAccumulationCamera = false;
+		// Preview samples must not overwrite the primary hits of the accumulation
+		bool m_RenderingPreview = false;
+
+		std::vector<uint8_t> m_TileConverged;
+		std::atomic<uint32_t> m_ConvergedTiles = 0;
+		// Denoiser features or AOVs were allocated since the last frame started, converged tiles
+		// have to be traced once more to fill them
+		bool m_RetraceConvergedTiles = false;
+		uint32_t m_TileCount = 0;
 
 		uint32_t m_FrameIndex = 1;
+
+		// Settings::FrameBudgetMs: first tile of the current frame not traced yet, the tile count of
+		// that frame, and the wall time per tile of the last batch with all threads busy
+		uint32_t m_NextTile = 0;
+		uint32_t m_FrameTileCount = 0;
+		float m_SliceTileMs = 0.0f;
+
+		static constexpr uint32_t MaxPreviewStride = 16;
+		bool m_Interacting = false;
+		uint32_t m_PreviewStride = 2;
+
+		struct PathState
+		{
+			Ray PathRay;
+			glm::vec3 Light;
+			glm::vec3 Contribution;
+			uint32_t Seed;
+			float BSDFPdf; // see TraceColorRay
+			uint32_t Slot; // pixel within the tile
+			int Depth; // -1 once the path has terminated
+			int GlassDepth;
+		};
+
+		// Scratch for the wavefront integrator, one per pool thread so it is reused across tiles
+		struct WavefrontQueues
+		{
+			std::vector<PathState> Paths;
+			std::vector<HitPayload> Hits;
+			std::vector<glm::vec3> Colors;
+			std::vector<uint32_t> Diffuse, Glass;
+		};
+		std::vector<WavefrontQueues> m_WavefrontQueues;
+
+		// Kept alive across frames, recreated when Settings::ThreadCount changes
+		std::unique_ptr<ThreadPool> m_ThreadPool;
+		uint32_t m_ThreadPoolSize = 0;
+
+		BVH m_BVH;
+		// Scene::Triangles, a separate hierarchy so sphere leaves stay on the SIMD kernels.
+		// It traces the scene's own vertex and triangle buffers instead of a copy.
+		BVH m_MeshBVH;
+		const Scene* m_BVHScene = nullptr;
+		// Diffuse spheres that emit light, gathered every frame
+		std::vector<uint32_t> m_EmissiveSpheres;
+		size_t m_BVHSphereCount = 0;
+		size_t m_BVHTriangleCount = 0;
+		bool m_SceneChanged = true;
+
+		std::vector<RenderStats> m_ThreadStats;
+		RenderStats m_LastStats;
 	};
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 #include <glm/glm.hpp>
+#include <cstdint>
 #include <vector>
 #include <memory>
 
@@ -9,11 +10,7 @@ enum class MaterialType
 	Glass
 };
 
-struct Material {
-	virtual MaterialType GetMaterialType() = 0;
-};
-
-struct DiffuseMaterial : Material {
+struct DiffuseMaterial {
 	glm::vec3 Albedo{ 1.0f };
 	float Roughness = 1.0f;
 	float Metallic = 0.0f;
@@ -21,19 +18,27 @@ struct DiffuseMaterial : Material {
 	float EmissionPower = 0.0f;
 
 	glm::vec3 GetEmission() const { return EmissionPower * EmissionColor; }
-	virtual MaterialType GetMaterialType() override {
-		return MaterialType::Diffuse;
-	}
 };
 
-struct RefractiveMaterial : Material {
+struct RefractiveMaterial {
 	// 1.5f ~= glass, 1.3f ~= water, 1.8f ~= diamond
 	float RefractiveIndex = 1.5f;
+};
+
+// Tagged union stored by value in Scene::Materials, shading switches on Type
+struct Material {
+	MaterialType Type;
+	union {
+		DiffuseMaterial Diffuse;
+		RefractiveMaterial Glass;
+	};
 
-	virtual MaterialType GetMaterialType() override {
-		return MaterialType::Glass;
-	}
+	Material(const DiffuseMaterial& diffuse = DiffuseMaterial())
+		: Type(MaterialType::Diffuse), Diffuse(diffuse) {}
+	Material(const RefractiveMaterial& glass)
+		: Type(MaterialType::Glass), Glass(glass) {}
 };
+
 struct Sphere
 {
 	glm::vec3 Position{0.0f};
@@ -42,6 +47,15 @@ struct Sphere
 	int MaterialIndex = 0;
 };
 
+// Corners index into Scene::Vertices, so meshes store each vertex once however many
+// triangles share it. Wound counter-clockwise seen from outside.
+struct Triangle
+{
+	uint32_t Indices[3] = { 0, 0, 0 };
+
+	int MaterialIndex = 0;
+};
+
 struct DirectionalLight
 {
 	glm::vec3 Direction = glm::vec3(0.7f, -0.9f, 0.5f);
@@ -58,7 +72,10 @@ struct PointLight
 struct Scene
 {
 	std::vector<Sphere> Spheres;
-	std::vector<Material*> Materials;
+	// Triangle meshes share one vertex buffer
+	std::vector<glm::vec3> Vertices;
+	std::vector<Triangle> Triangles;
+	std::vector<Material> Materials;
 	std::vector<DirectionalLight> DirectionalLights;
 	std::vector<PointLight> PointLights;
 };
\ No newline at end of file
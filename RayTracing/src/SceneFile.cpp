@@ -0,0 +1,604 @@
+#include "SceneFile.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The sections are the runtime arrays byte for byte
+static_assert(std::is_trivially_copyable<Sphere>::value, "Sphere must be trivially copyable");
+static_assert(std::is_trivially_copyable<glm::vec3>::value, "glm::vec3 must be trivially copyable");
+static_assert(std::is_trivially_copyable<Triangle>::value, "Triangle must be trivially copyable");
+static_assert(std::is_trivially_copyable<Material>::value, "Material must be trivially copyable");
+static_assert(std::is_trivially_copyable<DirectionalLight>::value, "DirectionalLight must be trivially copyable");
+static_assert(std::is_trivially_copyable<PointLight>::value, "PointLight must be trivially copyable");
+
+namespace SceneFile {
+	namespace Utils {
+		static void SetError(std::string* error, const std::string& message)
+		{
+			if (error)
+				*error = message;
+		}
+
+		static uint64_t AlignUp(uint64_t value)
+		{
+			return (value + SectionAlignment - 1) & ~(SectionAlignment - 1);
+		}
+
+		template<typename T>
+		static Section MakeSection(uint64_t& offset, const std::vector<T>& elements)
+		{
+			Section section = {};
+			section.Offset = AlignUp(offset);
+			section.Count = elements.size();
+			section.ElementSize = sizeof(T);
+			offset = section.Offset + section.Count * sizeof(T);
+			return section;
+		}
+
+		template<typename T>
+		static bool WriteSection(FILE* file, uint64_t& position, const Section& section, const std::vector<T>& elements)
+		{
+			static const char padding[SectionAlignment] = {};
+			if (fwrite(padding, 1, (size_t)(section.Offset - position), file) != section.Offset - position)
+				return false;
+			if (!elements.empty() && fwrite(elements.data(), sizeof(T), elements.size(), file) != elements.size())
+				return false;
+			position = section.Offset + section.Count * sizeof(T);
+			return true;
+		}
+
+		// Points element at the section if it lies inside the file and matches the runtime layout
+		template<typename T>
+		static bool MapSection(const uint8_t* data, size_t size, const Section& section, const char* name, const T*& elements, std::string* error)
+		{
+			if (section.ElementSize != sizeof(T))
+			{
+				SetError(error, std::string(name) + " were written with a different struct layout");
+				return false;
+			}
+			if (section.Offset % SectionAlignment != 0 || section.Offset > size || section.Count > (size - section.Offset) / sizeof(T))
+			{
+				SetError(error, std::string(name) + " section is out of bounds");
+				return false;
+			}
+			elements = reinterpret_cast<const T*>(data + section.Offset);
+			return true;
+		}
+
+		// The renderer indexes Materials and Vertices with these unchecked
+		template<typename T>
+		static bool CheckMaterialIndices(const T* objects, size_t count, const char* name, size_t materialCount, const std::string& path, std::string* error)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				if (objects[i].MaterialIndex < 0 || (size_t)objects[i].MaterialIndex >= materialCount)
+				{
+					SetError(error, path + ": " + name + " " + std::to_string(i) + " uses material " + std::to_string(objects[i].MaterialIndex) + ", which does not exist");
+					return false;
+				}
+			}
+			return true;
+		}
+
+		static bool CheckVertexIndices(const Triangle* triangles, size_t triangleCount, size_t vertexCount, const std::string& path, std::string* error)
+		{
+			for (size_t i = 0; i < triangleCount; i++)
+			{
+				for (uint32_t index : triangles[i].Indices)
+				{
+					if (index >= vertexCount)
+					{
+						SetError(error, path + ": triangle " + std::to_string(i) + " uses vertex " + std::to_string(index) + ", which does not exist");
+						return false;
+					}
+				}
+			}
+			return true;
+		}
+
+		static bool CheckIndices(const Scene& scene, const std::string& path, std::string* error)
+		{
+			return CheckMaterialIndices(scene.Spheres.data(), scene.Spheres.size(), "sphere", scene.Materials.size(), path, error) &&
+				CheckMaterialIndices(scene.Triangles.data(), scene.Triangles.size(), "triangle", scene.Materials.size(), path, error) &&
+				CheckVertexIndices(scene.Triangles.data(), scene.Triangles.size(), scene.Vertices.size(), path, error);
+		}
+
+		static Header MakeHeader(const Scene& scene)
+		{
+			Header header = {};
+			header.Magic = Magic;
+			header.Version = Version;
+			header.EndianCheck = EndianCheck;
+			header.HeaderSize = sizeof(Header);
+
+			uint64_t offset = sizeof(Header);
+			header.Spheres = MakeSection(offset, scene.Spheres);
+			header.Vertices = MakeSection(offset, scene.Vertices);
+			header.Triangles = MakeSection(offset, scene.Triangles);
+			header.Materials = MakeSection(offset, scene.Materials);
+			header.DirectionalLights = MakeSection(offset, scene.DirectionalLights);
+			header.PointLights = MakeSection(offset, scene.PointLights);
+			return header;
+		}
+
+		template<typename T>
+		static void CopySection(std::vector<uint8_t>& buffer, const Section& section, const std::vector<T>& elements)
+		{
+			if (!elements.empty())
+				memcpy(buffer.data() + section.Offset, elements.data(), elements.size() * sizeof(T));
+		}
+
+		static bool CopyScene(const MappedScene& mapped, const std::string& name, Scene& scene, std::string* error)
+		{
+			if (!CheckMaterialIndices(mapped.GetSpheres(), mapped.GetSphereCount(), "sphere", mapped.GetMaterialCount(), name, error) ||
+				!CheckMaterialIndices(mapped.GetTriangles(), mapped.GetTriangleCount(), "triangle", mapped.GetMaterialCount(), name, error) ||
+				!CheckVertexIndices(mapped.GetTriangles(), mapped.GetTriangleCount(), mapped.GetVertexCount(), name, error))
+				return false;
+
+			scene.Spheres.assign(mapped.GetSpheres(), mapped.GetSpheres() + mapped.GetSphereCount());
+			scene.Vertices.assign(mapped.GetVertices(), mapped.GetVertices() + mapped.GetVertexCount());
+			scene.Triangles.assign(mapped.GetTriangles(), mapped.GetTriangles() + mapped.GetTriangleCount());
+			scene.Materials.assign(mapped.GetMaterials(), mapped.GetMaterials() + mapped.GetMaterialCount());
+			scene.DirectionalLights.assign(mapped.GetDirectionalLights(), mapped.GetDirectionalLights() + mapped.GetDirectionalLightCount());
+			scene.PointLights.assign(mapped.GetPointLights(), mapped.GetPointLights() + mapped.GetPointLightCount());
+			return true;
+		}
+
+		// Directory part of path including the separator, empty for a bare file name
+		static std::string GetDirectory(const std::string& path)
+		{
+			size_t separator = path.find_last_of("/\\");
+			return separator == std::string::npos ? std::string() : path.substr(0, separator + 1);
+		}
+
+		// One OBJ face corner ("7", "7/2", "7//3" or "-1"), converted to a 0-based vertex position
+		static bool ParseOBJIndex(const char*& cursor, size_t vertexCount, uint32_t& index)
+		{
+			char* end = nullptr;
+			long value = strtol(cursor, &end, 10);
+			if (end == cursor || value == 0)
+				return false;
+			cursor = end;
+			while (*cursor && *cursor != ' ' && *cursor != '\t' && *cursor != '\r' && *cursor != '\n')
+				cursor++;
+
+			// Negative indices count back from the last vertex read so far
+			long position = value > 0 ? value - 1 : (long)vertexCount + value;
+			if (position < 0 || (size_t)position >= vertexCount)
+				return false;
+			index = (uint32_t)position;
+			return true;
+		}
+	}
+
+	MappedScene::~MappedScene()
+	{
+		Close();
+	}
+
+	bool MappedScene::Open(const std::string& path, std::string* error)
+	{
+		Close();
+
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			Utils::SetError(error, "cannot open " + path);
+			return false;
+		}
+		m_File = file;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(Header))
+		{
+			Utils::SetError(error, path + " is too small to be a scene file");
+			Close();
+			return false;
+		}
+		m_Size = (size_t)fileSize.QuadPart;
+
+		m_Mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		m_Data = m_Mapping ? MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+#else
+		int file = open(path.c_str(), O_RDONLY);
+		if (file < 0)
+		{
+			Utils::SetError(error, "cannot open " + path);
+			return false;
+		}
+
+		struct stat fileStat;
+		if (fstat(file, &fileStat) != 0 || fileStat.st_size < (off_t)sizeof(Header))
+		{
+			Utils::SetError(error, path + " is too small to be a scene file");
+			close(file);
+			return false;
+		}
+		m_Size = (size_t)fileStat.st_size;
+
+		// The mapping keeps the file alive on its own
+		void* data = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, file, 0);
+		close(file);
+		m_Data = data == MAP_FAILED ? nullptr : data;
+#endif
+		if (!m_Data)
+		{
+			Utils::SetError(error, "cannot map " + path);
+			Close();
+			return false;
+		}
+		m_Mapped = true;
+
+		return MapSections(path, error);
+	}
+
+	bool MappedScene::OpenMemory(const void* data, size_t size, std::string* error)
+	{
+		Close();
+		if (size < sizeof(Header))
+		{
+			Utils::SetError(error, "scene data is too small to be a scene file");
+			return false;
+		}
+
+		m_Data = const_cast<void*>(data);
+		m_Size = size;
+		return MapSections("scene data", error);
+	}
+
+	bool MappedScene::MapSections(const std::string& name, std::string* error)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(m_Data);
+		const Header* header = reinterpret_cast<const Header*>(bytes);
+		if (header->Magic != Magic)
+		{
+			Utils::SetError(error, name + " is not a binary scene file");
+			Close();
+			return false;
+		}
+		if (header->EndianCheck != EndianCheck)
+		{
+			Utils::SetError(error, name + " was written on a machine with the other byte order");
+			Close();
+			return false;
+		}
+		if (header->Version != Version || header->HeaderSize != sizeof(Header))
+		{
+			Utils::SetError(error, name + " is scene file version " + std::to_string(header->Version) + ", expected " + std::to_string(Version));
+			Close();
+			return false;
+		}
+
+		if (!Utils::MapSection(bytes, m_Size, header->Spheres, "Spheres", m_Spheres, error) ||
+			!Utils::MapSection(bytes, m_Size, header->Vertices, "Vertices", m_Vertices, error) ||
+			!Utils::MapSection(bytes, m_Size, header->Triangles, "Triangles", m_Triangles, error) ||
+			!Utils::MapSection(bytes, m_Size, header->Materials, "Materials", m_Materials, error) ||
+			!Utils::MapSection(bytes, m_Size, header->DirectionalLights, "Directional lights", m_DirectionalLights, error) ||
+			!Utils::MapSection(bytes, m_Size, header->PointLights, "Point lights", m_PointLights, error))
+		{
+			Close();
+			return false;
+		}
+
+		m_Header = header;
+		return true;
+	}
+
+	void MappedScene::Close()
+	{
+#ifdef _WIN32
+		if (m_Data && m_Mapped)
+			UnmapViewOfFile(m_Data);
+		if (m_Mapping)
+			CloseHandle(m_Mapping);
+		if (m_File)
+			CloseHandle(m_File);
+		m_Mapping = nullptr;
+		m_File = nullptr;
+#else
+		if (m_Data && m_Mapped)
+			munmap(m_Data, m_Size);
+#endif
+		m_Data = nullptr;
+		m_Mapped = false;
+		m_Size = 0;
+		m_Header = nullptr;
+		m_Spheres = nullptr;
+		m_Vertices = nullptr;
+		m_Triangles = nullptr;
+		m_Materials = nullptr;
+		m_DirectionalLights = nullptr;
+		m_PointLights = nullptr;
+	}
+
+	bool WriteBinary(const std::string& path, const Scene& scene)
+	{
+		Header header = Utils::MakeHeader(scene);
+
+		FILE* file = fopen(path.c_str(), "wb");
+		if (!file)
+			return false;
+
+		uint64_t position = sizeof(Header);
+		bool written = fwrite(&header, sizeof(Header), 1, file) == 1 &&
+			Utils::WriteSection(file, position, header.Spheres, scene.Spheres) &&
+			Utils::WriteSection(file, position, header.Vertices, scene.Vertices) &&
+			Utils::WriteSection(file, position, header.Triangles, scene.Triangles) &&
+			Utils::WriteSection(file, position, header.Materials, scene.Materials) &&
+			Utils::WriteSection(file, position, header.DirectionalLights, scene.DirectionalLights) &&
+			Utils::WriteSection(file, position, header.PointLights, scene.PointLights);
+
+		return fclose(file) == 0 && written;
+	}
+
+	std::vector<uint8_t> SerializeBinary(const Scene& scene)
+	{
+		Header header = Utils::MakeHeader(scene);
+		const Section& last = header.PointLights;
+
+		// Zero-filled, so the alignment padding matches what WriteBinary writes
+		std::vector<uint8_t> buffer((size_t)(last.Offset + last.Count * last.ElementSize));
+		memcpy(buffer.data(), &header, sizeof(Header));
+		Utils::CopySection(buffer, header.Spheres, scene.Spheres);
+		Utils::CopySection(buffer, header.Vertices, scene.Vertices);
+		Utils::CopySection(buffer, header.Triangles, scene.Triangles);
+		Utils::CopySection(buffer, header.Materials, scene.Materials);
+		Utils::CopySection(buffer, header.DirectionalLights, scene.DirectionalLights);
+		Utils::CopySection(buffer, header.PointLights, scene.PointLights);
+		return buffer;
+	}
+
+	bool LoadBinary(const std::string& path, Scene& scene, std::string* error)
+	{
+		MappedScene mapped;
+		if (!mapped.Open(path, error))
+			return false;
+		return Utils::CopyScene(mapped, path, scene, error);
+	}
+
+	bool LoadBinary(const void* data, size_t size, Scene& scene, std::string* error)
+	{
+		MappedScene mapped;
+		if (!mapped.OpenMemory(data, size, error))
+			return false;
+		return Utils::CopyScene(mapped, "scene data", scene, error);
+	}
+
+	bool WriteText(const std::string& path, const Scene& scene)
+	{
+		FILE* file = fopen(path.c_str(), "w");
+		if (!file)
+			return false;
+
+		fprintf(file, "# RayTracing text scene, see SceneFile.h\n");
+		for (const Material& material : scene.Materials)
+		{
+			if (material.Type == MaterialType::Diffuse)
+			{
+				const DiffuseMaterial& diffuse = material.Diffuse;
+				fprintf(file, "diffuse %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n", diffuse.Albedo.r, diffuse.Albedo.g, diffuse.Albedo.b,
+					diffuse.Roughness, diffuse.Metallic, diffuse.EmissionColor.r, diffuse.EmissionColor.g, diffuse.EmissionColor.b, diffuse.EmissionPower);
+			}
+			else
+			{
+				fprintf(file, "glass %.9g\n", material.Glass.RefractiveIndex);
+			}
+		}
+		for (const Sphere& sphere : scene.Spheres)
+			fprintf(file, "sphere %.9g %.9g %.9g %.9g %d\n", sphere.Position.x, sphere.Position.y, sphere.Position.z, sphere.Radius, sphere.MaterialIndex);
+		for (const glm::vec3& vertex : scene.Vertices)
+			fprintf(file, "vertex %.9g %.9g %.9g\n", vertex.x, vertex.y, vertex.z);
+		for (const Triangle& triangle : scene.Triangles)
+			fprintf(file, "triangle %u %u %u %d\n", triangle.Indices[0], triangle.Indices[1], triangle.Indices[2], triangle.MaterialIndex);
+		for (const PointLight& light : scene.PointLights)
+		{
+			fprintf(file, "point_light %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n", light.Position.x, light.Position.y, light.Position.z,
+				light.Intesity, light.Color.r, light.Color.g, light.Color.b);
+		}
+		for (const DirectionalLight& light : scene.DirectionalLights)
+		{
+			fprintf(file, "directional_light %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n", light.Direction.x, light.Direction.y, light.Direction.z,
+				light.Intesity, light.Color.r, light.Color.g, light.Color.b);
+		}
+
+		return fclose(file) == 0;
+	}
+
+	bool LoadText(const std::string& path, Scene& scene, std::string* error)
+	{
+		FILE* file = fopen(path.c_str(), "r");
+		if (!file)
+		{
+			Utils::SetError(error, "cannot open " + path);
+			return false;
+		}
+
+		Scene loaded;
+		char line[512];
+		uint32_t lineNumber = 0;
+		bool valid = true;
+		while (valid && fgets(line, sizeof(line), file))
+		{
+			lineNumber++;
+			char keyword[32];
+			int consumed = 0;
+			if (sscanf(line, " %31s%n", keyword, &consumed) != 1 || keyword[0] == '#')
+				continue;
+
+			const char* args = line + consumed;
+			if (strcmp(keyword, "diffuse") == 0)
+			{
+				DiffuseMaterial diffuse;
+				valid = sscanf(args, "%f %f %f %f %f %f %f %f %f", &diffuse.Albedo.r, &diffuse.Albedo.g, &diffuse.Albedo.b, &diffuse.Roughness,
+					&diffuse.Metallic, &diffuse.EmissionColor.r, &diffuse.EmissionColor.g, &diffuse.EmissionColor.b, &diffuse.EmissionPower) == 9;
+				loaded.Materials.push_back(diffuse);
+			}
+			else if (strcmp(keyword, "glass") == 0)
+			{
+				RefractiveMaterial glass;
+				valid = sscanf(args, "%f", &glass.RefractiveIndex) == 1;
+				loaded.Materials.push_back(glass);
+			}
+			else if (strcmp(keyword, "sphere") == 0)
+			{
+				Sphere& sphere = loaded.Spheres.emplace_back();
+				valid = sscanf(args, "%f %f %f %f %d", &sphere.Position.x, &sphere.Position.y, &sphere.Position.z, &sphere.Radius, &sphere.MaterialIndex) == 5;
+			}
+			else if (strcmp(keyword, "vertex") == 0)
+			{
+				glm::vec3& vertex = loaded.Vertices.emplace_back();
+				valid = sscanf(args, "%f %f %f", &vertex.x, &vertex.y, &vertex.z) == 3;
+			}
+			else if (strcmp(keyword, "triangle") == 0)
+			{
+				Triangle& triangle = loaded.Triangles.emplace_back();
+				valid = sscanf(args, "%u %u %u %d", &triangle.Indices[0], &triangle.Indices[1], &triangle.Indices[2], &triangle.MaterialIndex) == 4;
+			}
+			else if (strcmp(keyword, "obj") == 0)
+			{
+				char objPath[400];
+				int materialIndex = 0;
+				valid = sscanf(args, "%399s %d", objPath, &materialIndex) == 2;
+				if (valid && !LoadOBJ(Utils::GetDirectory(path) + objPath, loaded, materialIndex, error))
+				{
+					fclose(file);
+					return false;
+				}
+			}
+			else if (strcmp(keyword, "point_light") == 0)
+			{
+				PointLight& light = loaded.PointLights.emplace_back();
+				valid = sscanf(args, "%f %f %f %f %f %f %f", &light.Position.x, &light.Position.y, &light.Position.z,
+					&light.Intesity, &light.Color.r, &light.Color.g, &light.Color.b) == 7;
+			}
+			else if (strcmp(keyword, "directional_light") == 0)
+			{
+				DirectionalLight& light = loaded.DirectionalLights.emplace_back();
+				valid = sscanf(args, "%f %f %f %f %f %f %f", &light.Direction.x, &light.Direction.y, &light.Direction.z,
+					&light.Intesity, &light.Color.r, &light.Color.g, &light.Color.b) == 7;
+			}
+			else
+			{
+				valid = false;
+			}
+		}
+		fclose(file);
+
+		if (!valid)
+		{
+			Utils::SetError(error, path + ":" + std::to_string(lineNumber) + ": cannot parse line");
+			return false;
+		}
+
+		if (!Utils::CheckIndices(loaded, path, error))
+			return false;
+
+		scene = std::move(loaded);
+		return true;
+	}
+
+	bool Load(const std::string& path, Scene& scene, std::string* error)
+	{
+		uint32_t magic = 0;
+		FILE* file = fopen(path.c_str(), "rb");
+		if (!file)
+		{
+			Utils::SetError(error, "cannot open " + path);
+			return false;
+		}
+		size_t read = fread(&magic, sizeof(magic), 1, file);
+		fclose(file);
+
+		if (read == 1 && magic == Magic)
+			return LoadBinary(path, scene, error);
+		return LoadText(path, scene, error);
+	}
+
+	bool LoadOBJ(const std::string& path, Scene& scene, int materialIndex, std::string* error)
+	{
+		FILE* file = fopen(path.c_str(), "r");
+		if (!file)
+		{
+			Utils::SetError(error, "cannot open " + path);
+			return false;
+		}
+
+		// OBJ indices are relative to the file, the scene may already hold other meshes
+		size_t firstVertex = scene.Vertices.size();
+		size_t firstTriangle = scene.Triangles.size();
+		char line[1024];
+		uint32_t lineNumber = 0;
+		bool valid = true;
+		while (valid && fgets(line, sizeof(line), file))
+		{
+			lineNumber++;
+			const char* cursor = line;
+			while (*cursor == ' ' || *cursor == '\t')
+				cursor++;
+
+			if (cursor[0] == 'v' && (cursor[1] == ' ' || cursor[1] == '\t'))
+			{
+				glm::vec3& vertex = scene.Vertices.emplace_back();
+				valid = sscanf(cursor + 2, "%f %f %f", &vertex.x, &vertex.y, &vertex.z) == 3;
+			}
+			else if (cursor[0] == 'f' && (cursor[1] == ' ' || cursor[1] == '\t'))
+			{
+				cursor += 2;
+				size_t vertexCount = scene.Vertices.size() - firstVertex;
+				uint32_t corners[3];
+				uint32_t cornerCount = 0;
+				while (valid)
+				{
+					while (*cursor == ' ' || *cursor == '\t')
+						cursor++;
+					if (*cursor == '\0' || *cursor == '\r' || *cursor == '\n' || *cursor == '#')
+						break;
+
+					uint32_t index = 0;
+					valid = Utils::ParseOBJIndex(cursor, vertexCount, index);
+					if (!valid)
+						break;
+					index += (uint32_t)firstVertex;
+					if (cornerCount < 2)
+					{
+						corners[cornerCount++] = index;
+						continue;
+					}
+
+					// Fan around the first corner
+					corners[2] = index;
+					Triangle& triangle = scene.Triangles.emplace_back();
+					triangle.Indices[0] = corners[0];
+					triangle.Indices[1] = corners[1];
+					triangle.Indices[2] = corners[2];
+					triangle.MaterialIndex = materialIndex;
+					corners[1] = corners[2];
+				}
+			}
+		}
+		fclose(file);
+
+		if (!valid)
+		{
+			scene.Vertices.resize(firstVertex);
+			scene.Triangles.resize(firstTriangle);
+			Utils::SetError(error, path + ":" + std::to_string(lineNumber) + ": cannot parse line");
+			return false;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "Scene.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary scene files (.rtscene) are a header followed by the Scene arrays exactly as
+// they sit in memory, so opening one is a mmap and a few bounds checks:
+//
+//   SceneFileHeader                 magic, version, endianness and layout check
+//   Sphere[SphereCount]             each array starts on a 64 byte boundary
+//   glm::vec3[VertexCount]
+//   Triangle[TriangleCount]
+//   Material[MaterialCount]
+//   DirectionalLight[...]
+//   PointLight[...]
+//
+// The element sizes are stored per section and must match the runtime structs, so a
+// file written by a build with a different layout is rejected instead of misread.
+// Bump Version whenever Sphere, Triangle, Material or the lights change.
+//
+// Text scenes (.txt) are one object per line, '#' starts a comment. Spheres refer to
+// materials by their position in the file, starting at 0:
+//
+//   diffuse <r> <g> <b> <roughness> <metallic> <emission r> <g> <b> <emission power>
+//   glass <refractive index>
+//   sphere <x> <y> <z> <radius> <material>
+//   vertex <x> <y> <z>
+//   triangle <vertex> <vertex> <vertex> <material>    vertices count from 0 like materials
+//   obj <file> <material>                             Wavefront OBJ mesh, relative to the scene file
+//   point_light <x> <y> <z> <intensity> <r> <g> <b>
+//   directional_light <x> <y> <z> <intensity> <r> <g> <b>
+namespace SceneFile {
+	constexpr uint32_t Magic = 0x43535452; // "RTSC"
+	constexpr uint32_t Version = 2;
+	constexpr uint32_t EndianCheck = 0x01020304;
+	constexpr uint64_t SectionAlignment = 64;
+
+	struct Section
+	{
+		uint64_t Offset;
+		uint64_t Count;
+		uint32_t ElementSize;
+		uint32_t Reserved;
+	};
+
+	struct Header
+	{
+		uint32_t Magic;
+		uint32_t Version;
+		uint32_t EndianCheck;
+		uint32_t HeaderSize;
+		Section Spheres;
+		Section Vertices;
+		Section Triangles;
+		Section Materials;
+		Section DirectionalLights;
+		Section PointLights;
+	};
+
+	// Read-only view of a mapped .rtscene file, the arrays point straight into the mapping
+	// and stay valid until Close or destruction
+	class MappedScene
+	{
+	public:
+		MappedScene() = default;
+		~MappedScene();
+		MappedScene(const MappedScene&) = delete;
+		MappedScene& operator=(const MappedScene&) = delete;
+
+		bool Open(const std::string& path, std::string* error = nullptr);
+		// Views a scene file that is already in memory, data must outlive the view
+		bool OpenMemory(const void* data, size_t size, std::string* error = nullptr);
+		void Close();
+
+		const Sphere* GetSpheres() const { return m_Spheres; }
+		size_t GetSphereCount() const { return m_Header ? (size_t)m_Header->Spheres.Count : 0; }
+		const glm::vec3* GetVertices() const { return m_Vertices; }
+		size_t GetVertexCount() const { return m_Header ? (size_t)m_Header->Vertices.Count : 0; }
+		const Triangle* GetTriangles() const { return m_Triangles; }
+		size_t GetTriangleCount() const { return m_Header ? (size_t)m_Header->Triangles.Count : 0; }
+		const Material* GetMaterials() const { return m_Materials; }
+		size_t GetMaterialCount() const { return m_Header ? (size_t)m_Header->Materials.Count : 0; }
+		const DirectionalLight* GetDirectionalLights() const { return m_DirectionalLights; }
+		size_t GetDirectionalLightCount() const { return m_Header ? (size_t)m_Header->DirectionalLights.Count : 0; }
+		const PointLight* GetPointLights() const { return m_PointLights; }
+		size_t GetPointLightCount() const { return m_Header ? (size_t)m_Header->PointLights.Count : 0; }
+
+		size_t GetFileSize() const { return m_Size; }
+	private:
+		// Checks the header and points the arrays into [m_Data, m_Data + m_Size)
+		bool MapSections(const std::string& name, std::string* error);
+	private:
+		void* m_Data = nullptr;
+		size_t m_Size = 0;
+		// false for OpenMemory views, which are not unmapped
+		bool m_Mapped = false;
+#ifdef _WIN32
+		void* m_File = nullptr;
+		void* m_Mapping = nullptr;
+#endif
+
+		const Header* m_Header = nullptr;
+		const Sphere* m_Spheres = nullptr;
+		const glm::vec3* m_Vertices = nullptr;
+		const Triangle* m_Triangles = nullptr;
+		const Material* m_Materials = nullptr;
+		const DirectionalLight* m_DirectionalLights = nullptr;
+		const PointLight* m_PointLights = nullptr;
+	};
+
+	bool WriteBinary(const std::string& path, const Scene& scene);
+	// The bytes WriteBinary would write, for sending a scene to another process
+	std::vector<uint8_t> SerializeBinary(const Scene& scene);
+	// Maps the file and copies each array into scene with a single memcpy. Scene owns its
+	// arrays so the viewport can edit them; read-only users can keep a MappedScene instead.
+	bool LoadBinary(const std::string& path, Scene& scene, std::string* error = nullptr);
+	bool LoadBinary(const void* data, size_t size, Scene& scene, std::string* error = nullptr);
+
+	bool WriteText(const std::string& path, const Scene& scene);
+	bool LoadText(const std::string& path, Scene& scene, std::string* error = nullptr);
+
+	// Binary or text, told apart by the magic number
+	bool Load(const std::string& path, Scene& scene, std::string* error = nullptr);
+
+	// Appends the faces of a Wavefront OBJ file to scene's vertex and triangle buffers, polygons
+	// are split into fans. Only positions are read, normals and texture coordinates are skipped.
+	bool LoadOBJ(const std::string& path, Scene& scene, int materialIndex, std::string* error = nullptr);
+}
@@ -0,0 +1,255 @@
+#include "Scenes.h"
+
+#include "Random.h"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/constants.hpp>
+
+namespace Scenes {
+	Scene CornellBox()
+	{
+		Scene scene;
+
+		RefractiveMaterial glass;
+		scene.Materials.push_back(glass);
+
+		DiffuseMaterial white;
+		white.Albedo = { 1.0f, 1.0f, 1.0f };
+		white.Roughness = 1.0f;
+		scene.Materials.push_back(white);
+
+		DiffuseMaterial red;
+		red.Albedo = { 1.0f, 0.2f, 0.2f };
+		red.Roughness = 1.0f;
+		scene.Materials.push_back(red);
+
+		DiffuseMaterial green;
+		green.Albedo = { 0.2f, 1.0f, 0.2f };
+		green.Roughness = 1.0f;
+		scene.Materials.push_back(green);
+
+		DiffuseMaterial blue;
+		blue.Albedo = { 0.2f, 0.2f, 1.0f };
+		blue.Roughness = 1.0f;
+		scene.Materials.push_back(blue);
+
+
+		DiffuseMaterial pink;
+		pink.Albedo = { 1.0f, 0.3, 1.0f };
+		pink.Roughness = 1.0f;
+		pink.EmissionColor = { 1.0f, 0.3, 1.0f };
+		pink.EmissionPower = 5.0f;
+		scene.Materials.push_back(pink);
+
+		{
+			Sphere sphere;
+			sphere.Position = { 0.0f, -0.2f, 0.0f };
+			sphere.Radius = 1.0f;
+			sphere.MaterialIndex = 5;
+			scene.Spheres.push_back(sphere);
+		}
+
+		{
+			Sphere sphere;
+			sphere.Position = { 2.0f, 2.0f, 0.0f };
+			sphere.Radius = 1.0f;
+			sphere.MaterialIndex = 0;
+			scene.Spheres.push_back(sphere);
+		}
+
+		{
+			Sphere sphere;
+			sphere.Position = { 0.0f, -1001.0f, 0.0f };
+			sphere.Radius = 1000.0f;
+			sphere.MaterialIndex = 1;
+			scene.Spheres.push_back(sphere);
+		}
+		{
+			Sphere sphere;
+			sphere.Position = { 0.0f, 1010.0f, 0.0f };
+			sphere.Radius = 1000.0f;
+			sphere.MaterialIndex = 1;
+			scene.Spheres.push_back(sphere);
+		}
+		{
+			Sphere sphere;
+			sphere.Position = { -1010.0f, 0.0f, -5.0f };
+			sphere.Radius = 1000.0f;
+			sphere.MaterialIndex = 2;
+			scene.Spheres.push_back(sphere);
+		}
+		{
+			Sphere sphere;
+			sphere.Position = { 1010.0f, 0.0f, -5.0f };
+			sphere.Radius = 1000.0f;
+			sphere.MaterialIndex = 2;
+			scene.Spheres.push_back(sphere);
+		}
+		{
+			Sphere sphere;
+			sphere.Position = { 0.0f, 0.0f, -1010.0f };
+			sphere.Radius = 1000.0f;
+			sphere.MaterialIndex = 3;
+			scene.Spheres.push_back(sphere); 
+		}
+		{
+			Sphere sphere;
+			sphere.Position = { 0.0f, 0.0f, 1010.0f };
+			sphere.Radius = 1000.0f;
+			sphere.MaterialIndex = 4;
+			scene.Spheres.push_back(sphere);
+		}
+
+		return scene;
+	}
+
+	// The Cornell box without its two inner spheres. Open scenes only see the sky, so the
+	// other scenes are built inside it and reuse its materials:
+	// 0 glass, 1 white, 2 red, 3 green, 4 blue, 5 pink emissive
+	static Scene CornellWalls()
+	{
+		Scene scene = CornellBox();
+		scene.Spheres.erase(scene.Spheres.begin(), scene.Spheres.begin() + 2);
+		return scene;
+	}
+
+	Scene AllGlass()
+	{
+		Scene scene = CornellWalls();
+
+		// Water and diamond next to the box's glass
+		uint32_t firstMaterial = (uint32_t)scene.Materials.size();
+		const float refractiveIndices[] = { 1.3f, 1.8f };
+		for (float refractiveIndex : refractiveIndices)
+		{
+			RefractiveMaterial glass;
+			glass.RefractiveIndex = refractiveIndex;
+			scene.Materials.push_back(glass);
+		}
+		const int glassMaterials[] = { 0, (int)firstMaterial, (int)firstMaterial + 1 };
+
+		{
+			Sphere sphere;
+			sphere.Position = { 0.0f, 2.2f, -1.5f };
+			sphere.Radius = 1.0f;
+			sphere.MaterialIndex = 5;
+			scene.Spheres.push_back(sphere);
+		}
+
+		for (int z = 0; z < 3; z++)
+		{
+			for (int x = -2; x <= 2; x++)
+			{
+				Sphere sphere;
+				sphere.Position = { x * 1.1f, -0.5f, -z * 1.5f };
+				sphere.Radius = 0.5f;
+				sphere.MaterialIndex = glassMaterials[(x + 2 + z) % 3];
+				scene.Spheres.push_back(sphere);
+			}
+		}
+
+		return scene;
+	}
+
+	Scene ManyPointLights()
+	{
+		Scene scene = CornellBox();
+
+		for (int z = 0; z < 4; z++)
+		{
+			for (int x = 0; x < 8; x++)
+			{
+				PointLight light;
+				light.Position = { -3.5f + x, 5.0f, -6.0f + 2.0f * z };
+				light.Intesity = 0.5f;
+				light.Color = { 0.5f + 0.5f * (x & 1), 0.5f + 0.5f * (z & 1), 0.5f + 0.05f * (x + z) };
+				scene.PointLights.push_back(light);
+			}
+		}
+
+		return scene;
+	}
+
+	Scene RandomSpheres(uint32_t count, uint32_t seed)
+	{
+		Scene scene = CornellWalls();
+
+		// Keep the total volume roughly constant so 10k and 100k spheres fill the same box
+		float radius = 0.6f / std::cbrt((float)std::max(count, 1u));
+		RayTracing::RandomStream random(seed, 0);
+		scene.Spheres.reserve(scene.Spheres.size() + count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			Sphere sphere;
+			sphere.Position = random.Vec3(0.0f, 1.0f) * glm::vec3(10.0f, 5.0f, 8.0f) - glm::vec3(5.0f, 1.0f, 9.0f);
+			sphere.Radius = radius * (0.5f + random.Float());
+
+			// Mostly diffuse, one in ten glass, one in a hundred emissive
+			uint32_t kind = random.UInt() % 100;
+			if (kind == 0)
+				sphere.MaterialIndex = 5;
+			else if (kind < 10)
+				sphere.MaterialIndex = 0;
+			else
+				sphere.MaterialIndex = 1 + kind % 4;
+			scene.Spheres.push_back(sphere);
+		}
+
+		return scene;
+	}
+
+	Scene MeshTorus(uint32_t segments)
+	{
+		Scene scene = CornellWalls();
+
+		Sphere light;
+		light.Position = { 0.0f, 3.0f, -1.0f };
+		light.Radius = 0.75f;
+		light.MaterialIndex = 5;
+		scene.Spheres.push_back(light);
+
+		// Tilted towards the camera, one ring of vertices per major segment
+		const float majorRadius = 1.2f, minorRadius = 0.45f;
+		const glm::vec3 center(0.0f, 0.0f, -1.5f);
+		const float tilt = 0.6f;
+		uint32_t majorSegments = std::max(segments, 3u);
+		uint32_t minorSegments = std::max(segments / 2, 3u);
+
+		scene.Vertices.reserve(majorSegments * minorSegments);
+		for (uint32_t i = 0; i < majorSegments; i++)
+		{
+			float u = glm::two_pi<float>() * i / majorSegments;
+			for (uint32_t j = 0; j < minorSegments; j++)
+			{
+				float v = glm::two_pi<float>() * j / minorSegments;
+				float ring = majorRadius + minorRadius * std::cos(v);
+				glm::vec3 position(ring * std::cos(u), minorRadius * std::sin(v), ring * std::sin(u));
+				float y = position.y * std::cos(tilt) - position.z * std::sin(tilt);
+				float z = position.y * std::sin(tilt) + position.z * std::cos(tilt);
+				scene.Vertices.push_back(center + glm::vec3(position.x, y, z));
+			}
+		}
+
+		scene.Triangles.reserve(2 * majorSegments * minorSegments);
+		for (uint32_t i = 0; i < majorSegments; i++)
+		{
+			uint32_t nextI = (i + 1) % majorSegments;
+			for (uint32_t j = 0; j < minorSegments; j++)
+			{
+				uint32_t nextJ = (j + 1) % minorSegments;
+				uint32_t a = i * minorSegments + j, b = nextI * minorSegments + j;
+				uint32_t c = nextI * minorSegments + nextJ, d = i * minorSegments + nextJ;
+
+				Triangle triangle;
+				triangle.MaterialIndex = 1;
+				triangle.Indices[0] = a; triangle.Indices[1] = d; triangle.Indices[2] = c;
+				scene.Triangles.push_back(triangle);
+				triangle.Indices[0] = a; triangle.Indices[1] = c; triangle.Indices[2] = b;
+				scene.Triangles.push_back(triangle);
+			}
+		}
+
+		return scene;
+	}
+}
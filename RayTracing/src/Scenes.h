@@ -0,0 +1,19 @@
+#pragma once
+
+#include "Scene.h"
+
+#include <cstdint>
+
+// Canonical scenes shared by the viewport, the headless renderer and the benchmark.
+// All of them are framed for the default camera at (0, 0, 3) looking down -Z.
+namespace Scenes {
+	Scene CornellBox();
+	// Rows of glass spheres under a light in the Cornell box
+	Scene AllGlass();
+	// The Cornell box lit by a grid of 32 colored point lights
+	Scene ManyPointLights();
+	// count small spheres scattered through the Cornell box, same seed gives the same scene
+	Scene RandomSpheres(uint32_t count, uint32_t seed = 0);
+	// A torus of segments^2 triangles under the emissive sphere of the Cornell box
+	Scene MeshTorus(uint32_t segments = 256);
+}
@@ -0,0 +1,236 @@
+#include "SphereKernels.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64)
+	#define RT_X64 1
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#define RT_TARGET_AVX2
+	#else
+		#define RT_TARGET_AVX2 __attribute__((target("avx2")))
+	#endif
+#endif
+
+namespace RayTracing {
+	namespace Utils {
+		// Never hit: c = |o - center|^2 - r^2 stays huge, so the discriminant is negative
+		static constexpr float NoHitRadiusSquared = -1e30f;
+
+		static bool CastsShadow(const Sphere& sphere, const std::vector<Material>& materials)
+		{
+			if (sphere.MaterialIndex < 0 || sphere.MaterialIndex >= (int)materials.size())
+				return true;
+			return materials[sphere.MaterialIndex].Type != MaterialType::Glass;
+		}
+	}
+
+	void SphereSoA::Build(const std::vector<Sphere>& spheres, const std::vector<Material>& materials, const std::vector<uint32_t>& order)
+	{
+		Count = (uint32_t)order.size();
+		size_t size = Count + Padding;
+
+		CenterX.assign(size, 0.0f);
+		CenterY.assign(size, 0.0f);
+		CenterZ.assign(size, 0.0f);
+		RadiusSquared.assign(size, Utils::NoHitRadiusSquared);
+		ShadowRadiusSquared.assign(size, Utils::NoHitRadiusSquared);
+		SphereIndex.assign(order.begin(), order.end());
+
+		for (uint32_t i = 0; i < Count; i++)
+		{
+			const Sphere& sphere = spheres[order[i]];
+			CenterX[i] = sphere.Position.x;
+			CenterY[i] = sphere.Position.y;
+			CenterZ[i] = sphere.Position.z;
+			RadiusSquared[i] = sphere.Radius * sphere.Radius;
+			if (Utils::CastsShadow(sphere, materials))
+				ShadowRadiusSquared[i] = RadiusSquared[i];
+		}
+	}
+
+	void SphereSoA::Clear()
+	{
+		CenterX.clear();
+		CenterY.clear();
+		CenterZ.clear();
+		RadiusSquared.clear();
+		ShadowRadiusSquared.clear();
+		SphereIndex.clear();
+		Count = 0;
+	}
+
+	namespace SphereKernels {
+		// All kernels solve t^2 a + 2t b + c = 0 with b = dot(o - center, d), so a = dot(d, d)
+		// and its reciprocal are computed once per call instead of once per sphere.
+
+		static int IntersectScalar(const SphereSoA& spheres, const float* radiusSquared, uint32_t first, uint32_t count,
+			const glm::vec3& origin, const glm::vec3& direction, float& hitDistance)
+		{
+			float a = glm::dot(direction, direction);
+			float invA = 1.0f / a;
+
+			int closest = -1;
+			for (uint32_t i = first; i < first + count; i++)
+			{
+				glm::vec3 oc = origin - glm::vec3(spheres.CenterX[i], spheres.CenterY[i], spheres.CenterZ[i]);
+				float b = glm::dot(oc, direction);
+				float c = glm::dot(oc, oc) - radiusSquared[i];
+
+				float discriminant = b * b - a * c;
+				if (discriminant < 0.0f)
+					continue;
+
+				float t = (-b - std::sqrt(discriminant)) * invA;
+				if (t > 0.0f && t < hitDistance)
+				{
+					hitDistance = t;
+					closest = (int)i;
+				}
+			}
+			return closest;
+		}
+
+#ifdef RT_X64
+		static int IntersectSSE(const SphereSoA& spheres, const float* radiusSquared, uint32_t first, uint32_t count,
+			const glm::vec3& origin, const glm::vec3& direction, float& hitDistance)
+		{
+			float a = glm::dot(direction, direction);
+
+			const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+			const __m128 dx = _mm_set1_ps(direction.x), dy = _mm_set1_ps(direction.y), dz = _mm_set1_ps(direction.z);
+			const __m128 va = _mm_set1_ps(a);
+			const __m128 invA = _mm_set1_ps(1.0f / a);
+			const __m128 zero = _mm_setzero_ps();
+			const __m128i laneOffsets = _mm_setr_epi32(0, 1, 2, 3);
+			const __m128i countVec = _mm_set1_epi32((int)count);
+
+			__m128 best = _mm_set1_ps(hitDistance);
+			__m128i bestIndex = _mm_set1_epi32(-1);
+
+			for (uint32_t i = 0; i < count; i += 4)
+			{
+				uint32_t index = first + i;
+				__m128 ocx = _mm_sub_ps(ox, _mm_loadu_ps(&spheres.CenterX[index]));
+				__m128 ocy = _mm_sub_ps(oy, _mm_loadu_ps(&spheres.CenterY[index]));
+				__m128 ocz = _mm_sub_ps(oz, _mm_loadu_ps(&spheres.CenterZ[index]));
+
+				__m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+				__m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)),
+					_mm_loadu_ps(&radiusSquared[index]));
+				__m128 discriminant = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(va, c));
+
+				// A negative discriminant gives NaN here, which fails every comparison below
+				__m128 t = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(zero, b), _mm_sqrt_ps(discriminant)), invA);
+
+				__m128i lanes = _mm_add_epi32(_mm_set1_epi32((int)i), laneOffsets);
+				__m128 inRange = _mm_castsi128_ps(_mm_cmplt_epi32(lanes, countVec));
+				__m128 hit = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmplt_ps(t, best)), inRange);
+
+				best = _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, best));
+				__m128i hitIndex = _mm_add_epi32(_mm_set1_epi32((int)index), laneOffsets);
+				__m128i hitMask = _mm_castps_si128(hit);
+				bestIndex = _mm_or_si128(_mm_and_si128(hitMask, hitIndex), _mm_andnot_si128(hitMask, bestIndex));
+			}
+
+			alignas(16) float distances[4];
+			alignas(16) int indices[4];
+			_mm_store_ps(distances, best);
+			_mm_store_si128((__m128i*)indices, bestIndex);
+
+			int closest = -1;
+			for (int lane = 0; lane < 4; lane++)
+			{
+				if (indices[lane] >= 0 && distances[lane] < hitDistance)
+				{
+					hitDistance = distances[lane];
+					closest = indices[lane];
+				}
+			}
+			return closest;
+		}
+
+		RT_TARGET_AVX2
+		static int IntersectAVX2(const SphereSoA& spheres, const float* radiusSquared, uint32_t first, uint32_t count,
+			const glm::vec3& origin, const glm::vec3& direction, float& hitDistance)
+		{
+			float a = glm::dot(direction, direction);
+
+			const __m256 ox = _mm256_set1_ps(origin.x), oy = _mm256_set1_ps(origin.y), oz = _mm256_set1_ps(origin.z);
+			const __m256 dx = _mm256_set1_ps(direction.x), dy = _mm256_set1_ps(direction.y), dz = _mm256_set1_ps(direction.z);
+			const __m256 va = _mm256_set1_ps(a);
+			const __m256 invA = _mm256_set1_ps(1.0f / a);
+			const __m256 zero = _mm256_setzero_ps();
+			const __m256i laneOffsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+			const __m256i countVec = _mm256_set1_epi32((int)count);
+
+			__m256 best = _mm256_set1_ps(hitDistance);
+			__m256i bestIndex = _mm256_set1_epi32(-1);
+
+			for (uint32_t i = 0; i < count; i += 8)
+			{
+				uint32_t index = first + i;
+				__m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(&spheres.CenterX[index]));
+				__m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(&spheres.CenterY[index]));
+				__m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(&spheres.CenterZ[index]));
+
+				__m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)), _mm256_mul_ps(ocz, dz));
+				__m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz)),
+					_mm256_loadu_ps(&radiusSquared[index]));
+				__m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(va, c));
+
+				// A negative discriminant gives NaN here, which fails every comparison below
+				__m256 t = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(zero, b), _mm256_sqrt_ps(discriminant)), invA);
+
+				__m256i lanes = _mm256_add_epi32(_mm256_set1_epi32((int)i), laneOffsets);
+				__m256 inRange = _mm256_castsi256_ps(_mm256_cmpgt_epi32(countVec, lanes));
+				__m256 hit = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GT_OQ), _mm256_cmp_ps(t, best, _CMP_LT_OQ)), inRange);
+
+				best = _mm256_blendv_ps(best, t, hit);
+				__m256i hitIndex = _mm256_add_epi32(_mm256_set1_epi32((int)index), laneOffsets);
+				bestIndex = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(bestIndex), _mm256_castsi256_ps(hitIndex), hit));
+			}
+
+			alignas(32) float distances[8];
+			alignas(32) int indices[8];
+			_mm256_store_ps(distances, best);
+			_mm256_store_si256((__m256i*)indices, bestIndex);
+
+			int closest = -1;
+			for (int lane = 0; lane < 8; lane++)
+			{
+				if (indices[lane] >= 0 && distances[lane] < hitDistance)
+				{
+					hitDistance = distances[lane];
+					closest = indices[lane];
+				}
+			}
+			return closest;
+		}
+#endif
+
+		const char* GetName(SIMDLevel level)
+		{
+			switch (level)
+			{
+			case SIMDLevel::SSE:  return "SSE";
+			case SIMDLevel::AVX2: return "AVX2";
+			default:              return "Scalar";
+			}
+		}
+
+		SphereKernel Get(SIMDLevel level)
+		{
+			level = std::min(level, CPUFeatures::DetectSIMDLevel());
+#ifdef RT_X64
+			if (level == SIMDLevel::AVX2)
+				return IntersectAVX2;
+			if (level == SIMDLevel::SSE)
+				return IntersectSSE;
+#endif
+			return IntersectScalar;
+		}
+	}
+}
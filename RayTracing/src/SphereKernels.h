@@ -0,0 +1,42 @@
+#pragma once
+
+#include "CPUFeatures.h"
+#include "Scene.h"
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+namespace RayTracing {
+	// Structure-of-arrays copy of Scene::Spheres, in whatever order the caller wants
+	// (BVH leaf order, so leaves are contiguous). Arrays are padded past Count so a
+	// kernel can always load a full 8-wide vector.
+	struct SphereSoA
+	{
+		static constexpr uint32_t Padding = 8;
+
+		std::vector<float> CenterX, CenterY, CenterZ;
+		std::vector<float> RadiusSquared;
+		// Same as RadiusSquared, but glass spheres never hit so shadow rays pass through
+		std::vector<float> ShadowRadiusSquared;
+		// Position in Scene::Spheres
+		std::vector<uint32_t> SphereIndex;
+		uint32_t Count = 0;
+
+		void Build(const std::vector<Sphere>& spheres, const std::vector<Material>& materials, const std::vector<uint32_t>& order);
+		void Clear();
+	};
+
+	// Tests spheres [first, first + count) of the SoA. Returns the SoA position of the
+	// closest hit with 0 < t < hitDistance and updates hitDistance, or -1.
+	// radiusSquared is either RadiusSquared or ShadowRadiusSquared.
+	using SphereKernel = int(*)(const SphereSoA& spheres, const float* radiusSquared, uint32_t first, uint32_t count,
+		const glm::vec3& origin, const glm::vec3& direction, float& hitDistance);
+
+	namespace SphereKernels {
+		const char* GetName(SIMDLevel level);
+
+		// Falls back to the best supported level if the requested one is not available
+		SphereKernel Get(SIMDLevel level);
+	}
+}
@@ -0,0 +1,135 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace RayTracing {
+	ThreadPool::ThreadPool(uint32_t threadCount)
+	{
+		if (threadCount == 0)
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+		m_Queues.reserve(threadCount);
+		for (uint32_t i = 0; i < threadCount; i++)
+			m_Queues.push_back(std::make_unique<WorkQueue>());
+
+		// Slot 0 belongs to the thread calling ParallelFor
+		m_Workers.reserve(threadCount - 1);
+		for (uint32_t i = 1; i < threadCount; i++)
+			m_Workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Shutdown = true;
+		}
+		m_WakeCondition.notify_all();
+
+		for (std::thread& worker : m_Workers)
+			worker.join();
+	}
+
+	void ThreadPool::ParallelFor(uint32_t count, const std::function<void(uint32_t index, uint32_t threadIndex)>& task)
+	{
+		if (count == 0)
+			return;
+
+		if (m_Workers.empty())
+		{
+			for (uint32_t i = 0; i < count; i++)
+				task(i, 0);
+			return;
+		}
+
+		uint32_t threadCount = GetThreadCount();
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Task = &task;
+			m_Remaining = count;
+
+			// Neighbouring tasks (tiles) start on the same thread, stealing evens out the rest
+			for (uint32_t t = 0; t < threadCount; t++)
+			{
+				uint32_t first = (uint32_t)((uint64_t)count * t / threadCount);
+				uint32_t last = (uint32_t)((uint64_t)count * (t + 1) / threadCount);
+
+				WorkQueue& queue = *m_Queues[t];
+				std::lock_guard<std::mutex> queueLock(queue.Mutex);
+				for (uint32_t i = first; i < last; i++)
+					queue.Tasks.push_back(i);
+			}
+
+			m_Generation++;
+		}
+		m_WakeCondition.notify_all();
+
+		while (RunOne(0))
+			;
+
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_DoneCondition.wait(lock, [this]() { return m_Remaining == 0; });
+		m_Task = nullptr;
+	}
+
+	void ThreadPool::WorkerLoop(uint32_t threadIndex)
+	{
+		uint64_t lastGeneration = 0;
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_Mutex);
+				m_WakeCondition.wait(lock, [&]() { return m_Shutdown || m_Generation != lastGeneration; });
+				if (m_Shutdown)
+					return;
+				lastGeneration = m_Generation;
+			}
+
+			while (RunOne(threadIndex))
+				;
+		}
+	}
+
+	bool ThreadPool::RunOne(uint32_t threadIndex)
+	{
+		uint32_t threadCount = GetThreadCount();
+		bool found = false;
+		uint32_t index = 0;
+
+		{
+			WorkQueue& own = *m_Queues[threadIndex];
+			std::lock_guard<std::mutex> lock(own.Mutex);
+			if (!own.Tasks.empty())
+			{
+				index = own.Tasks.back();
+				own.Tasks.pop_back();
+				found = true;
+			}
+		}
+
+		for (uint32_t offset = 1; !found && offset < threadCount; offset++)
+		{
+			WorkQueue& victim = *m_Queues[(threadIndex + offset) % threadCount];
+			std::lock_guard<std::mutex> lock(victim.Mutex);
+			if (!victim.Tasks.empty())
+			{
+				index = victim.Tasks.front();
+				victim.Tasks.pop_front();
+				found = true;
+			}
+		}
+
+		if (!found)
+			return false;
+
+		(*m_Task)(index, threadIndex);
+
+		if (--m_Remaining == 0)
+		{
+			// Lock so the notify can't slip in between the caller's check and its wait
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_DoneCondition.notify_all();
+		}
+		return true;
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace RayTracing {
+	// Persistent pool of worker threads with one work-stealing deque each.
+	// ParallelFor deals contiguous ranges of task indices to the deques; a thread
+	// pops from the back of its own deque and steals from the front of the others.
+	class ThreadPool {
+	public:
+		// threadCount includes the thread calling ParallelFor, 0 = hardware concurrency
+		explicit ThreadPool(uint32_t threadCount = 0);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		uint32_t GetThreadCount() const { return (uint32_t)m_Queues.size(); }
+
+		// Runs task(index, threadIndex) for every index in [0, count) and returns once all
+		// of them finished. threadIndex is in [0, GetThreadCount()), 0 is the caller.
+		void ParallelFor(uint32_t count, const std::function<void(uint32_t index, uint32_t threadIndex)>& task);
+	private:
+		struct WorkQueue
+		{
+			std::mutex Mutex;
+			std::deque<uint32_t> Tasks;
+		};
+
+		void WorkerLoop(uint32_t threadIndex);
+		// Runs one task from our own deque or a stolen one, false if every deque is empty
+		bool RunOne(uint32_t threadIndex);
+	private:
+		std::vector<std::thread> m_Workers;
+		std::vector<std::unique_ptr<WorkQueue>> m_Queues;
+
+		std::mutex m_Mutex;
+		std::condition_variable m_WakeCondition;
+		std::condition_variable m_DoneCondition;
+		uint64_t m_Generation = 0;
+		bool m_Shutdown = false;
+
+		const std::function<void(uint32_t, uint32_t)>* m_Task = nullptr;
+		std::atomic<uint32_t> m_Remaining = 0;
+	};
+}
@@ -4,8 +4,10 @@
 #include "Walnut/Image.h"
 #include "Walnut/Timer.h"
 
-#include "Renderer.h"
+#include "RenderThread.h"
 #include "Camera.h"
+#include "SceneFile.h"
+#include "Scenes.h"
 
 #include <glm/gtc/type_ptr.hpp>
 
@@ -15,145 +17,205 @@ public:
 	ExampleLayer()
 		: m_Camera(45.0f, 0.01f, 100.0f) 
 	{
-		
-		RefractiveMaterial* glass = new RefractiveMaterial();
-		m_Scene.Materials.push_back(glass);
-
-		DiffuseMaterial* white = new DiffuseMaterial();
-		white->Albedo = { 1.0f, 1.0f, 1.0f };
-		white->Roughness = 1.0f;
-		m_Scene.Materials.push_back(white);
-
-		DiffuseMaterial* red = new DiffuseMaterial();
-		red->Albedo = { 1.0f, 0.2f, 0.2f };
-		red->Roughness = 1.0f;
-		m_Scene.Materials.push_back(red);
-
-		DiffuseMaterial* green = new DiffuseMaterial();
-		green->Albedo = { 0.2f, 1.0f, 0.2f };
-		green->Roughness = 1.0f;
-		m_Scene.Materials.push_back(green);
-
-		DiffuseMaterial* blue = new DiffuseMaterial();
-		blue->Albedo = { 0.2f, 0.2f, 1.0f };
-		blue->Roughness = 1.0f;
-		m_Scene.Materials.push_back(blue);
+		m_Scene = Scenes::CornellBox();
+		m_RenderThread.SubmitScene(m_Scene, true);
 
-
-		DiffuseMaterial* pink = new DiffuseMaterial();
-		pink->Albedo = { 1.0f, 0.3, 1.0f };
-		pink->Roughness = 1.0f;
-		pink->EmissionColor = { 1.0f, 0.3, 1.0f };
-		pink->EmissionPower = 5.0f;
-		m_Scene.Materials.push_back(pink);
-
-		{
-			Sphere sphere;
-			sphere.Position = { 0.0f, -0.2f, 0.0f };
-			sphere.Radius = 1.0f;
-			sphere.MaterialIndex = 5;
-			m_Scene.Spheres.push_back(sphere);
+		//PointLight& pointLight = m_Scene.PointLights.emplace_back();
+		//pointLight.Intesity = 20.0f;
+		//pointLight.Position = { 0.0f, 4.0f, 0.0f };
+	}
+	virtual void OnUpdate(float ts) override {
+		// Camera movement is picked up by the renderer itself, which reprojects the accumulation
+		if (m_Camera.OnUpdate(ts) || m_SceneEdited) {
+			m_IdleTime = 0.0f;
 		}
-
+		else {
+			m_IdleTime += ts;
+		}
+		m_SceneEdited = false;
+	}
+	virtual void OnUIRender() override
+	{
+		ImGui::Begin("Settings");
+		if (ImGui::Checkbox("Accumulate", &m_Settings.Accumulate))
+			m_ResetFrame = true;
+		if (ImGui::Checkbox("Preview Renderer", &m_Settings.PreviewRenderer))
+			m_ResetFrame = true;
+		int integrator = (int)m_Settings.Integrator;
+		const char* integrators[] = { "Recursive", "Wavefront" };
+		if (ImGui::Combo("Integrator", &integrator, integrators, IM_ARRAYSIZE(integrators)))
 		{
-			Sphere sphere;
-			sphere.Position = { 2.0f, 2.0f, 0.0f };
-			sphere.Radius = 1.0f;
-			sphere.MaterialIndex = 0;
-			m_Scene.Spheres.push_back(sphere);
+			m_Settings.Integrator = (RayTracing::IntegratorMode)integrator;
+			m_ResetFrame = true;
 		}
 
-		{
-			Sphere sphere;
-			sphere.Position = { 0.0f, -1001.0f, 0.0f };
-			sphere.Radius = 1000.0f;
-			sphere.MaterialIndex = 1;
-			m_Scene.Spheres.push_back(sphere);
+		if (ImGui::Button("Reset")) {
+			m_ResetFrame = true;
 		}
+		ImGui::Text("Last Render Time: %.3fms (frame %u, presented at %.1f fps)", m_FrameInfo.RenderMs, m_FrameInfo.FrameIndex, ImGui::GetIO().Framerate);
+		ImGui::Checkbox("Interactive Preview", &m_Settings.InteractivePreview);
+		ImGui::SameLine();
+		ImGui::Text("(1/%u res)", m_FrameInfo.PreviewStride);
+		ImGui::DragFloat("Target Frame Time", &m_Settings.TargetFrameMs, 0.5f, 1.0f, 100.0f, "%.1fms");
+		// 0 = every Render call traces the whole frame
+		ImGui::DragFloat("Frame Budget", &m_Settings.FrameBudgetMs, 0.5f, 0.0f, 1000.0f, m_Settings.FrameBudgetMs > 0.0f ? "%.1fms" : "off");
+		if (m_FrameInfo.FrameProgress > 0.0f)
 		{
-			Sphere sphere;
-			sphere.Position = { 0.0f, 1010.0f, 0.0f };
-			sphere.Radius = 1000.0f;
-			sphere.MaterialIndex = 1;
-			m_Scene.Spheres.push_back(sphere);
+			ImGui::SameLine();
+			ImGui::Text("(%.0f%% of the frame traced)", m_FrameInfo.FrameProgress * 100.0f);
 		}
+		ImGui::Checkbox("Temporal Reprojection", &m_Settings.TemporalReprojection);
+		int maxHistory = (int)m_Settings.MaxHistoryLength;
+		if (ImGui::DragInt("Max History", &maxHistory, 1.0f, 1, 4096))
+			m_Settings.MaxHistoryLength = (uint32_t)maxHistory;
+		ImGui::DragFloat("Depth Tolerance", &m_Settings.DepthTolerance, 0.001f, 0.001f, 0.5f, "%.3f");
+		// The renderer restarts accumulation itself when the format changes
+		int accumulation = (int)m_Settings.Accumulation;
+		const char* accumulations[] = { "Float", "Half", "RGB9E5" };
+		if (ImGui::Combo("Accumulation", &accumulation, accumulations, IM_ARRAYSIZE(accumulations)))
+			m_Settings.Accumulation = (RayTracing::AccumulationFormat)accumulation;
+		// Only the displayed image changes, the accumulation carries on
+		ImGui::Checkbox("Denoise", &m_Settings.Denoise);
+		ImGui::SameLine();
+		int denoiseIterations = (int)m_Settings.DenoiseIterations;
+		if (ImGui::DragInt("Iterations", &denoiseIterations, 0.1f, 1, 8))
+			m_Settings.DenoiseIterations = (uint32_t)denoiseIterations;
+		ImGui::DragFloat("Denoise Color Sigma", &m_Settings.DenoiseColorSigma, 0.05f, 0.1f, 64.0f, "%.2f");
+		const RayTracing::Renderer::MemoryUsage& memory = m_FrameInfo.Memory;
+		ImGui::Text("Buffers: %.2f MB (accumulation %.2f MB, history %.2f MB, denoiser %.2f MB)", memory.GetTotal() / (1024.0 * 1024.0),
+			memory.Accumulation / (1024.0 * 1024.0), memory.History / (1024.0 * 1024.0), memory.Denoising / (1024.0 * 1024.0));
+		ImGui::SliderFloat("Render Scale", &m_RenderScale, 0.01f, 2.0f);
+
+		int threadCount = (int)m_Settings.ThreadCount;
+		if (ImGui::DragInt("Threads (0 = all)", &threadCount, 1.0f, 0, 256))
+			m_Settings.ThreadCount = (uint32_t)threadCount;
+		int tileSize = (int)m_Settings.TileSize;
+		if (ImGui::DragInt("Tile Size", &tileSize, 1.0f, 1, 256))
+			m_Settings.TileSize = (uint32_t)tileSize;
+		int seed = (int)m_Settings.Seed;
+		if (ImGui::InputInt("Seed", &seed))
 		{
-			Sphere sphere;
-			sphere.Position = { -1010.0f, 0.0f, -5.0f };
-			sphere.Radius = 1000.0f;
-			sphere.MaterialIndex = 2;
-			m_Scene.Spheres.push_back(sphere);
+			m_Settings.Seed = (uint32_t)seed;
+			m_ResetFrame = true;
 		}
+
+		if (ImGui::Checkbox("Use BVH", &m_Settings.UseBVH))
+			m_ResetFrame = true;
+		ImGui::SameLine();
+		ImGui::Checkbox("Camera Ray Packets", &m_Settings.PrimaryRayPackets);
+		ImGui::SameLine();
+		ImGui::Checkbox("BVH Stats", &m_Settings.CollectBVHStats);
+		if (ImGui::Checkbox("Sample Emissive Spheres", &m_Settings.NextEventEstimation))
+			m_ResetFrame = true;
+		int maxDiffuseDepth = (int)m_Settings.MaxDiffuseDepth;
+		if (ImGui::DragInt("Max Diffuse Depth", &maxDiffuseDepth, 0.1f, 1, 64))
 		{
-			Sphere sphere;
-			sphere.Position = { 1010.0f, 0.0f, -5.0f };
-			sphere.Radius = 1000.0f;
-			sphere.MaterialIndex = 2;
-			m_Scene.Spheres.push_back(sphere);
+			m_Settings.MaxDiffuseDepth = (uint32_t)maxDiffuseDepth;
+			m_ResetFrame = true;
 		}
+		int maxGlassDepth = (int)m_Settings.MaxGlassDepth;
+		if (ImGui::DragInt("Max Glass Depth", &maxGlassDepth, 0.1f, 0, 64))
 		{
-			Sphere sphere;
-			sphere.Position = { 0.0f, 0.0f, -1010.0f };
-			sphere.Radius = 1000.0f;
-			sphere.MaterialIndex = 3;
-			m_Scene.Spheres.push_back(sphere); 
+			m_Settings.MaxGlassDepth = (uint32_t)maxGlassDepth;
+			m_ResetFrame = true;
 		}
+		if (ImGui::Checkbox("Russian Roulette", &m_Settings.RussianRoulette))
+			m_ResetFrame = true;
+		ImGui::SameLine();
+		int rouletteDepth = (int)m_Settings.RussianRouletteDepth;
+		if (ImGui::DragInt("After Depth", &rouletteDepth, 0.1f, 0, 64))
 		{
-			Sphere sphere;
-			sphere.Position = { 0.0f, 0.0f, 1010.0f };
-			sphere.Radius = 1000.0f;
-			sphere.MaterialIndex = 4;
-			m_Scene.Spheres.push_back(sphere);
+			m_Settings.RussianRouletteDepth = (uint32_t)rouletteDepth;
+			m_ResetFrame = true;
 		}
 
-
-		//PointLight& pointLight = m_Scene.PointLights.emplace_back();
-		//pointLight.Intesity = 20.0f;
-		//pointLight.Position = { 0.0f, 4.0f, 0.0f };
-	}
-	virtual void OnUpdate(float ts) override {
-		if (m_Camera.OnUpdate(ts)) {
-			m_Renderer.ResetFrameIndex();
+		int simdLevel = (int)m_Settings.SphereSIMDLevel;
+		const char* simdLevels[] = { "Scalar", "SSE", "AVX2" };
+		if (ImGui::Combo("Sphere Kernel", &simdLevel, simdLevels, IM_ARRAYSIZE(simdLevels)))
+			m_Settings.SphereSIMDLevel = (RayTracing::SIMDLevel)simdLevel;
+		ImGui::Text("Detected: %s", RayTracing::SphereKernels::GetName(RayTracing::CPUFeatures::DetectSIMDLevel()));
+		const auto& buildStats = m_FrameInfo.BVHBuildStats;
+		ImGui::Text("BVH Build: %.3fms, %u nodes, %u leaves, depth %u", buildStats.BuildTimeMs, buildStats.NodeCount, buildStats.LeafCount, buildStats.MaxDepth);
+		const auto& meshBuildStats = m_FrameInfo.MeshBVHBuildStats;
+		if (meshBuildStats.NodeCount > 0)
+			ImGui::Text("Mesh BVH Build: %.3fms, %u nodes, %u leaves, %.2f MB", meshBuildStats.BuildTimeMs, meshBuildStats.NodeCount,
+				meshBuildStats.LeafCount, meshBuildStats.MemoryBytes / (1024.0 * 1024.0));
+#ifdef RT_ENABLE_STATS
+		const RayTracing::RenderStats& stats = m_FrameInfo.Stats;
+		double totalRays = (double)std::max<uint64_t>(stats.GetTotalRays(), 1);
+		ImGui::Text("Frame %u: %.3fms (setup %.3fms, tiles %.3fms)", stats.FrameIndex, stats.FrameMs,
+			stats.StageMs[(size_t)RayTracing::RenderStage::Setup], stats.TilesMs);
+		ImGui::Text("Rays: %llu camera, %llu bounce, %llu shadow (%.2f Mrays/s)", (unsigned long long)stats.CameraRays,
+			(unsigned long long)stats.BounceRays, (unsigned long long)stats.ShadowRays, totalRays / (stats.FrameMs * 1000.0));
+		if (m_Settings.CollectBVHStats)
+			ImGui::Text("BVH: %.2f nodes/ray, %.2f sphere tests/ray, %.2f triangle tests/ray", stats.NodesVisited / totalRays,
+				stats.SphereTests / totalRays, stats.TriangleTests / totalRays);
+		ImGui::Text("Shading: %llu diffuse, %llu glass", (unsigned long long)stats.DiffuseEvents, (unsigned long long)stats.GlassEvents);
+		if (ImGui::TreeNode("Stage Times (summed over threads)"))
+		{
+			for (size_t i = 1; i < (size_t)RayTracing::RenderStage::Count; i++)
+				ImGui::Text("%s: %.3fms", RayTracing::RenderStats::GetStageName((RayTracing::RenderStage)i), stats.StageMs[i]);
+			ImGui::TreePop();
 		}
-		Render();
-	}
-	virtual void OnUIRender() override
-	{
-		ImGui::Begin("Settings");
-		if (ImGui::Button("Render")) {
-			Render();
+		if (ImGui::TreeNode("Path Depth", "Path Depth (average %.2f)", stats.GetAveragePathDepth()))
+		{
+			float depthHistogram[RayTracing::RenderStats::DepthBuckets];
+			for (uint32_t i = 0; i < RayTracing::RenderStats::DepthBuckets; i++)
+				depthHistogram[i] = (float)stats.PathDepth[i];
+			ImGui::PlotHistogram("##PathDepth", depthHistogram, RayTracing::RenderStats::DepthBuckets, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 60));
+			ImGui::TreePop();
 		}
-		if (ImGui::Checkbox("Accumulate", &m_Renderer.GetSettings().Accumulate))
-			m_Renderer.ResetFrameIndex();
-		if (ImGui::Checkbox("Preview Renderer", &m_Renderer.GetSettings().PreviewRenderer))
-			m_Renderer.ResetFrameIndex();
+		if (ImGui::Checkbox("Log Stats to render_stats.jsonl", &m_LogStats))
+			m_RenderThread.SetStatsLogPath(m_LogStats ? "render_stats.jsonl" : "");
+#endif
 
-		if (ImGui::Button("Reset")) {
-			m_Renderer.ResetFrameIndex();
-		}
-		ImGui::Text("Last Render Time: %.3fms", m_LastRenderTime);
-		ImGui::SliderFloat("Render Scale", &m_RenderScale, 0.01f, 2.0f);
+		ImGui::Checkbox("Adaptive Sampling", &m_Settings.AdaptiveSampling);
+		ImGui::SameLine();
+		ImGui::Checkbox("Show Sample Count", &m_Settings.ShowSampleCount);
+		ImGui::DragFloat("Noise Threshold", &m_Settings.NoiseThreshold, 0.0005f, 0.0001f, 1.0f, "%.4f");
+		int minSamples = (int)m_Settings.MinSamples;
+		if (ImGui::DragInt("Min Samples", &minSamples, 1.0f, 2, 1024))
+			m_Settings.MinSamples = (uint32_t)minSamples;
+		if (m_Settings.AdaptiveSampling)
+			ImGui::Text("Converged Tiles: %u / %u", m_FrameInfo.ConvergedTiles, m_FrameInfo.TileCount);
 
 		if (ImGui::Button("Add Sphere")) {
 			Sphere sphere;
 			m_Scene.Spheres.push_back(sphere);
-			m_Renderer.ResetFrameIndex();
+			OnSceneEdited();
 		}
 		if (ImGui::Button("Add Diffuse Mat")) {
-			m_Scene.Materials.push_back(new DiffuseMaterial());
-			m_Renderer.ResetFrameIndex();
+			m_Scene.Materials.push_back(DiffuseMaterial());
+			OnSceneEdited();
 		}
 		ImGui::SameLine();
 		if (ImGui::Button("Add Refractive Mat")) {
-			m_Scene.Materials.push_back(new RefractiveMaterial());
-			m_Renderer.ResetFrameIndex();
+			m_Scene.Materials.push_back(RefractiveMaterial());
+			OnSceneEdited();
 		}
 
 		if (ImGui::Button("Add Point Light")) {
 			PointLight pointLight;
 			m_Scene.PointLights.push_back(pointLight);
-			m_Renderer.ResetFrameIndex();
+			OnSceneEdited();
+		}
+
+		ImGui::InputText("Scene File", m_ScenePath, sizeof(m_ScenePath));
+		if (ImGui::Button("Load Scene")) {
+			Walnut::Timer loadTimer;
+			Scene scene;
+			if (SceneFile::Load(m_ScenePath, scene, &m_SceneFileStatus))
+			{
+				m_Scene = std::move(scene);
+				m_SceneFileStatus = "Loaded in " + std::to_string(loadTimer.ElapsedMillis()) + "ms";
+				OnSceneEdited(true);
+			}
 		}
+		ImGui::SameLine();
+		if (ImGui::Button("Save Scene"))
+			m_SceneFileStatus = SceneFile::WriteBinary(m_ScenePath, m_Scene) ? "Saved" : "Failed to save";
+		if (!m_SceneFileStatus.empty())
+			ImGui::TextUnformatted(m_SceneFileStatus.c_str());
 
 		ImGui::End();
 
@@ -164,11 +226,11 @@ public:
 
 			PointLight& pointLight = m_Scene.PointLights[i];
 			if (ImGui::DragFloat3("Position", glm::value_ptr(pointLight.Position), 0.1f))
-				m_Renderer.ResetFrameIndex();
+				OnSceneEdited();
 			if (ImGui::DragFloat("Intesity", &pointLight.Intesity, 0.1f))
-				m_Renderer.ResetFrameIndex();
+				OnSceneEdited();
 			if (ImGui::ColorEdit3("Color", glm::value_ptr(pointLight.Color)))
-				m_Renderer.ResetFrameIndex();
+				OnSceneEdited();
 
 			ImGui::Separator();
 
@@ -181,24 +243,24 @@ public:
 		{
 			ImGui::PushID(i);
 
-			Material* material = m_Scene.Materials[i];
-			if (material->GetMaterialType() == MaterialType::Diffuse) {
-				DiffuseMaterial* diffuse = (DiffuseMaterial*)material;
-				if (ImGui::ColorEdit3("Albedo", glm::value_ptr(diffuse->Albedo)))
-					m_Renderer.ResetFrameIndex();
-				if (ImGui::DragFloat("Roughness", &diffuse->Roughness, 0.05f, 0.0f, 1.0f))
-					m_Renderer.ResetFrameIndex();
-				if (ImGui::DragFloat("Metallic", &diffuse->Metallic, 0.05f, 0.0f, 1.0f))
-					m_Renderer.ResetFrameIndex();
-				if (ImGui::ColorEdit3("Emission Color", glm::value_ptr(diffuse->EmissionColor)))
-					m_Renderer.ResetFrameIndex();
-				if (ImGui::DragFloat("Emission Power", &diffuse->EmissionPower, 0.05f, 0.0f, FLT_MAX))
-					m_Renderer.ResetFrameIndex();
+			Material& material = m_Scene.Materials[i];
+			if (material.Type == MaterialType::Diffuse) {
+				DiffuseMaterial& diffuse = material.Diffuse;
+				if (ImGui::ColorEdit3("Albedo", glm::value_ptr(diffuse.Albedo)))
+					OnSceneEdited();
+				if (ImGui::DragFloat("Roughness", &diffuse.Roughness, 0.05f, 0.0f, 1.0f))
+					OnSceneEdited();
+				if (ImGui::DragFloat("Metallic", &diffuse.Metallic, 0.05f, 0.0f, 1.0f))
+					OnSceneEdited();
+				if (ImGui::ColorEdit3("Emission Color", glm::value_ptr(diffuse.EmissionColor)))
+					OnSceneEdited();
+				if (ImGui::DragFloat("Emission Power", &diffuse.EmissionPower, 0.05f, 0.0f, FLT_MAX))
+					OnSceneEdited();
 			}
 			else {
-				RefractiveMaterial* refractive = (RefractiveMaterial*)material;
-				if (ImGui::DragFloat("Refractive Index", &refractive->RefractiveIndex, 0.05f))
-					m_Renderer.ResetFrameIndex();
+				RefractiveMaterial& refractive = material.Glass;
+				if (ImGui::DragFloat("Refractive Index", &refractive.RefractiveIndex, 0.05f))
+					OnSceneEdited();
 			}
 
 			ImGui::Separator();
@@ -207,20 +269,32 @@ public:
 		ImGui::End();
 
 		ImGui::Begin("Objects");
-		for (size_t i = 0; i < m_Scene.Spheres.size(); i++)
+		// Loaded scenes can hold millions of spheres, only lay out the visible ones
+		ImGuiListClipper clipper;
+		clipper.Begin((int)m_Scene.Spheres.size());
+		while (clipper.Step())
 		{
-			ImGui::PushID(i);
-
-			Sphere& sphere = m_Scene.Spheres[i];
-			if(ImGui::DragFloat3("Position", glm::value_ptr(sphere.Position), 0.1f))
-				m_Renderer.ResetFrameIndex();
-			if(ImGui::DragFloat("Radius", &sphere.Radius, 0.1f))
-				m_Renderer.ResetFrameIndex();
-			if(ImGui::DragInt("Material", &sphere.MaterialIndex, 1.0f, 0, (int)m_Scene.Materials.size() - 1))
-				m_Renderer.ResetFrameIndex();
-
-			ImGui::Separator();
-			ImGui::PopID();
+			for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+			{
+				ImGui::PushID(i);
+
+				Sphere& sphere = m_Scene.Spheres[i];
+				if (ImGui::DragFloat3("Position", glm::value_ptr(sphere.Position), 0.1f))
+				{
+					OnSceneEdited(true);
+				}
+				if (ImGui::DragFloat("Radius", &sphere.Radius, 0.1f))
+				{
+					OnSceneEdited(true);
+				}
+				if (ImGui::DragInt("Material", &sphere.MaterialIndex, 1.0f, 0, (int)m_Scene.Materials.size() - 1))
+				{
+					OnSceneEdited(true);
+				}
+
+				ImGui::Separator();
+				ImGui::PopID();
+			}
 		}
 		ImGui::End();
 
@@ -230,29 +304,79 @@ public:
 		m_ViewportHeight = ImGui::GetContentRegionAvail().x;
 		m_ViewportWidth = ImGui::GetContentRegionAvail().y;
 
-		auto image = m_Renderer.GetFinalImage();
+		Present();
+		auto image = m_FinalImage;
 		if(image)
 			ImGui::Image(image->GetDescriptorSet(), { (float)m_ViewportHeight, (float)m_ViewportWidth }, ImVec2(0,1), ImVec2(1,0));
 
 		ImGui::End();
 		ImGui::PopStyleVar();
+
+		Submit();
 	}
 
-	void Render() {
-		Walnut::Timer timer;
+	// Scene edits from the panels are previewed like camera movement. geometryChanged = spheres
+	// were moved, resized or given another material, the BVH is rebuilt.
+	void OnSceneEdited(bool geometryChanged = false) {
+		m_ResetFrame = true;
+		m_SceneEdited = true;
+		m_SceneDirty = true;
+		m_GeometryChanged |= geometryChanged;
+	}
 
-		m_Renderer.OnResize(m_ViewportHeight * m_RenderScale, m_ViewportWidth * m_RenderScale);
-		m_Camera.OnResize(m_ViewportHeight * m_RenderScale, m_ViewportWidth * m_RenderScale);
-		m_Renderer.Render(m_Scene, m_Camera);
+	// Hands this UI frame's edits to the render thread, which picks them up when its current frame finishes
+	void Submit() {
+		uint32_t width = m_ViewportHeight * m_RenderScale;
+		uint32_t height = m_ViewportWidth * m_RenderScale;
+		if (width > 0 && height > 0)
+			m_Camera.OnResize(width, height);
+
+		if (m_SceneDirty)
+			m_RenderThread.SubmitScene(m_Scene, m_GeometryChanged);
+		// Short grace period so a slider held still for a frame does not trigger a full resolution frame
+		m_RenderThread.Submit(m_Settings, m_Camera, width, height, m_IdleTime < 0.1f, m_ResetFrame);
+		m_SceneDirty = false;
+		m_GeometryChanged = false;
+		m_ResetFrame = false;
+	}
+
+	// Uploads the newest finished frame, if any; the render thread is already tracing the next one
+	void Present() {
+		const uint32_t* pixels = m_RenderThread.AcquireImage(m_FrameInfo);
+		if (!pixels)
+			return;
 
-		m_LastRenderTime = timer.ElapsedMillis();
+		uint32_t width = m_FrameInfo.Width, height = m_FrameInfo.Height;
+		if (!m_FinalImage)
+			m_FinalImage = std::make_shared<Walnut::Image>(width, height, Walnut::ImageFormat::RGBA);
+		else if (m_FinalImage->GetWidth() != width || m_FinalImage->GetHeight() != height)
+			m_FinalImage->Resize(width, height);
+
+		m_FinalImage->SetData(pixels);
 	}
 
 private:
-	RayTracing::Renderer m_Renderer;
-	float m_LastRenderTime = 0.0f;
+	// Edits to the settings, scene and camera are copied to it once per UI frame
+	RayTracing::RenderThread m_RenderThread;
+	RayTracing::Renderer::Settings m_Settings;
+	// Of the frame on screen
+	RayTracing::RenderThread::FrameInfo m_FrameInfo;
+	std::shared_ptr<Walnut::Image> m_FinalImage;
 	float m_RenderScale = 1.0f;
 
+	bool m_SceneEdited = false;
+	// Pending for the next Submit
+	bool m_SceneDirty = false;
+	bool m_GeometryChanged = false;
+	bool m_ResetFrame = false;
+	char m_ScenePath[256] = "scene.rtscene";
+	std::string m_SceneFileStatus;
+	// Seconds since the camera or scene last changed
+	float m_IdleTime = 1.0f;
+
+	// Written by the render thread, one JSON line per rendered frame while enabled
+	bool m_LogStats = false;
+
 	Camera m_Camera;
 	Scene m_Scene;
 
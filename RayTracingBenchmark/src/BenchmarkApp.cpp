@@ -0,0 +1,612 @@
+#include "Walnut/Timer.h"
+
+#include "Renderer.h"
+#include "Camera.h"
+#include "SceneFile.h"
+#include "Scenes.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(WL_DEBUG)
+static const char* s_BuildConfig = "Debug";
+#elif defined(WL_RELEASE)
+static const char* s_BuildConfig = "Release";
+#elif defined(WL_DIST)
+static const char* s_BuildConfig = "Dist";
+#else
+static const char* s_BuildConfig = "Unknown";
+#endif
+
+struct BenchmarkOptions
+{
+	uint32_t Width = 640;
+	uint32_t Height = 360;
+	uint32_t Frames = 8;
+	// 0 = all hardware threads
+	uint32_t MaxThreads = 0;
+	// Only run scenes whose name contains this
+	std::string SceneFilter;
+	RayTracing::IntegratorMode Integrator = RayTracing::IntegratorMode::Recursive;
+	RayTracing::AccumulationFormat Accumulation = RayTracing::AccumulationFormat::Float32;
+	bool CSV = false;
+	// Empty = stdout
+	std::string OutputPath;
+	// Non-zero = time loading a scene of this many spheres instead of rendering
+	uint32_t SceneLoadSpheres = 0;
+	// Print the renderer's per-pixel memory at common resolutions instead of rendering
+	bool MemoryReport = false;
+	// Non-zero = check the memory of a torus mesh with this many segments instead of rendering
+	uint32_t MeshMemorySegments = 0;
+	// Check that AOVs and denoiser features turned on after adaptive sampling converged get filled
+	bool LateFeatures = false;
+};
+
+struct BenchmarkScene
+{
+	const char* Name;
+	std::function<Scene()> Create;
+};
+
+struct ThreadRun
+{
+	uint32_t ThreadCount;
+	double MsPerFrame;
+};
+
+struct SceneLoadResult
+{
+	size_t SphereCount;
+	size_t BinaryBytes;
+	size_t TextBytes;
+	// Best of Frames runs each
+	double TextMs;
+	double MapMs;
+	double BinaryMs;
+};
+
+struct MeshMemoryResult
+{
+	size_t VertexCount;
+	size_t TriangleCount;
+	// Scene::Vertices and Scene::Triangles
+	size_t MeshBytes;
+	size_t BVHBytes;
+	// Nodes plus one leaf order index per triangle, all a mesh BVH is allowed to keep
+	size_t BVHLimitBytes;
+	float BuildTimeMs;
+};
+
+struct SceneResult
+{
+	std::string Name;
+	size_t SphereCount;
+	size_t PointLightCount;
+	float BVHBuildTimeMs;
+	// Deterministic for a given scene, resolution and seed, so counted once and shared by every run
+	uint64_t PrimaryRaysPerFrame;
+	uint64_t TotalRaysPerFrame;
+	std::vector<ThreadRun> Runs;
+};
+
+static void PrintUsage(const char* exe)
+{
+	printf("Usage: %s [options]\n", exe);
+	printf("  --width <n>      image width (default 640)\n");
+	printf("  --height <n>     image height (default 360)\n");
+	printf("  --frames <n>     timed frames per run (default 8)\n");
+	printf("  --threads <n>    highest thread count to scale to, 0 = all hardware threads (default 0)\n");
+	printf("  --scene <name>   only run scenes whose name contains <name>\n");
+	printf("  --wavefront      use the wavefront integrator instead of the recursive one\n");
+	printf("  --accumulation <f> float, half or rgb9e5 accumulation storage (default float)\n");
+	printf("  --csv            one line per scene and thread count instead of JSON\n");
+	printf("  --output <file>  write results to a file instead of stdout\n");
+	printf("  --scene-load <n> time loading n random spheres from text and binary scene files instead of rendering\n");
+	printf("  --memory         report renderer memory per resolution and accumulation format instead of rendering\n");
+	printf("  --late-features  check that AOVs enabled after adaptive sampling converged are recorded for every tile\n");
+	printf("  --mesh-memory <n> check that the BVH of an n-segment torus mesh does not copy the mesh, fails if it does\n");
+}
+
+static bool ParseArgs(int argc, char** argv, BenchmarkOptions& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (strcmp(arg, "--width") == 0 && hasValue)
+			options.Width = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--height") == 0 && hasValue)
+			options.Height = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--frames") == 0 && hasValue)
+			options.Frames = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--threads") == 0 && hasValue)
+			options.MaxThreads = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--scene") == 0 && hasValue)
+			options.SceneFilter = argv[++i];
+		else if (strcmp(arg, "--wavefront") == 0)
+			options.Integrator = RayTracing::IntegratorMode::Wavefront;
+		else if (strcmp(arg, "--accumulation") == 0 && hasValue)
+		{
+			const char* format = argv[++i];
+			if (strcmp(format, "float") == 0)
+				options.Accumulation = RayTracing::AccumulationFormat::Float32;
+			else if (strcmp(format, "half") == 0)
+				options.Accumulation = RayTracing::AccumulationFormat::Half;
+			else if (strcmp(format, "rgb9e5") == 0)
+				options.Accumulation = RayTracing::AccumulationFormat::SharedExponent;
+			else
+				return false;
+		}
+		else if (strcmp(arg, "--memory") == 0)
+			options.MemoryReport = true;
+		else if (strcmp(arg, "--csv") == 0)
+			options.CSV = true;
+		else if (strcmp(arg, "--output") == 0 && hasValue)
+			options.OutputPath = argv[++i];
+		else if (strcmp(arg, "--scene-load") == 0 && hasValue)
+			options.SceneLoadSpheres = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--late-features") == 0)
+			options.LateFeatures = true;
+		else if (strcmp(arg, "--mesh-memory") == 0 && hasValue)
+			options.MeshMemorySegments = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else
+			return false;
+	}
+
+	return options.Width > 0 && options.Height > 0 && options.Frames > 0;
+}
+
+// 1, 2, 4, ... up to and including maxThreads
+static std::vector<uint32_t> GetThreadCounts(uint32_t maxThreads)
+{
+	std::vector<uint32_t> threadCounts;
+	for (uint32_t threadCount = 1; threadCount < maxThreads; threadCount *= 2)
+		threadCounts.push_back(threadCount);
+	threadCounts.push_back(maxThreads);
+	return threadCounts;
+}
+
+static SceneResult RunScene(const BenchmarkScene& benchmarkScene, const BenchmarkOptions& options, const std::vector<uint32_t>& threadCounts)
+{
+	Scene scene = benchmarkScene.Create();
+	Camera camera(45.0f, 0.01f, 100.0f);
+	RayTracing::Renderer renderer;
+
+	renderer.GetSettings().Accumulate = true;
+	renderer.GetSettings().Integrator = options.Integrator;
+	renderer.GetSettings().Accumulation = options.Accumulation;
+	renderer.OnResize(options.Width, options.Height);
+	camera.OnResize(options.Width, options.Height);
+
+	SceneResult result;
+	result.Name = benchmarkScene.Name;
+	result.SphereCount = scene.Spheres.size();
+	result.PointLightCount = scene.PointLights.size();
+
+	// Counting pass over the same frames the timed runs render, rendering is deterministic so the
+	// counts hold for every thread count. Dist builds compile the counters out and report 0.
+	renderer.GetSettings().ThreadCount = threadCounts.back();
+	uint64_t totalRays = 0;
+	for (uint32_t frame = 0; frame < options.Frames; frame++)
+	{
+		renderer.Render(scene, camera);
+		totalRays += renderer.GetStats().GetTotalRays();
+	}
+
+	result.BVHBuildTimeMs = renderer.GetBVHBuildStats().BuildTimeMs + renderer.GetMeshBVHBuildStats().BuildTimeMs;
+	result.PrimaryRaysPerFrame = (uint64_t)options.Width * options.Height;
+	result.TotalRaysPerFrame = totalRays / options.Frames;
+
+	for (uint32_t threadCount : threadCounts)
+	{
+		renderer.GetSettings().ThreadCount = threadCount;
+
+		// Warm-up frame starts the pool and touches the buffers
+		renderer.ResetFrameIndex();
+		renderer.Render(scene, camera);
+
+		renderer.ResetFrameIndex();
+		Walnut::Timer timer;
+		for (uint32_t frame = 0; frame < options.Frames; frame++)
+			renderer.Render(scene, camera);
+		float elapsedMs = timer.ElapsedMillis();
+
+		result.Runs.push_back({ threadCount, elapsedMs / options.Frames });
+		fprintf(stderr, "%s, %u threads: %.3fms/frame\n", result.Name.c_str(), threadCount, elapsedMs / options.Frames);
+	}
+
+	return result;
+}
+
+static bool RunSceneLoad(const BenchmarkOptions& options, SceneLoadResult& result)
+{
+	const std::string binaryPath = "scene_load_benchmark.rtscene";
+	const std::string textPath = "scene_load_benchmark.txt";
+
+	Scene scene = Scenes::RandomSpheres(options.SceneLoadSpheres);
+	if (!SceneFile::WriteBinary(binaryPath, scene) || !SceneFile::WriteText(textPath, scene))
+	{
+		fprintf(stderr, "Failed to write the scene files\n");
+		return false;
+	}
+
+	result.SphereCount = scene.Spheres.size();
+	result.TextMs = result.MapMs = result.BinaryMs = 1.0e30;
+
+	// The files were just written, so every run reads from the page cache
+	bool loaded = true;
+	for (uint32_t run = 0; run < options.Frames && loaded; run++)
+	{
+		Scene textScene;
+		Walnut::Timer textTimer;
+		loaded &= SceneFile::LoadText(textPath, textScene);
+		result.TextMs = std::min(result.TextMs, (double)textTimer.ElapsedMillis());
+
+		// Zero-copy: only the mapping and the header checks
+		SceneFile::MappedScene mapped;
+		Walnut::Timer mapTimer;
+		loaded &= mapped.Open(binaryPath);
+		result.MapMs = std::min(result.MapMs, (double)mapTimer.ElapsedMillis());
+		result.BinaryBytes = mapped.GetFileSize();
+		mapped.Close();
+
+		Scene binaryScene;
+		Walnut::Timer binaryTimer;
+		loaded &= SceneFile::LoadBinary(binaryPath, binaryScene);
+		result.BinaryMs = std::min(result.BinaryMs, (double)binaryTimer.ElapsedMillis());
+		loaded &= binaryScene.Spheres.size() == scene.Spheres.size() && textScene.Spheres.size() == scene.Spheres.size();
+	}
+
+	FILE* textFile = fopen(textPath.c_str(), "rb");
+	if (textFile)
+	{
+		fseek(textFile, 0, SEEK_END);
+		result.TextBytes = (size_t)ftell(textFile);
+		fclose(textFile);
+	}
+	std::remove(binaryPath.c_str());
+	std::remove(textPath.c_str());
+
+	if (!loaded)
+		fprintf(stderr, "Failed to load the scene files back\n");
+	return loaded;
+}
+
+// Renders one frame so the BVH is traced from the scene's buffers, not just built
+static bool RunMeshMemory(const BenchmarkOptions& options, MeshMemoryResult& result)
+{
+	Scene scene = Scenes::MeshTorus(options.MeshMemorySegments);
+	Camera camera(45.0f, 0.01f, 100.0f);
+	RayTracing::Renderer renderer;
+
+	renderer.GetSettings().Accumulate = true;
+	renderer.OnResize(options.Width, options.Height);
+	camera.OnResize(options.Width, options.Height);
+	renderer.Render(scene, camera);
+
+	const RayTracing::BVH::BuildStats& buildStats = renderer.GetMeshBVHBuildStats();
+	result.VertexCount = scene.Vertices.size();
+	result.TriangleCount = scene.Triangles.size();
+	result.MeshBytes = scene.Vertices.size() * sizeof(glm::vec3) + scene.Triangles.size() * sizeof(Triangle);
+	result.BVHBytes = buildStats.MemoryBytes;
+	result.BVHLimitBytes = buildStats.NodeCount * sizeof(RayTracing::BVH::Node) + scene.Triangles.size() * sizeof(uint32_t);
+	result.BuildTimeMs = buildStats.BuildTimeMs;
+
+	if (result.BVHBytes > result.BVHLimitBytes)
+	{
+		fprintf(stderr, "The mesh BVH keeps %zu bytes, more than the %zu of its nodes and leaf order\n", result.BVHBytes, result.BVHLimitBytes);
+		return false;
+	}
+	return true;
+}
+
+// One renderer records AOVs from the first frame, the other turns them and the denoiser on only
+// once most tiles converged. Both then hold the primary hits of their latest samples, so their
+// object indices may only differ where jitter moved a sample across an edge.
+static bool RunLateFeatures(const BenchmarkOptions& options)
+{
+	const uint32_t maxFrames = 256;
+	Scene scene = Scenes::CornellBox();
+	Camera camera(45.0f, 0.01f, 100.0f);
+	camera.OnResize(options.Width, options.Height);
+
+	RayTracing::Renderer reference, late;
+	for (RayTracing::Renderer* renderer : { &reference, &late })
+	{
+		RayTracing::Renderer::Settings& settings = renderer->GetSettings();
+		settings.Accumulate = true;
+		settings.AdaptiveSampling = true;
+		settings.NoiseThreshold = 0.05f;
+		settings.MinSamples = 4;
+		renderer->OnResize(options.Width, options.Height);
+	}
+	reference.GetSettings().AOVs = RayTracing::AOV::ObjectIndex;
+
+	uint32_t frames = 0;
+	do
+	{
+		late.Render(scene, camera);
+		frames++;
+	} while (frames < maxFrames && late.GetConvergedTileCount() * 2 < late.GetTileCount());
+	uint32_t convergedTiles = late.GetConvergedTileCount();
+	if (convergedTiles * 2 < late.GetTileCount())
+	{
+		fprintf(stderr, "Only %u of %u tiles converged after %u frames\n", convergedTiles, late.GetTileCount(), maxFrames);
+		return false;
+	}
+
+	late.GetSettings().AOVs = RayTracing::AOV::ObjectIndex;
+	late.GetSettings().Denoise = true;
+	late.Render(scene, camera);
+	for (uint32_t i = 0; i <= frames; i++)
+		reference.Render(scene, camera);
+
+	const uint32_t* lateObjects = late.GetAOVs().GetObjectIndices();
+	const uint32_t* referenceObjects = reference.GetAOVs().GetObjectIndices();
+	size_t pixelCount = (size_t)options.Width * options.Height;
+	size_t mismatches = 0;
+	for (size_t i = 0; i < pixelCount; i++)
+		mismatches += lateObjects[i] != referenceObjects[i];
+
+	double mismatchFraction = (double)mismatches / (double)pixelCount;
+	bool passed = late.IsDenoised() && mismatchFraction < 0.02;
+	printf("Late features: %u/%u tiles converged after %u frames, %zu of %zu object indices differ, %s\n", convergedTiles, late.GetTileCount(),
+		frames, mismatches, pixelCount, passed ? "passed" : "failed");
+	return passed;
+}
+
+static void WriteMeshMemory(FILE* file, const MeshMemoryResult& result, bool csv)
+{
+	if (csv)
+	{
+		fprintf(file, "vertices,triangles,mesh_bytes,bvh_bytes,bvh_limit_bytes,build_ms\n");
+		fprintf(file, "%zu,%zu,%zu,%zu,%zu,%.4f\n", result.VertexCount, result.TriangleCount, result.MeshBytes, result.BVHBytes,
+			result.BVHLimitBytes, result.BuildTimeMs);
+		return;
+	}
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"config\": \"%s\",\n", s_BuildConfig);
+	fprintf(file, "  \"meshMemory\": { \"vertices\": %zu, \"triangles\": %zu, \"meshBytes\": %zu, \"bvhBytes\": %zu, \"bvhLimitBytes\": %zu, \"buildMs\": %.4f }\n",
+		result.VertexCount, result.TriangleCount, result.MeshBytes, result.BVHBytes, result.BVHLimitBytes, result.BuildTimeMs);
+	fprintf(file, "}\n");
+}
+
+static void WriteSceneLoad(FILE* file, const SceneLoadResult& result, bool csv)
+{
+	double binaryMB = result.BinaryBytes / (1024.0 * 1024.0);
+	if (csv)
+	{
+		fprintf(file, "spheres,binary_bytes,text_bytes,text_ms,map_ms,binary_ms,binary_mb_per_s\n");
+		fprintf(file, "%zu,%zu,%zu,%.4f,%.4f,%.4f,%.1f\n", result.SphereCount, result.BinaryBytes, result.TextBytes,
+			result.TextMs, result.MapMs, result.BinaryMs, binaryMB / (result.BinaryMs / 1000.0));
+		return;
+	}
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"config\": \"%s\",\n", s_BuildConfig);
+	fprintf(file, "  \"sceneLoad\": { \"spheres\": %zu, \"binaryBytes\": %zu, \"textBytes\": %zu, \"textMs\": %.4f, \"mapMs\": %.4f, \"binaryMs\": %.4f, \"binaryMBPerSec\": %.1f }\n",
+		result.SphereCount, result.BinaryBytes, result.TextBytes, result.TextMs, result.MapMs, result.BinaryMs, binaryMB / (result.BinaryMs / 1000.0));
+	fprintf(file, "}\n");
+}
+
+// Computed, not measured: the buffers are sized from the resolution and format alone
+static void WriteMemoryReport(FILE* file, bool csv)
+{
+	struct Resolution
+	{
+		const char* Name;
+		uint32_t Width, Height;
+	};
+	const Resolution resolutions[] = {
+		{ "720p", 1280, 720 },
+		{ "1080p", 1920, 1080 },
+		{ "4k", 3840, 2160 },
+		{ "8k", 7680, 4320 },
+		{ "16k", 15360, 8640 },
+	};
+	const RayTracing::AccumulationFormat formats[] = {
+		RayTracing::AccumulationFormat::Float32,
+		RayTracing::AccumulationFormat::Half,
+		RayTracing::AccumulationFormat::SharedExponent,
+	};
+
+	if (csv)
+		fprintf(file, "resolution,width,height,accumulation,image_bytes,accumulation_bytes,statistics_bytes,primary_hit_bytes,history_bytes,total_bytes,total_with_history_bytes\n");
+	else
+		fprintf(file, "{\n  \"memory\": [\n");
+
+	size_t count = sizeof(resolutions) / sizeof(resolutions[0]) * (sizeof(formats) / sizeof(formats[0]));
+	size_t row = 0;
+	for (const Resolution& resolution : resolutions)
+	{
+		for (RayTracing::AccumulationFormat format : formats)
+		{
+			// Headless renders never move the camera, the viewport allocates the history on the first move
+			RayTracing::Renderer::MemoryUsage usage = RayTracing::Renderer::GetMemoryUsage(resolution.Width, resolution.Height, format, true);
+			size_t total = usage.GetTotal() - usage.History;
+			const char* name = RayTracing::AccumulationBuffer::GetName(format);
+			if (csv)
+			{
+				fprintf(file, "%s,%u,%u,%s,%zu,%zu,%zu,%zu,%zu,%zu,%zu\n", resolution.Name, resolution.Width, resolution.Height, name,
+					usage.Image, usage.Accumulation, usage.Statistics, usage.PrimaryHits, usage.History, total, usage.GetTotal());
+			}
+			else
+			{
+				fprintf(file, "    { \"resolution\": \"%s\", \"width\": %u, \"height\": %u, \"accumulation\": \"%s\", \"imageBytes\": %zu, \"accumulationBytes\": %zu, "
+					"\"statisticsBytes\": %zu, \"primaryHitBytes\": %zu, \"historyBytes\": %zu, \"totalBytes\": %zu, \"totalWithHistoryBytes\": %zu }%s\n",
+					resolution.Name, resolution.Width, resolution.Height, name, usage.Image, usage.Accumulation, usage.Statistics, usage.PrimaryHits,
+					usage.History, total, usage.GetTotal(), ++row < count ? "," : "");
+			}
+		}
+	}
+
+	if (!csv)
+		fprintf(file, "  ]\n}\n");
+}
+
+static double MraysPerSecond(uint64_t raysPerFrame, double msPerFrame)
+{
+	return raysPerFrame / (msPerFrame * 1000.0);
+}
+
+static double NanosecondsPerRay(uint64_t raysPerFrame, double msPerFrame)
+{
+	return msPerFrame * 1.0e6 / (double)std::max<uint64_t>(raysPerFrame, 1);
+}
+
+static void WriteCSV(FILE* file, const std::vector<SceneResult>& results)
+{
+	fprintf(file, "scene,spheres,point_lights,threads,ms_per_frame,primary_mrays_per_s,total_mrays_per_s,ns_per_ray,speedup\n");
+	for (const SceneResult& result : results)
+	{
+		for (const ThreadRun& run : result.Runs)
+		{
+			fprintf(file, "%s,%zu,%zu,%u,%.4f,%.4f,%.4f,%.3f,%.3f\n", result.Name.c_str(), result.SphereCount, result.PointLightCount,
+				run.ThreadCount, run.MsPerFrame, MraysPerSecond(result.PrimaryRaysPerFrame, run.MsPerFrame),
+				MraysPerSecond(result.TotalRaysPerFrame, run.MsPerFrame), NanosecondsPerRay(result.TotalRaysPerFrame, run.MsPerFrame),
+				result.Runs.front().MsPerFrame / run.MsPerFrame);
+		}
+	}
+}
+
+static void WriteJSON(FILE* file, const std::vector<SceneResult>& results, const BenchmarkOptions& options)
+{
+	RayTracing::SIMDLevel simdLevel = RayTracing::CPUFeatures::DetectSIMDLevel();
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"config\": \"%s\",\n", s_BuildConfig);
+	fprintf(file, "  \"sphereKernel\": \"%s\",\n", RayTracing::SphereKernels::GetName(simdLevel));
+	fprintf(file, "  \"integrator\": \"%s\",\n", options.Integrator == RayTracing::IntegratorMode::Wavefront ? "wavefront" : "recursive");
+	fprintf(file, "  \"accumulation\": \"%s\",\n", RayTracing::AccumulationBuffer::GetName(options.Accumulation));
+	fprintf(file, "  \"width\": %u,\n  \"height\": %u,\n  \"frames\": %u,\n", options.Width, options.Height, options.Frames);
+	fprintf(file, "  \"scenes\": [\n");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const SceneResult& result = results[i];
+		fprintf(file, "    {\n");
+		fprintf(file, "      \"name\": \"%s\",\n", result.Name.c_str());
+		fprintf(file, "      \"spheres\": %zu,\n", result.SphereCount);
+		fprintf(file, "      \"pointLights\": %zu,\n", result.PointLightCount);
+		fprintf(file, "      \"bvhBuildMs\": %.4f,\n", result.BVHBuildTimeMs);
+		fprintf(file, "      \"primaryRaysPerFrame\": %llu,\n", (unsigned long long)result.PrimaryRaysPerFrame);
+		fprintf(file, "      \"totalRaysPerFrame\": %llu,\n", (unsigned long long)result.TotalRaysPerFrame);
+		fprintf(file, "      \"runs\": [\n");
+		for (size_t j = 0; j < result.Runs.size(); j++)
+		{
+			const ThreadRun& run = result.Runs[j];
+			fprintf(file, "        { \"threads\": %u, \"msPerFrame\": %.4f, \"primaryMraysPerSec\": %.4f, \"totalMraysPerSec\": %.4f, \"nsPerRay\": %.3f, \"speedup\": %.3f }%s\n",
+				run.ThreadCount, run.MsPerFrame, MraysPerSecond(result.PrimaryRaysPerFrame, run.MsPerFrame),
+				MraysPerSecond(result.TotalRaysPerFrame, run.MsPerFrame), NanosecondsPerRay(result.TotalRaysPerFrame, run.MsPerFrame),
+				result.Runs.front().MsPerFrame / run.MsPerFrame, j + 1 < result.Runs.size() ? "," : "");
+		}
+		fprintf(file, "      ]\n");
+		fprintf(file, "    }%s\n", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+}
+
+int main(int argc, char** argv)
+{
+	BenchmarkOptions options;
+	if (!ParseArgs(argc, argv, options))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	if (options.SceneLoadSpheres > 0)
+	{
+		SceneLoadResult result = {};
+		if (!RunSceneLoad(options, result))
+			return 1;
+
+		FILE* file = options.OutputPath.empty() ? stdout : fopen(options.OutputPath.c_str(), "w");
+		if (!file)
+		{
+			fprintf(stderr, "Failed to open %s\n", options.OutputPath.c_str());
+			return 1;
+		}
+		WriteSceneLoad(file, result, options.CSV);
+		if (file != stdout)
+			fclose(file);
+		return 0;
+	}
+
+	if (options.LateFeatures)
+		return RunLateFeatures(options) ? 0 : 1;
+
+	if (options.MeshMemorySegments > 0)
+	{
+		MeshMemoryResult result = {};
+		bool passed = RunMeshMemory(options, result);
+
+		FILE* file = options.OutputPath.empty() ? stdout : fopen(options.OutputPath.c_str(), "w");
+		if (!file)
+		{
+			fprintf(stderr, "Failed to open %s\n", options.OutputPath.c_str());
+			return 1;
+		}
+		WriteMeshMemory(file, result, options.CSV);
+		if (file != stdout)
+			fclose(file);
+		return passed ? 0 : 1;
+	}
+
+	if (options.MemoryReport)
+	{
+		FILE* file = options.OutputPath.empty() ? stdout : fopen(options.OutputPath.c_str(), "w");
+		if (!file)
+		{
+			fprintf(stderr, "Failed to open %s\n", options.OutputPath.c_str());
+			return 1;
+		}
+		WriteMemoryReport(file, options.CSV);
+		if (file != stdout)
+			fclose(file);
+		return 0;
+	}
+
+	const BenchmarkScene scenes[] = {
+		{ "cornell_box", [] { return Scenes::CornellBox(); } },
+		{ "all_glass", [] { return Scenes::AllGlass(); } },
+		{ "many_point_lights", [] { return Scenes::ManyPointLights(); } },
+		{ "random_spheres_10k", [] { return Scenes::RandomSpheres(10000); } },
+		{ "random_spheres_100k", [] { return Scenes::RandomSpheres(100000); } },
+		{ "mesh_torus", [] { return Scenes::MeshTorus(); } },
+	};
+
+	uint32_t maxThreads = options.MaxThreads ? options.MaxThreads : std::max(1u, std::thread::hardware_concurrency());
+	std::vector<uint32_t> threadCounts = GetThreadCounts(maxThreads);
+
+	std::vector<SceneResult> results;
+	for (const BenchmarkScene& scene : scenes)
+	{
+		if (!options.SceneFilter.empty() && std::string(scene.Name).find(options.SceneFilter) == std::string::npos)
+			continue;
+		results.push_back(RunScene(scene, options, threadCounts));
+	}
+
+	FILE* file = options.OutputPath.empty() ? stdout : fopen(options.OutputPath.c_str(), "w");
+	if (!file)
+	{
+		fprintf(stderr, "Failed to open %s\n", options.OutputPath.c_str());
+		return 1;
+	}
+
+	if (options.CSV)
+		WriteCSV(file, results);
+	else
+		WriteJSON(file, results, options);
+
+	if (file != stdout)
+		fclose(file);
+	return 0;
+}
@@ -0,0 +1,83 @@
+project "RayTracingHeadless"
+   kind "ConsoleApp"
+   language "C++"
+   cppdialect "C++17"
+   targetdir "bin/%{cfg.buildcfg}"
+   staticruntime "off"
+
+   -- Shares the renderer with the viewport app but never touches Vulkan, GLFW or ImGui
+   files
+   {
+      "src/**.h",
+      "src/**.cpp",
+
+      "../RayTracing/src/AOVBuffers.h",
+      "../RayTracing/src/AOVBuffers.cpp",
+      "../RayTracing/src/AccumulationBuffer.h",
+      "../RayTracing/src/AccumulationBuffer.cpp",
+      "../RayTracing/src/BVH.h",
+      "../RayTracing/src/BVH.cpp",
+      "../RayTracing/src/CPUFeatures.h",
+      "../RayTracing/src/CPUFeatures.cpp",
+      "../RayTracing/src/Camera.h",
+      "../RayTracing/src/Camera.cpp",
+      "../RayTracing/src/Checkpoint.h",
+      "../RayTracing/src/Checkpoint.cpp",
+      "../RayTracing/src/Denoiser.h",
+      "../RayTracing/src/Denoiser.cpp",
+      "../RayTracing/src/Random.h",
+      "../RayTracing/src/Ray.h",
+      "../RayTracing/src/RayPacket.h",
+      "../RayTracing/src/RenderStats.h",
+      "../RayTracing/src/RenderStats.cpp",
+      "../RayTracing/src/Renderer.h",
+      "../RayTracing/src/Renderer.cpp",
+      "../RayTracing/src/Scene.h",
+      "../RayTracing/src/SceneFile.h",
+      "../RayTracing/src/SceneFile.cpp",
+      "../RayTracing/src/Scenes.h",
+      "../RayTracing/src/Scenes.cpp",
+      "../RayTracing/src/SphereKernels.h",
+      "../RayTracing/src/SphereKernels.cpp",
+      "../RayTracing/src/ThreadPool.h",
+      "../RayTracing/src/ThreadPool.cpp",
+   }
+
+   includedirs
+   {
+      "../RayTracing/src",
+      "../Walnut/vendor/glm",
+
+      -- Header-only Walnut/Timer.h
+      "../Walnut/Walnut/src",
+   }
+
+   defines { "RT_HEADLESS" }
+
+   targetdir ("../bin/" .. outputdir .. "/%{prj.name}")
+   objdir ("../bin-int/" .. outputdir .. "/%{prj.name}")
+
+   filter "system:windows"
+      systemversion "latest"
+      defines { "WL_PLATFORM_WINDOWS" }
+      links { "ws2_32" }
+
+   filter "system:linux"
+      links { "pthread" }
+
+   filter "configurations:Debug"
+      defines { "WL_DEBUG" }
+      runtime "Debug"
+      symbols "On"
+
+   filter "configurations:Release"
+      defines { "WL_RELEASE" }
+      runtime "Release"
+      optimize "On"
+      symbols "On"
+
+   filter "configurations:Dist"
+      defines { "WL_DIST" }
+      runtime "Release"
+      optimize "On"
+      symbols "Off"
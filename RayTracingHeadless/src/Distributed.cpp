@@ -0,0 +1,531 @@
+#include "Distributed.h"
+
+#include "Walnut/Timer.h"
+
+#include "Camera.h"
+#include "Renderer.h"
+#include "SceneFile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <thread>
+#include <type_traits>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+static_assert(std::is_trivially_copyable<Distributed::JobSettings>::value, "JobSettings is sent as raw bytes");
+
+namespace Distributed {
+	namespace Utils {
+#ifdef _WIN32
+		using Socket = SOCKET;
+		static constexpr Socket InvalidSocket = INVALID_SOCKET;
+		static void CloseSocket(Socket socket) { closesocket(socket); }
+		static int Poll(pollfd* fds, size_t count, int timeoutMs) { return WSAPoll(fds, (ULONG)count, timeoutMs); }
+#else
+		using Socket = int;
+		static constexpr Socket InvalidSocket = -1;
+		static void CloseSocket(Socket socket) { close(socket); }
+		static int Poll(pollfd* fds, size_t count, int timeoutMs) { return poll(fds, (nfds_t)count, timeoutMs); }
+#endif
+
+		static constexpr uint32_t ProtocolMagic = 0x44545452; // "RTTD"
+		static constexpr uint32_t ProtocolVersion = 1;
+		static constexpr uint32_t EndianCheck = 0x01020304;
+
+		// How long a single send or receive may stall before the peer counts as gone
+		static constexpr float TransferTimeoutSeconds = 30.0f;
+		// Workers started before the coordinator keep trying to connect for this long
+		static constexpr float ConnectRetrySeconds = 30.0f;
+		// Largest payload a worker accepts, sizes come off the socket and are checked before anything is allocated
+		static constexpr uint64_t MaxMessageSize = 1ull << 30;
+
+		enum class MessageType : uint32_t
+		{
+			Hello = 1, // worker -> coordinator: HelloMessage
+			Job,       // coordinator -> worker: JobSettings, then the binary scene file
+			Task,      // coordinator -> worker: TaskMessage
+			Result,    // worker -> coordinator: TaskMessage, then Width * Height RGB float sums
+			Done       // coordinator -> worker: no payload
+		};
+
+		struct MessageHeader
+		{
+			uint32_t Magic;
+			uint32_t Type;
+			uint64_t Size; // payload bytes that follow
+		};
+
+		struct HelloMessage
+		{
+			uint32_t Version;
+			uint32_t EndianCheck;
+			uint32_t ThreadCount;
+			uint32_t Reserved;
+		};
+
+		struct TaskMessage
+		{
+			uint32_t FirstSample;
+			uint32_t SampleCount;
+		};
+
+		struct Worker
+		{
+			Socket Handle = InvalidSocket;
+			std::string Name;
+			bool Busy = false;
+			TaskMessage Task = {};
+			Walnut::Timer TaskTimer;
+		};
+
+		static bool InitSockets()
+		{
+#ifdef _WIN32
+			WSADATA data;
+			return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+			// A worker that dies mid-send must not take the coordinator down with it
+			signal(SIGPIPE, SIG_IGN);
+			return true;
+#endif
+		}
+
+		static void SetTimeout(Socket socket, float seconds)
+		{
+#ifdef _WIN32
+			DWORD timeout = (DWORD)(seconds * 1000.0f);
+#else
+			timeval timeout;
+			timeout.tv_sec = (long)seconds;
+			timeout.tv_usec = (long)((seconds - (float)timeout.tv_sec) * 1.0e6f);
+#endif
+			setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+			setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(timeout));
+
+			int enable = 1;
+			setsockopt(socket, SOL_SOCKET, SO_KEEPALIVE, (const char*)&enable, sizeof(enable));
+			setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&enable, sizeof(enable));
+		}
+
+		static bool SendAll(Socket socket, const void* data, size_t size)
+		{
+			const char* bytes = static_cast<const char*>(data);
+			while (size > 0)
+			{
+				int chunk = (int)std::min<size_t>(size, 1 << 30);
+				int sent = (int)send(socket, bytes, chunk, 0);
+				if (sent <= 0)
+					return false;
+				bytes += sent;
+				size -= (size_t)sent;
+			}
+			return true;
+		}
+
+		static bool ReceiveAll(Socket socket, void* data, size_t size)
+		{
+			char* bytes = static_cast<char*>(data);
+			while (size > 0)
+			{
+				int chunk = (int)std::min<size_t>(size, 1 << 30);
+				int received = (int)recv(socket, bytes, chunk, 0);
+				if (received <= 0)
+					return false;
+				bytes += received;
+				size -= (size_t)received;
+			}
+			return true;
+		}
+
+		// The payload may come in two parts so large buffers are not copied together first
+		static bool SendMessage(Socket socket, MessageType type, const void* payload, size_t size, const void* extra = nullptr, size_t extraSize = 0)
+		{
+			MessageHeader header = { ProtocolMagic, (uint32_t)type, (uint64_t)(size + extraSize) };
+			return SendAll(socket, &header, sizeof(header)) &&
+				(size == 0 || SendAll(socket, payload, size)) &&
+				(extraSize == 0 || SendAll(socket, extra, extraSize));
+		}
+
+		static bool ReceiveHeader(Socket socket, MessageHeader& header)
+		{
+			return ReceiveAll(socket, &header, sizeof(header)) && header.Magic == ProtocolMagic;
+		}
+
+		static Socket Listen(uint16_t port)
+		{
+			Socket listener = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+			if (listener == InvalidSocket)
+				return InvalidSocket;
+
+			// Accept IPv4 and IPv6 workers, and allow restarting right after a previous run
+			int enable = 1, disable = 0;
+			setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&enable, sizeof(enable));
+			setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, (const char*)&disable, sizeof(disable));
+
+			sockaddr_in6 address = {};
+			address.sin6_family = AF_INET6;
+			address.sin6_addr = in6addr_any;
+			address.sin6_port = htons(port);
+			if (bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0)
+			{
+				CloseSocket(listener);
+				return InvalidSocket;
+			}
+			return listener;
+		}
+
+		static Socket Connect(const std::string& host, const std::string& port)
+		{
+			addrinfo hints = {};
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			addrinfo* addresses = nullptr;
+			if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0)
+				return InvalidSocket;
+
+			Socket connection = InvalidSocket;
+			for (addrinfo* address = addresses; address && connection == InvalidSocket; address = address->ai_next)
+			{
+				connection = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+				if (connection == InvalidSocket)
+					continue;
+				if (connect(connection, address->ai_addr, (int)address->ai_addrlen) != 0)
+				{
+					CloseSocket(connection);
+					connection = InvalidSocket;
+				}
+			}
+			freeaddrinfo(addresses);
+			return connection;
+		}
+
+		static std::string GetPeerName(Socket socket)
+		{
+			sockaddr_storage address = {};
+			socklen_t length = sizeof(address);
+			char host[NI_MAXHOST] = "?", port[NI_MAXSERV] = "?";
+			if (getpeername(socket, (sockaddr*)&address, &length) == 0)
+				getnameinfo((const sockaddr*)&address, length, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV);
+			return std::string(host) + ":" + port;
+		}
+
+		// Handshake and job for a new connection, false if it is not a usable worker
+		static bool StartWorker(Worker& worker, const JobSettings& job, const std::vector<uint8_t>& sceneData)
+		{
+			SetTimeout(worker.Handle, TransferTimeoutSeconds);
+
+			MessageHeader header;
+			HelloMessage hello;
+			if (!ReceiveHeader(worker.Handle, header) || header.Type != (uint32_t)MessageType::Hello || header.Size != sizeof(hello) ||
+				!ReceiveAll(worker.Handle, &hello, sizeof(hello)))
+			{
+				fprintf(stderr, "Worker %s did not say hello\n", worker.Name.c_str());
+				return false;
+			}
+			if (hello.Version != ProtocolVersion || hello.EndianCheck != EndianCheck)
+			{
+				fprintf(stderr, "Worker %s speaks protocol %u or has the other byte order\n", worker.Name.c_str(), hello.Version);
+				return false;
+			}
+
+			if (!SendMessage(worker.Handle, MessageType::Job, &job, sizeof(job), sceneData.data(), sceneData.size()))
+				return false;
+
+			printf("Worker %s connected, %u threads\n", worker.Name.c_str(), hello.ThreadCount);
+			return true;
+		}
+
+		static void ConfigureRenderer(RayTracing::Renderer& renderer, const JobSettings& job, uint32_t threadCount)
+		{
+			RayTracing::Renderer::Settings& settings = renderer.GetSettings();
+			settings.Accumulate = true;
+			settings.ThreadCount = threadCount;
+			settings.Seed = job.Seed;
+			settings.Integrator = (RayTracing::IntegratorMode)job.Integrator;
+			settings.MaxDiffuseDepth = job.MaxDiffuseDepth;
+			settings.MaxGlassDepth = job.MaxGlassDepth;
+			settings.SphereSIMDLevel = (RayTracing::SIMDLevel)job.SIMDLevel;
+			settings.UseBVH = job.UseBVH != 0;
+			settings.PrimaryRayPackets = job.PrimaryRayPackets != 0;
+			settings.NextEventEstimation = job.NextEventEstimation != 0;
+			settings.RussianRoulette = job.RussianRoulette != 0;
+			// Every pixel must get every sample of its chunks for the sums to add up
+			settings.AdaptiveSampling = false;
+			renderer.OnResize(job.Width, job.Height);
+		}
+	}
+
+	bool RunCoordinator(const Scene& scene, const JobSettings& job, const CoordinatorOptions& options,
+		RayTracing::AccumulationBuffer& accumulation, std::vector<uint32_t>& sampleCounts)
+	{
+		using namespace Utils;
+
+		if (!InitSockets())
+			return false;
+
+		Socket listener = Listen(options.Port);
+		if (listener == InvalidSocket)
+		{
+			fprintf(stderr, "Cannot listen on port %u\n", options.Port);
+			return false;
+		}
+
+		size_t pixelCount = (size_t)job.Width * job.Height;
+		accumulation.Resize(pixelCount, RayTracing::AccumulationFormat::Float32);
+		accumulation.Clear();
+		sampleCounts.assign(pixelCount, 0);
+
+		std::deque<TaskMessage> pending;
+		uint32_t chunkSamples = std::max(job.ChunkSamples, 1u);
+		for (uint32_t first = 0; first < job.SamplesPerPixel; first += chunkSamples)
+			pending.push_back({ first, std::min(chunkSamples, job.SamplesPerPixel - first) });
+		uint32_t chunkCount = (uint32_t)pending.size();
+		uint32_t mergedChunks = 0;
+
+		std::vector<uint8_t> sceneData = SceneFile::SerializeBinary(scene);
+		if (sizeof(job) + sceneData.size() > MaxMessageSize)
+		{
+			fprintf(stderr, "The scene is %zu bytes, workers accept at most %llu\n", sceneData.size(), (unsigned long long)(MaxMessageSize - sizeof(job)));
+			CloseSocket(listener);
+			return false;
+		}
+		std::vector<float> result(pixelCount * 3);
+		std::vector<Worker> workers;
+		printf("Waiting for workers on port %u, %u chunks of %u spp\n", options.Port, chunkCount, chunkSamples);
+
+		// Its chunk goes back to the front of the queue so it is picked up next
+		auto dropWorker = [&](size_t index, const char* reason)
+			{
+				Worker& worker = workers[index];
+				fprintf(stderr, "Dropping worker %s: %s\n", worker.Name.c_str(), reason);
+				if (worker.Busy)
+					pending.push_front(worker.Task);
+				CloseSocket(worker.Handle);
+				workers.erase(workers.begin() + index);
+			};
+
+		std::vector<pollfd> fds;
+		while (mergedChunks < chunkCount)
+		{
+			for (size_t i = 0; i < workers.size();)
+			{
+				Worker& worker = workers[i];
+				if (!worker.Busy && !pending.empty())
+				{
+					worker.Task = pending.front();
+					pending.pop_front();
+					worker.Busy = true;
+					worker.TaskTimer.Reset();
+					if (!SendMessage(worker.Handle, MessageType::Task, &worker.Task, sizeof(worker.Task)))
+					{
+						dropWorker(i, "cannot send task");
+						continue;
+					}
+				}
+				i++;
+			}
+
+			fds.assign(1, { listener, POLLIN, 0 });
+			for (const Worker& worker : workers)
+				fds.push_back({ worker.Handle, POLLIN, 0 });
+
+			// Wake up regularly to check the task timeouts
+			if (Poll(fds.data(), fds.size(), 500) < 0)
+				continue;
+
+			// Back to front, so dropping a worker does not shift the ones still to check
+			for (size_t i = workers.size(); i-- > 0;)
+			{
+				Worker& worker = workers[i];
+				short events = fds[i + 1].revents;
+				if (events & (POLLIN | POLLHUP | POLLERR))
+				{
+					MessageHeader header;
+					TaskMessage task;
+					if (!worker.Busy || !ReceiveHeader(worker.Handle, header) || header.Type != (uint32_t)MessageType::Result ||
+						header.Size != sizeof(task) + result.size() * sizeof(float) || !ReceiveAll(worker.Handle, &task, sizeof(task)) ||
+						task.FirstSample != worker.Task.FirstSample || task.SampleCount != worker.Task.SampleCount ||
+						!ReceiveAll(worker.Handle, result.data(), result.size() * sizeof(float)))
+					{
+						dropWorker(i, "connection lost");
+						continue;
+					}
+
+					for (size_t pixel = 0; pixel < pixelCount; pixel++)
+					{
+						sampleCounts[pixel] += task.SampleCount;
+						accumulation.AddSamples(pixel, glm::vec3(result[pixel * 3 + 0], result[pixel * 3 + 1], result[pixel * 3 + 2]),
+							task.SampleCount, sampleCounts[pixel], 0);
+					}
+					mergedChunks++;
+					worker.Busy = false;
+					printf("Samples %u-%u from %s in %.3fms (%u/%u chunks)\n", task.FirstSample, task.FirstSample + task.SampleCount - 1,
+						worker.Name.c_str(), worker.TaskTimer.ElapsedMillis(), mergedChunks, chunkCount);
+				}
+				else if (worker.Busy && options.WorkerTimeoutSeconds > 0.0f && worker.TaskTimer.Elapsed() > options.WorkerTimeoutSeconds)
+				{
+					dropWorker(i, "timed out");
+				}
+			}
+
+			if (fds[0].revents & POLLIN)
+			{
+				Worker worker;
+				worker.Handle = accept(listener, nullptr, nullptr);
+				if (worker.Handle != InvalidSocket)
+				{
+					worker.Name = GetPeerName(worker.Handle);
+					if (StartWorker(worker, job, sceneData))
+						workers.push_back(worker);
+					else
+						CloseSocket(worker.Handle);
+				}
+			}
+		}
+
+		for (const Worker& worker : workers)
+		{
+			SendMessage(worker.Handle, MessageType::Done, nullptr, 0);
+			CloseSocket(worker.Handle);
+		}
+		CloseSocket(listener);
+		return true;
+	}
+
+	bool RunWorker(const std::string& address, uint32_t threadCount)
+	{
+		using namespace Utils;
+
+		size_t separator = address.rfind(':');
+		if (separator == std::string::npos)
+		{
+			fprintf(stderr, "Expected host:port, got %s\n", address.c_str());
+			return false;
+		}
+		std::string host = address.substr(0, separator);
+		std::string port = address.substr(separator + 1);
+		// [::1]:7878 style IPv6 literals
+		if (host.size() > 2 && host.front() == '[' && host.back() == ']')
+			host = host.substr(1, host.size() - 2);
+
+		if (!InitSockets())
+			return false;
+
+		Socket connection = InvalidSocket;
+		Walnut::Timer connectTimer;
+		while ((connection = Connect(host, port)) == InvalidSocket)
+		{
+			if (connectTimer.Elapsed() > ConnectRetrySeconds)
+			{
+				fprintf(stderr, "Cannot connect to %s\n", address.c_str());
+				return false;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(250));
+		}
+		SetTimeout(connection, TransferTimeoutSeconds);
+
+		HelloMessage hello = { ProtocolVersion, EndianCheck, threadCount ? threadCount : std::max(1u, std::thread::hardware_concurrency()), 0 };
+		MessageHeader header;
+		JobSettings job;
+		std::vector<uint8_t> sceneData;
+		bool received = SendMessage(connection, MessageType::Hello, &hello, sizeof(hello)) &&
+			ReceiveHeader(connection, header) && header.Type == (uint32_t)MessageType::Job && header.Size >= sizeof(job) &&
+			header.Size <= MaxMessageSize && ReceiveAll(connection, &job, sizeof(job));
+		if (received)
+		{
+			sceneData.resize((size_t)(header.Size - sizeof(job)));
+			received = ReceiveAll(connection, sceneData.data(), sceneData.size());
+		}
+		if (!received)
+		{
+			fprintf(stderr, "Did not receive a job from %s\n", address.c_str());
+			CloseSocket(connection);
+			return false;
+		}
+
+		Scene scene;
+		std::string error;
+		if (!SceneFile::LoadBinary(sceneData.data(), sceneData.size(), scene, &error))
+		{
+			fprintf(stderr, "Bad scene from the coordinator: %s\n", error.c_str());
+			CloseSocket(connection);
+			return false;
+		}
+		std::vector<uint8_t>().swap(sceneData);
+
+		Camera camera(job.VerticalFOV, job.NearClip, job.FarClip);
+		camera.OnResize(job.Width, job.Height);
+		RayTracing::Renderer renderer;
+		ConfigureRenderer(renderer, job, threadCount);
+		printf("Rendering %ux%u for %s\n", job.Width, job.Height, address.c_str());
+
+		// Waiting for the next task can take as long as the other workers need
+		SetTimeout(connection, 0.0f);
+
+		size_t pixelCount = (size_t)job.Width * job.Height;
+		std::vector<float> result(pixelCount * 3);
+		while (true)
+		{
+			TaskMessage task;
+			if (!ReceiveHeader(connection, header))
+			{
+				fprintf(stderr, "Lost the coordinator\n");
+				CloseSocket(connection);
+				return false;
+			}
+			if (header.Type == (uint32_t)MessageType::Done)
+				break;
+			if (header.Type != (uint32_t)MessageType::Task || header.Size != sizeof(task) || !ReceiveAll(connection, &task, sizeof(task)))
+			{
+				fprintf(stderr, "Unexpected message from the coordinator\n");
+				CloseSocket(connection);
+				return false;
+			}
+
+			Walnut::Timer taskTimer;
+			renderer.GetSettings().SampleOffset = task.FirstSample;
+			renderer.ResetFrameIndex();
+			for (uint32_t i = 0; i < task.SampleCount; i++)
+				renderer.Render(scene, camera);
+
+			const RayTracing::AccumulationBuffer& accumulation = renderer.GetAccumulation();
+			const uint32_t* sampleCounts = renderer.GetSampleCounts();
+			for (size_t pixel = 0; pixel < pixelCount; pixel++)
+			{
+				glm::vec3 sum = accumulation.GetSum(pixel, sampleCounts[pixel]);
+				result[pixel * 3 + 0] = sum.r;
+				result[pixel * 3 + 1] = sum.g;
+				result[pixel * 3 + 2] = sum.b;
+			}
+
+			SetTimeout(connection, TransferTimeoutSeconds);
+			if (!SendMessage(connection, MessageType::Result, &task, sizeof(task), result.data(), result.size() * sizeof(float)))
+			{
+				fprintf(stderr, "Lost the coordinator\n");
+				CloseSocket(connection);
+				return false;
+			}
+			SetTimeout(connection, 0.0f);
+			printf("Samples %u-%u in %.3fms\n", task.FirstSample, task.FirstSample + task.SampleCount - 1, taskTimer.ElapsedMillis());
+		}
+
+		CloseSocket(connection);
+		return true;
+	}
+}
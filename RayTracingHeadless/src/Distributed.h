@@ -0,0 +1,59 @@
+#pragma once
+
+#include "AccumulationBuffer.h"
+#include "Scene.h"
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Renders one image with several processes over TCP. The coordinator splits the samples per
+// pixel into chunks and hands them to whichever worker is idle. A worker renders its chunk over
+// the whole image with Renderer::Settings::SampleOffset set to the chunk's first sample and
+// sends back the float sums, which the coordinator adds up. Sample k of a pixel is the same
+// path whichever process traces it, so the result matches a single-process render up to the
+// order of the float additions.
+//
+// Chunks of a worker that disconnects, or stops answering for longer than the worker timeout,
+// go back into the queue for the others. Workers may join at any time.
+namespace Distributed {
+	// Everything a worker needs besides the scene. Sent as is, so both ends must share a byte order.
+	struct JobSettings
+	{
+		uint32_t Width = 0;
+		uint32_t Height = 0;
+		uint32_t SamplesPerPixel = 0;
+		// Samples per pixel in one chunk; each finished chunk sends Width * Height * 12 bytes
+		uint32_t ChunkSamples = 8;
+		uint32_t Seed = 0;
+		uint32_t Integrator = 0;
+		uint32_t MaxDiffuseDepth = 8;
+		uint32_t MaxGlassDepth = 16;
+		uint32_t SIMDLevel = 0;
+		uint8_t UseBVH = 1;
+		uint8_t PrimaryRayPackets = 1;
+		uint8_t NextEventEstimation = 1;
+		uint8_t RussianRoulette = 1;
+
+		float VerticalFOV = 45.0f;
+		float NearClip = 0.01f;
+		float FarClip = 100.0f;
+	};
+
+	struct CoordinatorOptions
+	{
+		uint16_t Port = 7878;
+		// A worker that has not returned its chunk after this many seconds is dropped, 0 = never
+		float WorkerTimeoutSeconds = 0.0f;
+	};
+
+	// Serves the job to every worker that connects until all chunks are merged. accumulation
+	// receives the float sums of the samples, sampleCounts the samples per pixel.
+	bool RunCoordinator(const Scene& scene, const JobSettings& job, const CoordinatorOptions& options,
+		RayTracing::AccumulationBuffer& accumulation, std::vector<uint32_t>& sampleCounts);
+
+	// Connects to a coordinator at host:port, retrying for a while so workers can be started
+	// first, and renders chunks until the coordinator is done
+	bool RunWorker(const std::string& address, uint32_t threadCount);
+}
@@ -0,0 +1,658 @@
+#include "Walnut/Timer.h"
+
+#include "Renderer.h"
+#include "Camera.h"
+#include "Checkpoint.h"
+#include "SceneFile.h"
+#include "Scenes.h"
+
+#include "Distributed.h"
+#include "ImageWriter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+struct HeadlessOptions
+{
+	uint32_t Width = 1280;
+	uint32_t Height = 720;
+	uint32_t SamplesPerPixel = 64;
+	uint32_t ThreadCount = 0;
+	uint32_t TileSize = 16;
+	uint32_t Seed = 0;
+	// > 0 renders until every tile is below this noise level, SamplesPerPixel becomes the cap
+	float NoiseThreshold = 0.0f;
+	uint32_t MinSamples = 16;
+	bool Preview = false;
+	RayTracing::IntegratorMode Integrator = RayTracing::IntegratorMode::Recursive;
+	bool UseBVH = true;
+	bool PrimaryRayPackets = true;
+	bool NextEventEstimation = true;
+	uint32_t MaxDiffuseDepth = 8;
+	uint32_t MaxGlassDepth = 16;
+	bool RussianRoulette = true;
+	RayTracing::SIMDLevel SIMDLevel = RayTracing::SIMDLevel::AVX2;
+	RayTracing::AccumulationFormat Accumulation = RayTracing::AccumulationFormat::Float32;
+	// Filter the image guided by the first hit's albedo, normal and depth, see Denoiser.h
+	bool Denoise = false;
+	uint32_t DenoiseIterations = 5;
+	// Written next to the color into an .exr output
+	RayTracing::AOV AOVs = RayTracing::AOV::None;
+	bool Stats = false;
+	// One JSON line of render stats per frame
+	std::string StatsPath;
+	std::string OutputPath = "render.ppm";
+	std::string SceneName = "cornell_box";
+	// Binary or text scene file, replaces SceneName
+	std::string SceneFilePath;
+	// Write the scene as a binary scene file and exit without rendering
+	std::string WriteScenePath;
+	// Wavefront OBJ meshes added to the scene
+	std::vector<std::string> OBJPaths;
+	int OBJMaterial = 1;
+	// > 0 serves the render to --worker processes on this port instead of rendering locally
+	uint16_t CoordinatorPort = 0;
+	uint32_t ChunkSamples = 8;
+	float WorkerTimeout = 0.0f;
+	// host:port of a coordinator, the worker gets everything else from it
+	std::string WorkerAddress;
+	// Accumulation saved every CheckpointInterval seconds and after the last frame
+	std::string CheckpointPath;
+	float CheckpointInterval = 60.0f;
+	// Continue from CheckpointPath instead of starting over, up to SamplesPerPixel in total
+	bool Resume = false;
+};
+
+static bool CreateScene(const std::string& name, Scene& scene)
+{
+	if (name == "cornell_box")
+		scene = Scenes::CornellBox();
+	else if (name == "all_glass")
+		scene = Scenes::AllGlass();
+	else if (name == "many_point_lights")
+		scene = Scenes::ManyPointLights();
+	else if (name == "random_spheres_10k")
+		scene = Scenes::RandomSpheres(10000);
+	else if (name == "random_spheres_100k")
+		scene = Scenes::RandomSpheres(100000);
+	else if (name == "mesh_torus")
+		scene = Scenes::MeshTorus();
+	else
+		return false;
+	return true;
+}
+
+static void PrintUsage(const char* exe)
+{
+	printf("Usage: %s [options]\n", exe);
+	printf("  --width <n>      image width (default 1280)\n");
+	printf("  --height <n>     image height (default 720)\n");
+	printf("  --spp <n>        samples per pixel, one accumulated frame each (default 64)\n");
+	printf("  --threads <n>    worker threads, 0 = all hardware threads (default 0)\n");
+	printf("  --tile <n>       tile size in pixels (default 16)\n");
+	printf("  --seed <n>       random seed, same seed gives the same image (default 0)\n");
+	printf("  --noise <x>      adaptive sampling, stop once every tile's noise is below x, --spp caps it\n");
+	printf("  --min-spp <n>    samples every tile gets before it may stop (default 16)\n");
+	printf("  --preview        use the preview renderer instead of the path tracer\n");
+	printf("  --wavefront      use the wavefront integrator instead of the recursive one\n");
+	printf("  --no-bvh         test every sphere for every ray\n");
+	printf("  --no-packets     trace camera rays one at a time instead of 4x4 packets\n");
+	printf("  --no-nee         find emissive spheres only by bouncing into them\n");
+	printf("  --max-depth <n>  diffuse bounces per path (default 8)\n");
+	printf("  --glass-depth <n> glass refractions per path (default 16)\n");
+	printf("  --no-rr          run every path to the depth limit instead of Russian roulette\n");
+	printf("  --kernel <name>  scalar, sse or avx2, capped to the CPU (default avx2)\n");
+	printf("  --accumulation <f> float, half or rgb9e5 storage of the accumulated samples (default float),\n");
+	printf("                   the compact ones trade a little noise for memory on very large frames\n");
+	printf("  --denoise        filter the output with the a-trous denoiser, .pfm output is denoised too\n");
+	printf("  --denoise-iterations <n> filter iterations, n of them reach 2^(n+1) - 1 pixels across (default 5)\n");
+	printf("  --aov <list>     comma separated depth, normal, albedo, object, material or all, recorded from\n");
+	printf("                   the primary hits and written as extra channels, needs .exr output\n");
+	printf("  --stats          print ray and BVH traversal statistics for the last frame\n");
+	printf("  --stats-json <f> write the render stats of every frame to <f>, one JSON object per line\n");
+	printf("  --scene <name>   cornell_box, all_glass, many_point_lights, random_spheres_10k, random_spheres_100k\n");
+	printf("                   or mesh_torus\n");
+	printf("  --scene-file <f> load a binary (.rtscene) or text scene file instead of a built-in scene\n");
+	printf("  --write-scene <f> write the scene as a binary scene file and exit, converts text scenes\n");
+	printf("  --obj <file>     add a Wavefront OBJ mesh to the scene, can be repeated\n");
+	printf("  --obj-material <n> material of the --obj meshes (default 1, white in the built-in scenes)\n");
+	printf("  --output <file>  .ppm (8-bit), .pfm (linear float) or .exr (linear float plus AOVs) (default render.ppm)\n");
+	printf("  --checkpoint <f> save the accumulation to <f> periodically and after the last frame\n");
+	printf("  --checkpoint-every <s> seconds between checkpoints (default 60)\n");
+	printf("  --resume         continue the render saved in --checkpoint, same scene and settings only\n");
+	printf("  --coordinator <port> split the render into sample chunks for --worker processes and merge them\n");
+	printf("  --chunk-spp <n>  samples per pixel in one chunk handed to a worker (default 8)\n");
+	printf("  --worker-timeout <s> requeue a chunk a worker has not returned after <s> seconds (default never)\n");
+	printf("  --worker <host:port> render chunks for a coordinator, takes only --threads besides\n");
+}
+
+static bool ParseAOVs(const char* list, RayTracing::AOV& aovs)
+{
+	std::string names = list;
+	size_t start = 0;
+	while (start <= names.size())
+	{
+		size_t end = names.find(',', start);
+		if (end == std::string::npos)
+			end = names.size();
+		std::string name = names.substr(start, end - start);
+		start = end + 1;
+
+		if (name == "all")
+		{
+			aovs = aovs | RayTracing::AOV::All;
+			continue;
+		}
+
+		bool found = false;
+		for (uint32_t bit = 1; bit <= (uint32_t)RayTracing::AOV::All; bit <<= 1)
+		{
+			if (name == RayTracing::AOVBuffers::GetName((RayTracing::AOV)bit))
+			{
+				aovs = aovs | (RayTracing::AOV)bit;
+				found = true;
+			}
+		}
+		if (!found)
+			return false;
+	}
+	return true;
+}
+
+static bool EndsWith(const std::string& str, const char* suffix)
+{
+	size_t length = strlen(suffix);
+	return str.size() >= length && str.compare(str.size() - length, length, suffix) == 0;
+}
+
+static bool ParseArgs(int argc, char** argv, HeadlessOptions& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (strcmp(arg, "--width") == 0 && hasValue)
+			options.Width = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--height") == 0 && hasValue)
+			options.Height = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--spp") == 0 && hasValue)
+			options.SamplesPerPixel = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--threads") == 0 && hasValue)
+			options.ThreadCount = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--tile") == 0 && hasValue)
+			options.TileSize = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--seed") == 0 && hasValue)
+			options.Seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--noise") == 0 && hasValue)
+			options.NoiseThreshold = (float)strtod(argv[++i], nullptr);
+		else if (strcmp(arg, "--min-spp") == 0 && hasValue)
+			options.MinSamples = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--preview") == 0)
+			options.Preview = true;
+		else if (strcmp(arg, "--wavefront") == 0)
+			options.Integrator = RayTracing::IntegratorMode::Wavefront;
+		else if (strcmp(arg, "--no-bvh") == 0)
+			options.UseBVH = false;
+		else if (strcmp(arg, "--no-packets") == 0)
+			options.PrimaryRayPackets = false;
+		else if (strcmp(arg, "--no-nee") == 0)
+			options.NextEventEstimation = false;
+		else if (strcmp(arg, "--max-depth") == 0 && hasValue)
+			options.MaxDiffuseDepth = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--glass-depth") == 0 && hasValue)
+			options.MaxGlassDepth = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--no-rr") == 0)
+			options.RussianRoulette = false;
+		else if (strcmp(arg, "--denoise") == 0)
+			options.Denoise = true;
+		else if (strcmp(arg, "--denoise-iterations") == 0 && hasValue)
+			options.DenoiseIterations = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--stats") == 0)
+			options.Stats = true;
+		else if (strcmp(arg, "--aov") == 0 && hasValue)
+		{
+			if (!ParseAOVs(argv[++i], options.AOVs))
+				return false;
+		}
+		else if (strcmp(arg, "--stats-json") == 0 && hasValue)
+			options.StatsPath = argv[++i];
+		else if (strcmp(arg, "--kernel") == 0 && hasValue)
+		{
+			const char* kernel = argv[++i];
+			if (strcmp(kernel, "scalar") == 0)
+				options.SIMDLevel = RayTracing::SIMDLevel::Scalar;
+			else if (strcmp(kernel, "sse") == 0)
+				options.SIMDLevel = RayTracing::SIMDLevel::SSE;
+			else if (strcmp(kernel, "avx2") == 0)
+				options.SIMDLevel = RayTracing::SIMDLevel::AVX2;
+			else
+				return false;
+		}
+		else if (strcmp(arg, "--accumulation") == 0 && hasValue)
+		{
+			const char* format = argv[++i];
+			if (strcmp(format, "float") == 0)
+				options.Accumulation = RayTracing::AccumulationFormat::Float32;
+			else if (strcmp(format, "half") == 0)
+				options.Accumulation = RayTracing::AccumulationFormat::Half;
+			else if (strcmp(format, "rgb9e5") == 0)
+				options.Accumulation = RayTracing::AccumulationFormat::SharedExponent;
+			else
+				return false;
+		}
+		else if (strcmp(arg, "--scene") == 0 && hasValue)
+			options.SceneName = argv[++i];
+		else if (strcmp(arg, "--scene-file") == 0 && hasValue)
+			options.SceneFilePath = argv[++i];
+		else if (strcmp(arg, "--write-scene") == 0 && hasValue)
+			options.WriteScenePath = argv[++i];
+		else if (strcmp(arg, "--obj") == 0 && hasValue)
+			options.OBJPaths.push_back(argv[++i]);
+		else if (strcmp(arg, "--obj-material") == 0 && hasValue)
+			options.OBJMaterial = (int)strtol(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--output") == 0 && hasValue)
+			options.OutputPath = argv[++i];
+		else if (strcmp(arg, "--checkpoint") == 0 && hasValue)
+			options.CheckpointPath = argv[++i];
+		else if (strcmp(arg, "--checkpoint-every") == 0 && hasValue)
+			options.CheckpointInterval = (float)strtod(argv[++i], nullptr);
+		else if (strcmp(arg, "--resume") == 0)
+			options.Resume = true;
+		else if (strcmp(arg, "--coordinator") == 0 && hasValue)
+			options.CoordinatorPort = (uint16_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--chunk-spp") == 0 && hasValue)
+			options.ChunkSamples = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--worker-timeout") == 0 && hasValue)
+			options.WorkerTimeout = (float)strtod(argv[++i], nullptr);
+		else if (strcmp(arg, "--worker") == 0 && hasValue)
+			options.WorkerAddress = argv[++i];
+		else
+			return false;
+	}
+
+	if (options.Resume && options.CheckpointPath.empty())
+		return false;
+	if (options.AOVs != RayTracing::AOV::None && !EndsWith(options.OutputPath, ".exr"))
+		return false;
+	return options.Width > 0 && options.Height > 0 && options.SamplesPerPixel > 0 && options.TileSize > 0 && options.ChunkSamples > 0;
+}
+
+// Converged pixels stop taking samples, so count what was actually traced
+static double CountSamples(const RayTracing::Renderer& renderer)
+{
+	const uint32_t* sampleCounts = renderer.GetSampleCounts();
+	double samples = 0.0;
+	for (uint32_t i = 0; i < renderer.GetWidth() * renderer.GetHeight(); i++)
+		samples += sampleCounts[i];
+	return samples;
+}
+
+// Adaptive sampling and the preview renderer decide per frame what to trace, so they stay local.
+// The denoiser and AOVs need the primary hits, which workers do not send.
+static int RunCoordinator(const Scene& scene, const HeadlessOptions& options)
+{
+	if (options.Preview || options.NoiseThreshold > 0.0f || !options.CheckpointPath.empty() || options.Denoise || options.AOVs != RayTracing::AOV::None)
+	{
+		fprintf(stderr, "--coordinator does not support --preview, --noise, --checkpoint, --denoise or --aov\n");
+		return 1;
+	}
+
+	Distributed::JobSettings job;
+	job.Width = options.Width;
+	job.Height = options.Height;
+	job.SamplesPerPixel = options.SamplesPerPixel;
+	job.ChunkSamples = options.ChunkSamples;
+	job.Seed = options.Seed;
+	job.Integrator = (uint32_t)options.Integrator;
+	job.MaxDiffuseDepth = options.MaxDiffuseDepth;
+	job.MaxGlassDepth = options.MaxGlassDepth;
+	job.SIMDLevel = (uint32_t)options.SIMDLevel;
+	job.UseBVH = options.UseBVH;
+	job.PrimaryRayPackets = options.PrimaryRayPackets;
+	job.NextEventEstimation = options.NextEventEstimation;
+	job.RussianRoulette = options.RussianRoulette;
+
+	Distributed::CoordinatorOptions coordinatorOptions;
+	coordinatorOptions.Port = options.CoordinatorPort;
+	coordinatorOptions.WorkerTimeoutSeconds = options.WorkerTimeout;
+
+	Walnut::Timer timer;
+	RayTracing::AccumulationBuffer accumulation;
+	std::vector<uint32_t> sampleCounts;
+	if (!Distributed::RunCoordinator(scene, job, coordinatorOptions, accumulation, sampleCounts))
+		return 1;
+	float elapsedMs = timer.ElapsedMillis();
+
+	double primaryRays = (double)options.Width * options.Height * options.SamplesPerPixel;
+	printf("Total: %.3fms, including waiting for workers\n", elapsedMs);
+	printf("Primary rays: %.3f Mrays/s\n", primaryRays / (elapsedMs * 1000.0));
+
+	bool written;
+	if (EndsWith(options.OutputPath, ".pfm"))
+		written = ImageWriter::WritePFM(options.OutputPath, accumulation, sampleCounts.data(), options.Width, options.Height);
+	else
+		written = ImageWriter::WritePPM(options.OutputPath, accumulation, sampleCounts.data(), options.Width, options.Height);
+
+	if (!written)
+	{
+		fprintf(stderr, "Failed to write %s\n", options.OutputPath.c_str());
+		return 1;
+	}
+
+	printf("Wrote %s\n", options.OutputPath.c_str());
+	return 0;
+}
+
+// Beauty as R, G, B, denoised if it was, then every enabled AOV under the usual compositing names
+static bool WriteEXR(const std::string& path, const RayTracing::Renderer& renderer)
+{
+	uint32_t width = renderer.GetWidth(), height = renderer.GetHeight();
+	size_t pixelCount = (size_t)width * height;
+
+	std::vector<float> beauty[3];
+	const float* color[3];
+	if (renderer.IsDenoised())
+	{
+		for (int c = 0; c < 3; c++)
+			color[c] = renderer.GetDenoiser().GetColor(c);
+	}
+	else
+	{
+		const uint32_t* sampleCounts = renderer.GetSampleCounts();
+		for (int c = 0; c < 3; c++)
+			beauty[c].resize(pixelCount);
+		for (size_t i = 0; i < pixelCount; i++)
+		{
+			glm::vec3 mean = renderer.GetAccumulation().GetMean(i, sampleCounts[i]);
+			for (int c = 0; c < 3; c++)
+				beauty[c][i] = mean[c];
+		}
+		for (int c = 0; c < 3; c++)
+			color[c] = beauty[c].data();
+	}
+
+	std::vector<ImageWriter::EXRChannel> channels;
+	const char* rgb[3] = { "R", "G", "B" };
+	for (int c = 0; c < 3; c++)
+		channels.push_back({ rgb[c], color[c] });
+
+	const RayTracing::AOVBuffers& aovs = renderer.GetAOVs();
+	if (aovs.GetDepth())
+		channels.push_back({ "Z", aovs.GetDepth() });
+	const char* normal[3] = { "normal.X", "normal.Y", "normal.Z" };
+	const char* albedo[3] = { "albedo.R", "albedo.G", "albedo.B" };
+	for (int c = 0; c < 3; c++)
+	{
+		if (aovs.GetNormal(c))
+			channels.push_back({ normal[c], aovs.GetNormal(c) });
+		if (aovs.GetAlbedo(c))
+			channels.push_back({ albedo[c], aovs.GetAlbedo(c) });
+	}
+	if (aovs.GetObjectIndices())
+		channels.push_back({ "objectId", nullptr, aovs.GetObjectIndices() });
+	if (aovs.GetMaterialIndices())
+		channels.push_back({ "materialId", nullptr, aovs.GetMaterialIndices() });
+
+	return ImageWriter::WriteEXR(path, channels, width, height);
+}
+
+int main(int argc, char** argv)
+{
+	HeadlessOptions options;
+	if (!ParseArgs(argc, argv, options))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	if (!options.WorkerAddress.empty())
+		return Distributed::RunWorker(options.WorkerAddress, options.ThreadCount) ? 0 : 1;
+
+	Scene scene;
+	if (!options.SceneFilePath.empty())
+	{
+		Walnut::Timer loadTimer;
+		std::string error;
+		if (!SceneFile::Load(options.SceneFilePath, scene, &error))
+		{
+			fprintf(stderr, "Failed to load %s\n", error.c_str());
+			return 1;
+		}
+		printf("Loaded %s: %zu spheres, %zu triangles, %zu materials, %zu point lights in %.3fms\n", options.SceneFilePath.c_str(), scene.Spheres.size(),
+			scene.Triangles.size(), scene.Materials.size(), scene.PointLights.size(), loadTimer.ElapsedMillis());
+	}
+	else if (!CreateScene(options.SceneName, scene))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	for (const std::string& objPath : options.OBJPaths)
+	{
+		Walnut::Timer loadTimer;
+		std::string error;
+		size_t firstTriangle = scene.Triangles.size();
+		if (options.OBJMaterial < 0 || options.OBJMaterial >= (int)scene.Materials.size())
+		{
+			fprintf(stderr, "The scene has no material %d\n", options.OBJMaterial);
+			return 1;
+		}
+		if (!SceneFile::LoadOBJ(objPath, scene, options.OBJMaterial, &error))
+		{
+			fprintf(stderr, "Failed to load %s\n", error.c_str());
+			return 1;
+		}
+		printf("Loaded %s: %zu triangles in %.3fms\n", objPath.c_str(), scene.Triangles.size() - firstTriangle, loadTimer.ElapsedMillis());
+	}
+
+	if (!options.WriteScenePath.empty())
+	{
+		if (!SceneFile::WriteBinary(options.WriteScenePath, scene))
+		{
+			fprintf(stderr, "Failed to write %s\n", options.WriteScenePath.c_str());
+			return 1;
+		}
+		printf("Wrote %s\n", options.WriteScenePath.c_str());
+		return 0;
+	}
+
+	if (options.CoordinatorPort > 0)
+		return RunCoordinator(scene, options);
+
+	Camera camera(45.0f, 0.01f, 100.0f);
+	RayTracing::Renderer renderer;
+
+	renderer.GetSettings().Accumulate = true;
+	renderer.GetSettings().PreviewRenderer = options.Preview;
+	renderer.GetSettings().Integrator = options.Integrator;
+	renderer.GetSettings().ThreadCount = options.ThreadCount;
+	renderer.GetSettings().TileSize = options.TileSize;
+	renderer.GetSettings().Seed = options.Seed;
+	renderer.GetSettings().UseBVH = options.UseBVH;
+	renderer.GetSettings().PrimaryRayPackets = options.PrimaryRayPackets;
+	renderer.GetSettings().NextEventEstimation = options.NextEventEstimation;
+	renderer.GetSettings().MaxDiffuseDepth = options.MaxDiffuseDepth;
+	renderer.GetSettings().MaxGlassDepth = options.MaxGlassDepth;
+	renderer.GetSettings().RussianRoulette = options.RussianRoulette;
+	renderer.GetSettings().SphereSIMDLevel = options.SIMDLevel;
+	renderer.GetSettings().CollectBVHStats = options.Stats;
+	renderer.GetSettings().AdaptiveSampling = options.NoiseThreshold > 0.0f;
+	renderer.GetSettings().NoiseThreshold = options.NoiseThreshold;
+	renderer.GetSettings().MinSamples = options.MinSamples;
+	renderer.GetSettings().Accumulation = options.Accumulation;
+	renderer.GetSettings().DenoiseIterations = options.DenoiseIterations;
+	renderer.GetSettings().AOVs = options.AOVs;
+
+	renderer.OnResize(options.Width, options.Height);
+	camera.OnResize(options.Width, options.Height);
+
+	RayTracing::SIMDLevel simdLevel = std::min(options.SIMDLevel, RayTracing::CPUFeatures::DetectSIMDLevel());
+	uint32_t threadCount = options.ThreadCount ? options.ThreadCount : std::max(1u, std::thread::hardware_concurrency());
+	const char* integrator = options.Preview ? "preview" : options.Integrator == RayTracing::IntegratorMode::Wavefront ? "wavefront" : "recursive";
+	printf("Rendering %ux%u, %u spp, %s, %u threads, %ux%u tiles, %s sphere kernel\n", options.Width, options.Height, options.SamplesPerPixel,
+		integrator, threadCount, options.TileSize, options.TileSize, RayTracing::SphereKernels::GetName(simdLevel));
+
+	FILE* statsFile = nullptr;
+	if (!options.StatsPath.empty())
+	{
+		statsFile = fopen(options.StatsPath.c_str(), "w");
+		if (!statsFile)
+		{
+			fprintf(stderr, "Failed to open %s\n", options.StatsPath.c_str());
+			return 1;
+		}
+	}
+
+	Checkpoint::CheckpointFile checkpoint;
+	uint32_t resumedFrames = 0;
+	double resumedRays = 0.0;
+	if (!options.CheckpointPath.empty())
+	{
+		uint64_t renderHash = Checkpoint::HashRender(scene, camera, renderer.GetSettings(), options.Width, options.Height);
+		std::string error;
+		if (options.Resume)
+		{
+			if (checkpoint.Open(options.CheckpointPath, &error) && checkpoint.GetRenderHash() != renderHash)
+			{
+				fprintf(stderr, "%s was rendered with another scene, camera or settings\n", options.CheckpointPath.c_str());
+				return 1;
+			}
+			if (!checkpoint.IsOpen() || !checkpoint.Restore(renderer, &error))
+			{
+				fprintf(stderr, "Cannot resume from %s: %s\n", options.CheckpointPath.c_str(), error.c_str());
+				return 1;
+			}
+			resumedFrames = checkpoint.GetFrameIndex() - 1;
+			resumedRays = CountSamples(renderer);
+			printf("Resuming %s after %u frames\n", options.CheckpointPath.c_str(), resumedFrames);
+		}
+		else if (!checkpoint.Create(options.CheckpointPath, options.Width, options.Height,
+			Checkpoint::GetTileCount(renderer.GetSettings(), options.Width, options.Height), options.Accumulation, renderHash, &error))
+		{
+			fprintf(stderr, "Cannot create %s: %s\n", options.CheckpointPath.c_str(), error.c_str());
+			return 1;
+		}
+	}
+
+	Walnut::Timer timer;
+	Walnut::Timer checkpointTimer;
+	float checkpointMs = 0.0f;
+	uint32_t frameCount = resumedFrames;
+	while (frameCount < options.SamplesPerPixel)
+	{
+		// Only the image that gets written is denoised
+		renderer.GetSettings().Denoise = options.Denoise && frameCount + 1 == options.SamplesPerPixel;
+		renderer.Render(scene, camera);
+		frameCount++;
+		if (statsFile)
+			renderer.GetStats().WriteJSON(statsFile);
+		if (renderer.IsConverged())
+		{
+			// Stopped before the last frame, so one more records the first hits of every tile and denoises
+			if (options.Denoise && !renderer.IsDenoised())
+			{
+				renderer.GetSettings().Denoise = true;
+				renderer.Render(scene, camera);
+				frameCount++;
+				if (statsFile)
+					renderer.GetStats().WriteJSON(statsFile);
+			}
+			break;
+		}
+
+		if (checkpoint.IsOpen() && checkpointTimer.Elapsed() >= options.CheckpointInterval)
+		{
+			Walnut::Timer saveTimer;
+			checkpoint.Save(renderer);
+			checkpointMs += saveTimer.ElapsedMillis();
+			checkpointTimer.Reset();
+		}
+	}
+	if (checkpoint.IsOpen() && frameCount > resumedFrames)
+	{
+		Walnut::Timer saveTimer;
+		checkpoint.Save(renderer);
+		checkpointMs += saveTimer.ElapsedMillis();
+	}
+	// A checkpoint that already holds every sample skips the loop, but the denoiser and the AOVs
+	// still need the first hits of one frame. That frame is not saved, so resuming again adds nothing.
+	if (frameCount == resumedFrames && (options.Denoise || options.AOVs != RayTracing::AOV::None))
+	{
+		renderer.GetSettings().Denoise = options.Denoise;
+		renderer.Render(scene, camera);
+		frameCount++;
+		if (statsFile)
+			renderer.GetStats().WriteJSON(statsFile);
+	}
+	float elapsedMs = timer.ElapsedMillis();
+	if (statsFile)
+		fclose(statsFile);
+
+	double primaryRays = CountSamples(renderer);
+
+	uint32_t renderedFrames = std::max(frameCount - resumedFrames, 1u);
+	printf("Total: %.3fms (%.3fms/frame, %u frames)\n", elapsedMs, elapsedMs / renderedFrames, frameCount - resumedFrames);
+	if (checkpoint.IsOpen())
+		printf("Checkpoints: %.3fms saving to %s (%.2f MB)\n", checkpointMs, options.CheckpointPath.c_str(), checkpoint.GetFileSize() / (1024.0 * 1024.0));
+	printf("Primary rays: %.3f Mrays/s\n", (primaryRays - resumedRays) / (elapsedMs * 1000.0));
+	if (options.NoiseThreshold > 0.0f)
+	{
+		printf("Adaptive: %u/%u tiles converged, %.2f average spp\n", renderer.GetConvergedTileCount(), renderer.GetTileCount(),
+			primaryRays / ((double)options.Width * options.Height));
+	}
+
+	const auto& buildStats = renderer.GetBVHBuildStats();
+	printf("BVH build: %.3fms, %u nodes, %u leaves, depth %u\n", buildStats.BuildTimeMs, buildStats.NodeCount, buildStats.LeafCount, buildStats.MaxDepth);
+	const auto& meshBuildStats = renderer.GetMeshBVHBuildStats();
+	if (meshBuildStats.NodeCount > 0)
+		printf("Mesh BVH build: %.3fms, %u nodes, %u leaves, depth %u, %.2f MB\n", meshBuildStats.BuildTimeMs, meshBuildStats.NodeCount,
+			meshBuildStats.LeafCount, meshBuildStats.MaxDepth, meshBuildStats.MemoryBytes / (1024.0 * 1024.0));
+	RayTracing::Renderer::MemoryUsage memory = renderer.GetMemoryUsage();
+	printf("Renderer memory: %.2f MB, %.1f bytes/pixel (%s accumulation %.2f MB)\n", memory.GetTotal() / (1024.0 * 1024.0),
+		(double)memory.GetTotal() / ((double)options.Width * options.Height), RayTracing::AccumulationBuffer::GetName(options.Accumulation),
+		memory.Accumulation / (1024.0 * 1024.0));
+#ifdef RT_ENABLE_STATS
+	if (renderer.IsDenoised())
+		printf("Denoise: %.3fms for the last frame, %u iterations\n", renderer.GetStats().StageMs[(size_t)RayTracing::RenderStage::Denoise], options.DenoiseIterations);
+#endif
+	if (options.Stats)
+	{
+#ifdef RT_ENABLE_STATS
+		const RayTracing::RenderStats& stats = renderer.GetStats();
+		double rays = (double)std::max<uint64_t>(stats.GetTotalRays(), 1);
+		printf("Last frame: %llu camera, %llu bounce, %llu shadow rays, %.2f nodes/ray, %.2f sphere tests/ray, %.2f triangle tests/ray\n", (unsigned long long)stats.CameraRays,
+			(unsigned long long)stats.BounceRays, (unsigned long long)stats.ShadowRays, stats.NodesVisited / rays, stats.SphereTests / rays, stats.TriangleTests / rays);
+		printf("Average path depth: %.3f\n", stats.GetAveragePathDepth());
+#else
+		printf("Render stats are compiled out of Dist builds\n");
+#endif
+	}
+
+	bool written;
+	if (EndsWith(options.OutputPath, ".exr"))
+		written = WriteEXR(options.OutputPath, renderer);
+	else if (EndsWith(options.OutputPath, ".pfm") && renderer.IsDenoised())
+	{
+		const RayTracing::Denoiser& denoiser = renderer.GetDenoiser();
+		const float* planes[3] = { denoiser.GetColor(0), denoiser.GetColor(1), denoiser.GetColor(2) };
+		written = ImageWriter::WritePFM(options.OutputPath, planes, options.Width, options.Height);
+	}
+	else if (EndsWith(options.OutputPath, ".pfm"))
+		written = ImageWriter::WritePFM(options.OutputPath, renderer.GetAccumulation(), renderer.GetSampleCounts(), options.Width, options.Height);
+	else
+		written = ImageWriter::WritePPM(options.OutputPath, renderer.GetImageData(), options.Width, options.Height);
+
+	if (!written)
+	{
+		fprintf(stderr, "Failed to write %s\n", options.OutputPath.c_str());
+		return 1;
+	}
+
+	printf("Wrote %s\n", options.OutputPath.c_str());
+	return 0;
+}
@@ -0,0 +1,188 @@
+#include "ImageWriter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace ImageWriter {
+	namespace Utils {
+		// EXR is little endian throughout, like every platform the renderer runs on
+		template<typename T>
+		static void Append(std::vector<uint8_t>& bytes, const T& value)
+		{
+			const uint8_t* data = reinterpret_cast<const uint8_t*>(&value);
+			bytes.insert(bytes.end(), data, data + sizeof(T));
+		}
+
+		static void AppendString(std::vector<uint8_t>& bytes, const std::string& text)
+		{
+			bytes.insert(bytes.end(), text.begin(), text.end());
+			bytes.push_back(0);
+		}
+
+		static void AppendAttribute(std::vector<uint8_t>& bytes, const char* name, const char* type, const std::vector<uint8_t>& value)
+		{
+			AppendString(bytes, name);
+			AppendString(bytes, type);
+			Append(bytes, (int32_t)value.size());
+			bytes.insert(bytes.end(), value.begin(), value.end());
+		}
+	}
+
+	bool WritePPM(const std::string& path, const uint32_t* pixels, uint32_t width, uint32_t height)
+	{
+		FILE* file = fopen(path.c_str(), "wb");
+		if (!file)
+			return false;
+
+		fprintf(file, "P6\n%u %u\n255\n", width, height);
+
+		std::vector<uint8_t> row(width * 3);
+		for (uint32_t y = height; y-- > 0;)
+		{
+			for (uint32_t x = 0; x < width; x++)
+			{
+				uint32_t pixel = pixels[x + y * width];
+				row[x * 3 + 0] = (uint8_t)(pixel & 0xff);
+				row[x * 3 + 1] = (uint8_t)((pixel >> 8) & 0xff);
+				row[x * 3 + 2] = (uint8_t)((pixel >> 16) & 0xff);
+			}
+			fwrite(row.data(), 1, row.size(), file);
+		}
+
+		return fclose(file) == 0;
+	}
+
+	bool WritePPM(const std::string& path, const RayTracing::AccumulationBuffer& accumulation, const uint32_t* sampleCounts, uint32_t width, uint32_t height)
+	{
+		std::vector<uint32_t> resolved((size_t)width * height);
+		for (size_t i = 0; i < resolved.size(); i++)
+		{
+			glm::vec3 color = accumulation.GetMean(i, sampleCounts[i]);
+			color = glm::clamp(glm::sqrt(color), 0.0f, 1.0f);
+			uint8_t r = (uint8_t)(color.r * 255.0f);
+			uint8_t g = (uint8_t)(color.g * 255.0f);
+			uint8_t b = (uint8_t)(color.b * 255.0f);
+			resolved[i] = 0xff000000 | (b << 16) | (g << 8) | r;
+		}
+		return WritePPM(path, resolved.data(), width, height);
+	}
+
+	bool WritePFM(const std::string& path, const RayTracing::AccumulationBuffer& accumulation, const uint32_t* sampleCounts, uint32_t width, uint32_t height)
+	{
+		FILE* file = fopen(path.c_str(), "wb");
+		if (!file)
+			return false;
+
+		// Negative scale = little endian. PFM scanlines are stored bottom to top already.
+		fprintf(file, "PF\n%u %u\n-1.0\n", width, height);
+
+		std::vector<float> row(width * 3);
+		for (uint32_t y = 0; y < height; y++)
+		{
+			for (uint32_t x = 0; x < width; x++)
+			{
+				uint32_t index = x + y * width;
+				glm::vec3 mean = accumulation.GetMean(index, sampleCounts[index]);
+				row[x * 3 + 0] = mean.r;
+				row[x * 3 + 1] = mean.g;
+				row[x * 3 + 2] = mean.b;
+			}
+			fwrite(row.data(), sizeof(float), row.size(), file);
+		}
+
+		return fclose(file) == 0;
+	}
+
+	bool WritePFM(const std::string& path, const float* const planes[3], uint32_t width, uint32_t height)
+	{
+		FILE* file = fopen(path.c_str(), "wb");
+		if (!file)
+			return false;
+
+		fprintf(file, "PF\n%u %u\n-1.0\n", width, height);
+
+		std::vector<float> row(width * 3);
+		for (uint32_t y = 0; y < height; y++)
+		{
+			for (uint32_t x = 0; x < width; x++)
+			{
+				for (int c = 0; c < 3; c++)
+					row[x * 3 + c] = planes[c][x + y * width];
+			}
+			fwrite(row.data(), sizeof(float), row.size(), file);
+		}
+
+		return fclose(file) == 0;
+	}
+
+	bool WriteEXR(const std::string& path, std::vector<EXRChannel> channels, uint32_t width, uint32_t height)
+	{
+		std::sort(channels.begin(), channels.end(), [](const EXRChannel& a, const EXRChannel& b) { return a.Name < b.Name; });
+
+		constexpr int32_t UIntType = 0, FloatType = 2;
+		std::vector<uint8_t> channelList;
+		for (const EXRChannel& channel : channels)
+		{
+			Utils::AppendString(channelList, channel.Name);
+			Utils::Append(channelList, channel.Float ? FloatType : UIntType);
+			Utils::Append(channelList, (uint32_t)0); // pLinear and reserved
+			Utils::Append(channelList, (int32_t)1); // x sampling
+			Utils::Append(channelList, (int32_t)1); // y sampling
+		}
+		channelList.push_back(0);
+
+		std::vector<uint8_t> window;
+		for (int32_t value : { 0, 0, (int32_t)width - 1, (int32_t)height - 1 })
+			Utils::Append(window, value);
+		std::vector<uint8_t> one, zero2;
+		Utils::Append(one, 1.0f);
+		Utils::Append(zero2, 0.0f);
+		Utils::Append(zero2, 0.0f);
+
+		std::vector<uint8_t> header;
+		Utils::Append(header, (uint32_t)20000630); // magic
+		Utils::Append(header, (uint32_t)2); // version 2, single part scanline
+		Utils::AppendAttribute(header, "channels", "chlist", channelList);
+		Utils::AppendAttribute(header, "compression", "compression", { 0 });
+		Utils::AppendAttribute(header, "dataWindow", "box2i", window);
+		Utils::AppendAttribute(header, "displayWindow", "box2i", window);
+		Utils::AppendAttribute(header, "lineOrder", "lineOrder", { 0 }); // increasing y
+		Utils::AppendAttribute(header, "pixelAspectRatio", "float", one);
+		Utils::AppendAttribute(header, "screenWindowCenter", "v2f", zero2);
+		Utils::AppendAttribute(header, "screenWindowWidth", "float", one);
+		header.push_back(0);
+
+		// Uncompressed files have one scanline per chunk: y, byte count, then each channel's row
+		uint64_t lineBytes = (uint64_t)width * 4 * channels.size();
+		uint64_t chunkBytes = 8 + lineBytes;
+		uint64_t firstChunk = header.size() + (uint64_t)height * sizeof(uint64_t);
+		for (uint32_t y = 0; y < height; y++)
+			Utils::Append(header, firstChunk + y * chunkBytes);
+
+		FILE* file = fopen(path.c_str(), "wb");
+		if (!file)
+			return false;
+		fwrite(header.data(), 1, header.size(), file);
+
+		std::vector<uint8_t> chunk(chunkBytes);
+		for (uint32_t y = 0; y < height; y++)
+		{
+			// EXR rows run top to bottom
+			size_t row = (size_t)(height - 1 - y) * width;
+			int32_t lineHeader[2] = { (int32_t)y, (int32_t)lineBytes };
+			memcpy(chunk.data(), lineHeader, sizeof(lineHeader));
+			uint8_t* data = chunk.data() + sizeof(lineHeader);
+			for (const EXRChannel& channel : channels)
+			{
+				const void* source = channel.Float ? (const void*)(channel.Float + row) : (const void*)(channel.UInt + row);
+				memcpy(data, source, (size_t)width * 4);
+				data += (size_t)width * 4;
+			}
+			fwrite(chunk.data(), 1, chunk.size(), file);
+		}
+
+		return fclose(file) == 0;
+	}
+}
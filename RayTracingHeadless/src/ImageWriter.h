@@ -0,0 +1,34 @@
+#pragma once
+
+#include "AccumulationBuffer.h"
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ImageWriter {
+	// Renderer rows run bottom to top, both writers take care of the flip.
+
+	// Binary 8-bit RGB (P6) from packed RGBA8 pixels
+	bool WritePPM(const std::string& path, const uint32_t* pixels, uint32_t width, uint32_t height);
+	// Binary 8-bit RGB (P6) from accumulated samples, resolved the way the renderer does it
+	bool WritePPM(const std::string& path, const RayTracing::AccumulationBuffer& accumulation, const uint32_t* sampleCounts, uint32_t width, uint32_t height);
+
+	// Little-endian 32-bit float RGB (PF), the mean of each pixel's samples
+	bool WritePFM(const std::string& path, const RayTracing::AccumulationBuffer& accumulation, const uint32_t* sampleCounts, uint32_t width, uint32_t height);
+	// Little-endian 32-bit float RGB (PF) from one plane per channel, for the denoised image
+	bool WritePFM(const std::string& path, const float* const planes[3], uint32_t width, uint32_t height);
+
+	// One channel of a multi-channel image, a plane in renderer row order. Set Float or UInt.
+	struct EXRChannel
+	{
+		std::string Name;
+		const float* Float = nullptr;
+		const uint32_t* UInt = nullptr;
+	};
+
+	// Uncompressed scanline OpenEXR with any number of named 32-bit float or unsigned int channels,
+	// readable by compositing tools. Channels are sorted by name as the format requires.
+	bool WriteEXR(const std::string& path, std::vector<EXRChannel> channels, uint32_t width, uint32_t height);
+}
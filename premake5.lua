@@ -1,10 +1,25 @@
 -- premake5.lua
+newoption
+{
+   trigger = "headless",
+   description = "Only generate the offline renderer (no Walnut/Vulkan/ImGui), for GPU-less render nodes"
+}
+
 workspace "RayTracing"
    architecture "x64"
    configurations { "Debug", "Release", "Dist" }
-   startproject "RayTracing"
+   if _OPTIONS["headless"] then
+      startproject "RayTracingHeadless"
+   else
+      startproject "RayTracing"
+   end
 
 outputdir = "%{cfg.buildcfg}-%{cfg.system}-%{cfg.architecture}"
-include "Walnut/WalnutExternal.lua"
+if not _OPTIONS["headless"] then
+   include "Walnut/WalnutExternal.lua"
+
+   include "RayTracing"
+end
 
-include "RayTracing"
\ No newline at end of file
+include "RayTracingHeadless"
+include "RayTracingBenchmark"
@@ -0,0 +1,5 @@
+#!/bin/sh
+# Generates makefiles for the offline renderer only (premake5 must be on PATH)
+
+cd "$(dirname "$0")/.."
+premake5 --headless gmake2